@@ -2,7 +2,10 @@
 #define _WXRC_BACKEND_H
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <time.h>
 #include <openxr/openxr.h>
 #include <openxr/openxr_platform.h>
 #include <wlr/backend/interface.h>
@@ -16,33 +19,237 @@ struct wxrc_xr_view {
 	uint32_t nimages;
 	XrSwapchainImageOpenGLESKHR *images;
 	GLuint *framebuffers;
+	/* Only used if the view has no depth swapchain */
 	GLuint depth_buffer;
+	/* Multiview only: one framebuffer per image and layer, indexed by
+	 * image * nlayers + layer */
+	uint32_t nlayers;
+	GLuint *layer_framebuffers;
+
+	/* Depth swapchain submitted along with the color one, XR_NULL_HANDLE
+	 * unless the runtime supports XR_KHR_composition_layer_depth. Its
+	 * images are acquired and released along with the color ones. */
+	XrSwapchain depth_swapchain;
+	uint32_t ndepth_images;
+	XrSwapchainImageOpenGLESKHR *depth_images;
+	uint32_t depth_image_index;
+	/* Multiview only: depth texture attached to each framebuffer */
+	GLuint *depth_attachments;
 
 	struct wxrc_zxr_view_v1 *wl_view;
 };
 
+struct wxrc_trace;
+struct wxrc_xr_backend;
+
+/**
+ * Implementation of the XR side of the backend. All functions are called from
+ * the render thread with the render context current, except start and destroy
+ * which are called from the Wayland thread (also with the render context
+ * current).
+ */
+struct wxrc_xr_backend_impl {
+	/* Must set nviews and views */
+	bool (*start)(struct wxrc_xr_backend *backend);
+	void (*destroy)(struct wxrc_xr_backend *backend);
+	bool (*begin_session)(struct wxrc_xr_backend *backend);
+	bool (*end_session)(struct wxrc_xr_backend *backend);
+	bool (*get_timespec)(struct wxrc_xr_backend *backend, XrTime time,
+		struct timespec *ts);
+	XrResult (*poll_event)(struct wxrc_xr_backend *backend,
+		XrEventDataBuffer *event);
+	XrResult (*wait_frame)(struct wxrc_xr_backend *backend,
+		XrFrameState *frame_state);
+	XrResult (*begin_frame)(struct wxrc_xr_backend *backend);
+	XrResult (*locate_views)(struct wxrc_xr_backend *backend,
+		XrTime display_time, XrView *xr_views);
+	/* Acquires a swapchain image and waits until it can be rendered to */
+	XrResult (*acquire_image)(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view, uint32_t *image_index);
+	XrResult (*release_image)(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view);
+	/* Must set the swapchain, nimages and images of a view whose config
+	 * has been filled, with single-layer images */
+	bool (*create_quad_swapchain)(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view);
+	/* Must release what create_quad_swapchain has set */
+	void (*destroy_quad_swapchain)(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view);
+	XrResult (*end_frame)(struct wxrc_xr_backend *backend,
+		const XrFrameEndInfo *frame_end_info);
+};
+
 struct wxrc_xr_backend {
 	struct wlr_backend base;
+	const struct wxrc_xr_backend_impl *impl;
 
 	bool started;
 
 	struct wlr_egl *egl;
 	struct wlr_renderer *renderer;
+	/* Shares objects with the wlroots context, used by the render thread */
+	EGLContext render_context;
 
 	XrInstance instance;
 	XrSystemId sysid;
 	XrSession session;
+	XrSessionState session_state;
+	bool session_running;
 
 	XrSpace local_space;
+	int64_t swapchain_format;
 
 	uint32_t nviews;
 	struct wxrc_xr_view *views;
 
+	/* Limits of the XR system */
+	uint32_t max_layers;
+	uint32_t max_swapchain_width, max_swapchain_height;
+
+	/* Render all views in a single pass into one array swapchain, owned by
+	 * views[0]. Set before starting the backend to request it, cleared on
+	 * start if unsupported. */
+	bool multiview;
+	/* GL_OVR_multiview entry point, only set with multiview */
+	PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC glFramebufferTextureMultiviewOVR;
+
+	/* EGL_KHR_fence_sync, NULL if unsupported */
+	PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+	PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+	PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
+
+	/* XR_KHR_composition_layer_depth is enabled, views have depth
+	 * swapchains if the runtime also supports a depth format */
+	bool depth_layers;
+
+	/* XR_KHR_convert_timespec_time, NULL if unsupported */
+	PFN_xrConvertTimeToTimespecTimeKHR xrConvertTimeToTimespecTimeKHR;
+
 	struct wl_listener local_display_destroy;
 };
 
 bool wxrc_backend_is_xr(struct wlr_backend *wlr_backend);
 struct wxrc_xr_backend *wxrc_xr_backend_create(
 		struct wl_display *display, struct wlr_renderer *renderer);
+/**
+ * Creates a backend which doesn't need an XR runtime nor a headset. It renders
+ * to offscreen framebuffers at a fixed rate, from a synthetic head trajectory.
+ */
+struct wxrc_xr_backend *wxrc_null_xr_backend_create(
+		struct wl_display *display, struct wlr_renderer *renderer);
+/**
+ * Makes a null backend follow the head poses of a replayed trace instead of
+ * its synthetic trajectory, and exit once all frames have been replayed. Must
+ * be called before the render thread is started.
+ */
+void wxrc_null_xr_backend_set_trace(struct wxrc_xr_backend *backend,
+	struct wxrc_trace *trace);
+
+/**
+ * Initializes the common parts of a backend. Used by backend implementations.
+ */
+void wxrc_xr_backend_init(struct wxrc_xr_backend *backend,
+	const struct wxrc_xr_backend_impl *impl, struct wl_display *display,
+	struct wlr_renderer *renderer);
+/**
+ * Creates the framebuffers and depth buffer for a view. The view's config and
+ * images must be set. Used by backend implementations.
+ */
+bool wxrc_xr_view_init_framebuffers(struct wxrc_xr_view *view);
+/**
+ * Creates multiview framebuffers for a view whose images are 2D array
+ * textures with one layer per XR view. Used by backend implementations.
+ */
+bool wxrc_xr_view_init_multiview_framebuffers(struct wxrc_xr_backend *backend,
+	struct wxrc_xr_view *view);
+/**
+ * Returns the depth texture to render an image of the view with: the acquired
+ * depth swapchain image if there is one, the view's depth buffer otherwise.
+ */
+GLuint wxrc_xr_view_get_depth_texture(struct wxrc_xr_view *view);
+/**
+ * Attaches the acquired depth swapchain image to a multiview framebuffer and
+ * its layer framebuffers, if it isn't already.
+ */
+void wxrc_xr_view_update_multiview_depth(struct wxrc_xr_backend *backend,
+	struct wxrc_xr_view *view, uint32_t image_index);
+/**
+ * Number of swapchains frames are rendered to: one per view, or a single one
+ * with multiview.
+ */
+uint32_t wxrc_xr_backend_get_nswapchains(struct wxrc_xr_backend *backend);
+
+/**
+ * Makes the render context current on the calling thread. The XR session,
+ * swapchains and their framebuffers can only be used with this context.
+ */
+bool wxrc_xr_backend_make_current(struct wxrc_xr_backend *backend);
+void wxrc_xr_backend_unset_current(struct wxrc_xr_backend *backend);
+
+/**
+ * Begins or ends the XR session, as requested by the runtime via session state
+ * changes. Frames can only be submitted while the session is running.
+ */
+bool wxrc_xr_backend_begin_session(struct wxrc_xr_backend *backend);
+bool wxrc_xr_backend_end_session(struct wxrc_xr_backend *backend);
+
+XrResult wxrc_xr_backend_poll_event(struct wxrc_xr_backend *backend,
+	XrEventDataBuffer *event);
+XrResult wxrc_xr_backend_wait_frame(struct wxrc_xr_backend *backend,
+	XrFrameState *frame_state);
+XrResult wxrc_xr_backend_begin_frame(struct wxrc_xr_backend *backend);
+XrResult wxrc_xr_backend_locate_views(struct wxrc_xr_backend *backend,
+	XrTime display_time, XrView *xr_views);
+XrResult wxrc_xr_backend_acquire_image(struct wxrc_xr_backend *backend,
+	uint32_t view_index, uint32_t *image_index);
+XrResult wxrc_xr_backend_release_image(struct wxrc_xr_backend *backend,
+	uint32_t view_index);
+XrResult wxrc_xr_backend_acquire_swapchain_image(
+	struct wxrc_xr_backend *backend, struct wxrc_xr_view *view,
+	uint32_t *image_index);
+XrResult wxrc_xr_backend_release_swapchain_image(
+	struct wxrc_xr_backend *backend, struct wxrc_xr_view *view);
+
+/**
+ * Creates a swapchain for a quad composition layer. It isn't part of the
+ * backend's views, and its framebuffers have no depth buffer. Must be called
+ * from the render thread.
+ */
+struct wxrc_xr_view *wxrc_xr_backend_create_quad_swapchain(
+	struct wxrc_xr_backend *backend, uint32_t width, uint32_t height);
+void wxrc_xr_backend_destroy_quad_swapchain(struct wxrc_xr_backend *backend,
+	struct wxrc_xr_view *view);
+XrResult wxrc_xr_backend_end_frame(struct wxrc_xr_backend *backend,
+	const XrFrameEndInfo *frame_end_info);
+
+/**
+ * Converts an XrTime to a CLOCK_MONOTONIC timestamp. Falls back to the current
+ * time and returns false if the runtime can't convert times.
+ */
+bool wxrc_xr_backend_get_timespec(struct wxrc_xr_backend *backend,
+		XrTime time, struct timespec *ts);
+
+/**
+ * Inserts a fence after the GL commands submitted so far and flushes them.
+ * Returns EGL_NO_SYNC_KHR if fences aren't supported, in which case the GL
+ * commands have been completed with glFinish.
+ */
+EGLSyncKHR wxrc_xr_backend_create_fence(struct wxrc_xr_backend *backend);
+/**
+ * Returns true if the fence has been signaled. Doesn't block.
+ */
+bool wxrc_xr_backend_fence_signaled(struct wxrc_xr_backend *backend,
+		EGLSyncKHR fence);
+/**
+ * Blocks until the fence is signaled, then destroys it.
+ */
+void wxrc_xr_backend_wait_fence(struct wxrc_xr_backend *backend,
+		EGLSyncKHR fence);
+/**
+ * Destroys a fence without waiting for it. Does nothing if the fence is
+ * EGL_NO_SYNC_KHR.
+ */
+void wxrc_xr_backend_destroy_fence(struct wxrc_xr_backend *backend,
+		EGLSyncKHR fence);
 
 #endif
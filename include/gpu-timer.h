@@ -0,0 +1,67 @@
+#ifndef _WXRC_GPU_TIMER_H
+#define _WXRC_GPU_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include "timing.h"
+
+/* Maximum number of timed passes per frame, later ones aren't timed */
+#define WXRC_GPU_TIMER_MAX_QUERIES 32
+/* Results are read back this many frames later, so that reading them never
+ * waits for the GPU */
+#define WXRC_GPU_TIMER_NFRAMES 2
+
+struct wxrc_gpu_timer_frame {
+	GLuint queries[WXRC_GPU_TIMER_MAX_QUERIES];
+	enum wxrc_gpu_pass passes[WXRC_GPU_TIMER_MAX_QUERIES];
+	size_t nqueries;
+};
+
+/**
+ * Measures the GPU time of render passes with GL_EXT_disjoint_timer_query.
+ * Queries are per context, each wxrc_gl has its own timer.
+ */
+struct wxrc_gpu_timer {
+	bool enabled;
+	struct wxrc_gpu_timer_frame frames[WXRC_GPU_TIMER_NFRAMES];
+	size_t current;
+	/* Whether the last query of the current frame is still running */
+	bool running;
+
+	PFNGLGENQUERIESEXTPROC glGenQueriesEXT;
+	PFNGLDELETEQUERIESEXTPROC glDeleteQueriesEXT;
+	PFNGLBEGINQUERYEXTPROC glBeginQueryEXT;
+	PFNGLENDQUERYEXTPROC glEndQueryEXT;
+	PFNGLGETQUERYOBJECTUIVEXTPROC glGetQueryObjectuivEXT;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
+};
+
+/**
+ * Initializes the timer for the current context. Returns false if passes
+ * can't be timed, in which case all other functions are no-ops.
+ */
+bool wxrc_gpu_timer_init(struct wxrc_gpu_timer *timer);
+void wxrc_gpu_timer_finish(struct wxrc_gpu_timer *timer);
+/**
+ * Starts a new frame, and collects the results of the frame which started
+ * WXRC_GPU_TIMER_NFRAMES frames earlier. Returns false if they aren't
+ * available, e.g. because the GPU isn't done with that frame yet or has been
+ * reset since.
+ */
+bool wxrc_gpu_timer_begin_frame(struct wxrc_gpu_timer *timer,
+	int64_t pass_ns[static WXRC_GPU_PASS_COUNT]);
+/**
+ * Starts timing a pass, ending the previous one if it's still running. Passes
+ * may be timed several times per frame, their durations add up.
+ */
+void wxrc_gpu_timer_begin(struct wxrc_gpu_timer *timer,
+	enum wxrc_gpu_pass pass);
+/**
+ * Ends the running pass, if any.
+ */
+void wxrc_gpu_timer_end(struct wxrc_gpu_timer *timer);
+
+#endif
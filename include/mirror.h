@@ -0,0 +1,105 @@
+#ifndef _WXRC_MIRROR_H
+#define _WXRC_MIRROR_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WXRC_MIRROR_NSLOTS 3
+/* Flags the latest slot until the Wayland thread picks it up */
+#define WXRC_MIRROR_FRESH (1 << 8)
+/* Value of latest once the render thread is done with the copies, until the
+ * Wayland thread deletes them */
+#define WXRC_MIRROR_RELEASED -2
+
+struct wxrc_xr_backend;
+
+/**
+ * Downsampled copies of the first eye's image, shown on the desktop outputs
+ * instead of rendering the scene a third time. Copies are triple buffered, so
+ * that neither thread ever waits for the other: the render thread always has
+ * a slot to write to, and the Wayland thread a slot to read from.
+ */
+struct wxrc_mirror {
+	/* In the share group of both contexts */
+	GLuint textures[WXRC_MIRROR_NSLOTS];
+	uint32_t width, height;
+	/* Signaled once the Wayland thread's context is done sampling a slot it
+	 * has handed back, EGL_NO_SYNC_KHR if it wasn't sampled or once the
+	 * render thread has seen it signaled. Owned by the thread which owns
+	 * the slot. */
+	EGLSyncKHR fences[WXRC_MIRROR_NSLOTS];
+
+	/* Only accessed from the render thread. Framebuffers aren't shared
+	 * between contexts. */
+	GLuint framebuffers[WXRC_MIRROR_NSLOTS];
+	int write_slot;
+	/* Copies are made at most once per interval */
+	int64_t interval_ns;
+	int64_t last_copy_ns;
+
+	/* Only accessed from the Wayland thread once it has seen a fresh
+	 * copy */
+	int read_slot;
+	bool has_read;
+
+	/* Slot of the latest copy, with WXRC_MIRROR_FRESH set until the
+	 * Wayland thread picks it up. -1 until the copies are created, and
+	 * once they're deleted. WXRC_MIRROR_RELEASED in between: the textures
+	 * are deleted by the Wayland thread, which may still be sampling one
+	 * of them when the render thread releases them. */
+	atomic_int latest;
+};
+
+/**
+ * Initializes a mirror with no copies, for the Wayland thread. Called before
+ * the render thread is started.
+ */
+void wxrc_mirror_init(struct wxrc_mirror *mirror);
+/**
+ * Creates the textures copies are made to. Called from the render thread.
+ * Fails if the textures of earlier copies haven't been deleted yet.
+ */
+bool wxrc_mirror_init_copies(struct wxrc_mirror *mirror, uint32_t width,
+	uint32_t height, int64_t interval_ns);
+/**
+ * Releases the copies. Called from the render thread, the Wayland thread stops
+ * using them and deletes their textures with wxrc_mirror_reclaim.
+ */
+void wxrc_mirror_finish(struct wxrc_mirror *mirror);
+/**
+ * Deletes the textures of released copies. Called from the Wayland thread,
+ * with a context of the share group current.
+ */
+void wxrc_mirror_reclaim(struct wxrc_mirror *mirror,
+	struct wxrc_xr_backend *backend);
+/**
+ * Returns the framebuffer to make the next copy to, or 0 if the last one is
+ * too recent or the Wayland thread's context is still sampling the slot.
+ * Called from the render thread.
+ */
+GLuint wxrc_mirror_begin_copy(struct wxrc_mirror *mirror,
+	struct wxrc_xr_backend *backend, int64_t now_ns);
+/**
+ * Hands the copy made since wxrc_mirror_begin_copy over to the Wayland thread.
+ * The GPU must be done with it. Called from the render thread.
+ */
+void wxrc_mirror_publish(struct wxrc_mirror *mirror);
+/**
+ * Picks up the latest copy, or reclaims released copies. Returns true if it's
+ * newer than the one picked up before, in which case the previous one is
+ * handed back to the render thread. Called from the Wayland thread, with the
+ * context which sampled the previous copy current.
+ */
+bool wxrc_mirror_acquire(struct wxrc_mirror *mirror,
+	struct wxrc_xr_backend *backend);
+/**
+ * Returns the texture of the copy last picked up, or 0 if there's none. Called
+ * from the Wayland thread.
+ */
+GLuint wxrc_mirror_get_texture(struct wxrc_mirror *mirror);
+
+#endif
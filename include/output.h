@@ -1,11 +1,15 @@
 #ifndef _WXRC_OUTPUT_H
 #define _WXRC_OUTPUT_H
 
+#include <stdbool.h>
 #include <wayland-server-core.h>
 
 struct wxrc_output {
 	struct wlr_output *output;
 	struct wxrc_server *server;
+	struct wl_list link; // wxrc_server.outputs
+	/* A mirror copy has been picked up since the last frame */
+	bool mirror_damaged;
 
 	struct wl_listener frame;
 	struct wl_listener destroy;
@@ -0,0 +1,48 @@
+#ifndef _WXRC_PROGRAM_CACHE_H
+#define _WXRC_PROGRAM_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+/**
+ * Persists linked programs with GL_OES_get_program_binary, so that they don't
+ * need to be compiled again on the next start. Programs are stored in
+ * $XDG_CACHE_HOME/wxrc, one file per program, named after a hash of the
+ * driver and of everything the program is built from.
+ */
+struct wxrc_program_cache {
+	/* NULL if programs aren't cached */
+	char *dir;
+	/* Hash of the strings identifying the driver, part of all keys */
+	uint64_t driver_hash;
+	PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+	PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
+};
+
+/**
+ * Initializes the cache for the current context. Returns false if programs
+ * can't be cached, in which case all other functions are no-ops.
+ */
+bool wxrc_program_cache_init(struct wxrc_program_cache *cache);
+void wxrc_program_cache_finish(struct wxrc_program_cache *cache);
+/**
+ * Computes the key of a program built from the given strings, e.g. shader
+ * sources and attribute bindings, with the current driver.
+ */
+uint64_t wxrc_program_cache_key(struct wxrc_program_cache *cache,
+	const char *const *strings, size_t nstrings);
+/**
+ * Returns a new linked program loaded from the cache, or 0 on a cache miss.
+ */
+GLuint wxrc_program_cache_load(struct wxrc_program_cache *cache,
+	uint64_t key);
+/**
+ * Stores a linked program in the cache.
+ */
+void wxrc_program_cache_store(struct wxrc_program_cache *cache,
+	uint64_t key, GLuint program);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _WXRC_RENDER_THREAD_H
+#define _WXRC_RENDER_THREAD_H
+
+#include <openxr/openxr.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include "mirror.h"
+#include "render.h"
+#include "resolution.h"
+
+struct wxrc_scene;
+struct wxrc_server;
+
+struct wxrc_render_thread_frame_event {
+	/* False if nothing has been displayed, e.g. the session is hidden */
+	bool visible;
+	/* Number of frames submitted to the runtime before this one */
+	uint64_t frame_number;
+	/* When the frame is going to be displayed, CLOCK_MONOTONIC */
+	struct timespec display_time;
+};
+
+/**
+ * Runs the OpenXR frame loop and renders on its own thread, so that Wayland
+ * clients can't delay XR frames. The Wayland thread publishes scene snapshots,
+ * the render thread picks up the latest one when it latches a frame.
+ */
+struct wxrc_render_thread {
+	struct wxrc_server *server;
+	/* Re-locate views right before rendering instead of before
+	 * xrBeginFrame. Must be set before the thread is started. */
+	bool late_latch;
+	/* Submit 2D views and the cursor as quad layers, only rendered when
+	 * their content changes. Must be set before the thread is started. */
+	bool quad_layers;
+	/* Don't draw the floor grid. Must be set before the thread is
+	 * started. */
+	bool hide_grid;
+	/* Render the periphery of views at a reduced resolution, see
+	 * wxrc_gl_foveation. Must be set before the thread is started. */
+	float foveation_inset_size, foveation_periphery_scale;
+	/* Copy the first view's image for the desktop mirror at most this many
+	 * times per second, 0 to let the Wayland thread render the scene for it
+	 * instead. Must be set before the thread is started. */
+	float mirror_rate;
+	pthread_t thread;
+	atomic_bool running;
+	atomic_bool failed;
+
+	/* Wakes up the Wayland thread */
+	int event_fd;
+	struct wl_event_source *event_source;
+
+	/* Latest scene published by the Wayland thread, not yet consumed */
+	_Atomic(struct wxrc_scene *) pending_scene;
+	/* Scenes the render thread is done with, linked via next_retired */
+	_Atomic(struct wxrc_scene *) retired_scenes;
+
+	/* Copies made for the desktop mirror, if enabled by mirror_rate */
+	struct wxrc_mirror mirror;
+
+	/* Last latched frame, protected by frame_lock */
+	pthread_mutex_t frame_lock;
+	bool frame_pending;
+	struct wxrc_render_thread_frame_event frame;
+	XrView *frame_views;
+
+	/* Only accessed from the render thread */
+	struct wxrc_gl gl;
+	/* Frames submitted to the runtime so far, including empty ones */
+	uint64_t nframes;
+	struct wxrc_scene *scene;
+	XrView *xr_views;
+	XrCompositionLayerProjectionView *projection_views;
+	/* Chained to projection_views if views have depth swapchains */
+	XrCompositionLayerDepthInfoKHR *depth_infos;
+	/* Scales the image rects views are rendered to */
+	struct wxrc_resolution_governor resolution;
+	/* Scale of each frame whose GPU passes are being timed, indexed like
+	 * wxrc_gpu_timer.frames, 0 if it didn't render the views */
+	float timed_scales[WXRC_GPU_TIMER_NFRAMES];
+	uint32_t *buffer_indices;
+	struct wl_list quads; // wxrc_quad_layer.link
+	/* Layers submitted with the current frame */
+	const XrCompositionLayerBaseHeader **layers;
+	size_t layers_cap;
+
+	struct {
+		/* Emitted on the Wayland thread once a frame has been latched,
+		 * after its poses have been copied to wxrc_server.xr_views */
+		struct wl_signal frame; // struct wxrc_render_thread_frame_event
+	} events;
+};
+
+bool wxrc_render_thread_start(struct wxrc_render_thread *rt,
+	struct wxrc_server *server);
+/** Waits for the render thread to exit and releases all scenes */
+void wxrc_render_thread_stop(struct wxrc_render_thread *rt);
+/** Returns false once the render thread has exited on its own */
+bool wxrc_render_thread_is_running(struct wxrc_render_thread *rt);
+/**
+ * Hands a scene over to the render thread. The scene will be destroyed on the
+ * Wayland thread once it's not used anymore.
+ */
+void wxrc_render_thread_publish_scene(struct wxrc_render_thread *rt,
+	struct wxrc_scene *scene);
+
+#endif
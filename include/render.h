@@ -3,26 +3,345 @@
 
 #include <cglm/cglm.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <openxr/openxr.h>
+#include "gpu-timer.h"
+#include "program-cache.h"
 
-struct wxrc_xr_view;
-struct wxrc_server;
+struct wxrc_scene;
+struct wxrc_scene_surface;
+
+struct wxrc_gl_grid_program {
+	GLuint program;
+	GLint mvp_loc;
+};
+
+struct wxrc_gl_texture_program {
+	GLuint program;
+	GLint mvp_loc;
+	GLint invert_y_loc;
+	GLint has_alpha_loc; // -1 if unused
+	/* Part of the texture drawn, in texture coordinates before invert_y:
+	 * x, y, width, height */
+	GLint tex_rect_loc;
+
+	/* Current uniform values, -1 if unknown */
+	int invert_y, has_alpha;
+	GLfloat tex_rect[4];
+};
+
+/* Draws a batch of atlas slots, with per-instance model matrices */
+struct wxrc_gl_atlas_program {
+	GLuint program;
+	GLint vp_loc;
+};
+
+struct wxrc_gl_programs {
+	struct wxrc_gl_grid_program grid;
+	struct wxrc_gl_texture_program texture_rgb;
+	struct wxrc_gl_texture_program texture_external;
+	/* Only built by wxrc_gl_init_atlas */
+	struct wxrc_gl_atlas_program atlas;
+};
+
+/**
+ * A copy of a surface's texture, owned by the compositor. It's only updated
+ * when the surface is committed with new damage. Small surfaces are copied to
+ * a slot of the atlas, others to a mipmapped texture of their own.
+ */
+struct wxrc_gl_surface_texture {
+	uint64_t surface_id;
+	/* Surface state the copy holds, 0 if it's out of date */
+	uint64_t commit_seq;
+	int width, height;
+	/* The atlas' texture and framebuffer if in_atlas, x and y locate the
+	 * slot in them */
+	bool in_atlas;
+	int x, y;
+	GLuint texture;
+	GLuint framebuffer;
+	bool used;
+};
+
+/**
+ * A view with several surfaces, e.g. popups or subsurfaces, flattened into a
+ * single texture owned by the compositor. It's only updated when one of the
+ * surfaces is committed, or when they're moved relative to each other.
+ */
+struct wxrc_gl_view_texture {
+	uint64_t view_id;
+	/* View state the texture holds, 0 if it's out of date */
+	uint64_t commit_seq;
+	size_t nsurfaces;
+	/* Bounding box of the surfaces in the plane of the view, in pixels, see
+	 * wxrc_gl_get_surface_bounds */
+	int x1, y1, x2, y2;
+	/* Part of the texture the view's first surface covers, normalized with
+	 * the origin at the bottom-left */
+	GLfloat main_rect[4];
+	int width, height;
+	GLuint texture;
+	GLuint framebuffer;
+	bool used;
+};
+
+#define WXRC_GL_ATLAS_SIZE 2048
+/* Surfaces larger than a page in either dimension aren't packed */
+#define WXRC_GL_ATLAS_PAGE_SIZE 256
+#define WXRC_GL_ATLAS_MIN_SLOT_SIZE 32
+#define WXRC_GL_ATLAS_PAGES_PER_ROW \
+	(WXRC_GL_ATLAS_SIZE / WXRC_GL_ATLAS_PAGE_SIZE)
+#define WXRC_GL_ATLAS_NPAGES \
+	(WXRC_GL_ATLAS_PAGES_PER_ROW * WXRC_GL_ATLAS_PAGES_PER_ROW)
+/* Maximum number of surfaces drawn by one instanced draw */
+#define WXRC_GL_ATLAS_MAX_BATCH 128
+
+/**
+ * Pages are split into square slots of a power-of-two size, so that slots
+ * freed by a surface can be reused by any other surface of the same class.
+ */
+struct wxrc_gl_atlas_page {
+	/* 0 if the page is free */
+	int slot_size;
+	/* Bit i is set if slot i is allocated, in row-major order */
+	uint64_t used_slots;
+};
+
+struct wxrc_gl_atlas_instance {
+	GLfloat model_matrix[16];
+	/* Origin and size of the slot's contents, in texture coordinates */
+	GLfloat uv_rect[4];
+};
+
+/**
+ * Small surfaces are packed into a single texture, so that consecutive ones
+ * can be drawn by a single instanced draw.
+ */
+struct wxrc_gl_atlas {
+	GLuint texture;
+	GLuint framebuffer;
+	GLuint instance_vbo;
+	struct wxrc_gl_atlas_page pages[WXRC_GL_ATLAS_NPAGES];
+
+	/* Surfaces queued by the current render pass, drawn in order */
+	struct wxrc_gl_atlas_instance batch[WXRC_GL_ATLAS_MAX_BATCH];
+	size_t nbatch;
+
+	/* GLES 3, GL_EXT_instanced_arrays, GL_ANGLE_instanced_arrays or
+	 * GL_NV_instanced_arrays */
+	PFNGLDRAWARRAYSINSTANCEDEXTPROC glDrawArraysInstanced;
+	PFNGLVERTEXATTRIBDIVISOREXTPROC glVertexAttribDivisor;
+};
+
+/**
+ * Fixed foveation: XR views are rendered at a reduced resolution, upscaled,
+ * and only an inset around the lens center is rendered again at full
+ * resolution.
+ */
+struct wxrc_gl_foveation {
+	/* Size of the inset relative to the view's, 0 to disable foveation */
+	float inset_size;
+	/* Resolution of the periphery relative to the view's */
+	float periphery_scale;
+
+	/* Periphery render target, resized on demand */
+	GLuint texture;
+	GLuint depth_buffer;
+	GLuint framebuffer;
+	uint32_t width, height;
+};
+
+/* Sort key of a 2D view in a render pass */
+struct wxrc_gl_view_depth {
+	size_t index;
+	/* Position among the visible 2D views, in stacking order */
+	size_t rank;
+	/* Distance from the first view of the pass, along its axis */
+	float depth;
+};
+
+/* Number of views multiview programs render to at once */
+#define WXRC_GL_MULTIVIEW_NVIEWS 2
+
+struct wxrc_gl_program_build;
 
 struct wxrc_gl {
-	GLuint grid_program;
-	GLuint texture_rgb_program;
-	GLuint texture_external_program;
+	struct wxrc_gl_programs programs;
+	/* Programs rendering to all layers of a multiview framebuffer, only
+	 * built by wxrc_gl_init_multiview. multiview is set once they're
+	 * ready, multiview renders draw each layer on its own until then. */
+	bool multiview;
+	struct wxrc_gl_programs multiview_programs;
+	/* GL_KHR_parallel_shader_compile: programs can be polled for completion
+	 * instead of waited for */
+	bool parallel_compile;
+	/* Optional programs still being built, NULL once they're ready or
+	 * failed, see wxrc_gl_poll_programs */
+	struct wxrc_gl_program_build *multiview_build, *atlas_build;
+	/* 2D views and the cursor are submitted as quad layers, leave them out
+	 * of scene renders */
+	bool quad_layers;
+	/* Surfaces are sampled from mipmapped copies, only enabled by
+	 * wxrc_gl_init_mipmaps */
+	bool mipmaps;
+	struct wxrc_gl_surface_texture *surface_textures;
+	size_t nsurface_textures, surface_textures_cap;
+	/* Views with several surfaces are flattened when mipmaps are
+	 * enabled */
+	struct wxrc_gl_view_texture *view_textures;
+	size_t nview_textures, view_textures_cap;
+	GLint max_texture_size;
+	/* Programs built by wxrc_gl_init* are loaded from there if possible */
+	struct wxrc_program_cache program_cache;
+	/* Times the passes of renders, frames are delimited by the caller */
+	struct wxrc_gpu_timer gpu_timer;
+	/* Counted by the last wxrc_gl_update_surface_textures */
+	int64_t counters[WXRC_FRAME_COUNTER_COUNT];
+	/* NULL unless enabled by wxrc_gl_init_atlas, and until its programs
+	 * are ready */
+	struct wxrc_gl_atlas *atlas;
+
+	/* Only clear to the background color, drawing the grid costs a lot of
+	 * fill on software renderers */
+	bool hide_grid;
+	/* Scene renders leave the depth of what's visible in the depth
+	 * buffer, for the runtime to reproject with */
+	bool write_depth;
+	/* Only applies to wxrc_gl_render_xr_view */
+	struct wxrc_gl_foveation foveation;
+
+	/* Scratch space to sort the views of a render pass */
+	struct wxrc_gl_view_depth *view_depths;
+	size_t view_depths_cap;
+
+	GLuint grid_vbo;
+	GLuint grid_texture;
+	GLuint quad_vbo;
+
+	/* Bindings made by the current render pass, 0 if unknown. Reset at the
+	 * start of each pass, since the context may be shared with wlroots. */
+	struct {
+		GLuint program;
+		GLuint vertex_buffer;
+		GLenum texture_target;
+		GLuint texture;
+	} state;
 };
 
 #define WXRC_SURFACE_SCALE 300.0
 
+/* Clip planes of XR view projections, in meters */
+#define WXRC_GL_NEAR_Z 0.05
+#define WXRC_GL_FAR_Z 100.0
+
+/**
+ * Checks whether a space-separated extension string, as returned by
+ * glGetString or eglQueryString, contains an extension. Only whole names
+ * match. Returns false if exts is NULL.
+ */
+bool wxrc_has_extension(const char *exts, const char *name);
+/** Checks whether the current GL context supports an extension */
+bool wxrc_gl_has_extension(const char *name);
+
+/**
+ * Builds the programs needed for the first frame, and waits for them.
+ */
 bool wxrc_gl_init(struct wxrc_gl *gl);
+/**
+ * Starts building the multiview programs, see wxrc_gl_poll_programs. Requires
+ * a GLES 3 context supporting GL_OVR_multiview2.
+ */
+bool wxrc_gl_init_multiview(struct wxrc_gl *gl);
+/**
+ * Samples surfaces from mipmapped copies, with trilinear filtering. Returns
+ * false if the context can't generate mipmaps for all texture sizes.
+ */
+bool wxrc_gl_init_mipmaps(struct wxrc_gl *gl);
+/**
+ * Copies small surfaces to an atlas, and draws them with instanced draws,
+ * once its programs are ready, see wxrc_gl_poll_programs. Must be called
+ * after wxrc_gl_init_multiview, if at all. Returns false if the context
+ * doesn't support instancing.
+ */
+bool wxrc_gl_init_atlas(struct wxrc_gl *gl);
+/**
+ * Switches to the optional programs started by wxrc_gl_init_multiview and
+ * wxrc_gl_init_atlas once they're built. Must be called between frames.
+ * Without GL_KHR_parallel_shader_compile, their status can't be checked
+ * without blocking, so they're waited for on the first call.
+ */
+void wxrc_gl_poll_programs(struct wxrc_gl *gl);
 void wxrc_gl_finish(struct wxrc_gl *gl);
-void wxrc_gl_render_view(struct wxrc_server *server, struct wxrc_xr_view *view,
-	mat4 view_matrix, mat4 projection_matrix);
-void wxrc_gl_render_xr_view(struct wxrc_server *server, struct wxrc_xr_view *view,
-	XrView *xr_view, GLuint framebuffer, GLuint image, GLuint depth_buffer);
+/**
+ * Updates the copies of the scene's surfaces which have been damaged, and
+ * drops the ones of surfaces which aren't in the scene anymore. Views with
+ * several surfaces are flattened again if any of them has changed. Must be
+ * called with each new scene if mipmaps or the atlas are enabled.
+ */
+void wxrc_gl_update_surface_textures(struct wxrc_gl *gl,
+	struct wxrc_scene *scene);
+/**
+ * Renders a scene. xr_view_index selects which texture is used for XR shell
+ * surfaces. The scene may be NULL, in which case only the background is drawn.
+ */
+void wxrc_gl_render_view(struct wxrc_gl *gl, struct wxrc_scene *scene,
+	uint32_t xr_view_index, mat4 view_matrix, mat4 projection_matrix);
+/**
+ * Renders an XR view to the bottom-left width x height rectangle of an
+ * image, which may be smaller than the image. With foveation, the depth
+ * buffer is only valid in the inset.
+ */
+void wxrc_gl_render_xr_view(struct wxrc_gl *gl, struct wxrc_scene *scene,
+	uint32_t xr_view_index, XrView *xr_view, uint32_t width, uint32_t height,
+	GLuint framebuffer, GLuint image, GLuint depth_buffer);
+/**
+ * Renders WXRC_GL_MULTIVIEW_NVIEWS views in a single pass, to the same
+ * rectangle as wxrc_gl_render_xr_view. The framebuffer must have multiview
+ * attachments, with one layer per view. XR shell surfaces have a texture per
+ * view, so they're drawn to layer_framebuffers, which each have a single
+ * layer attached. Until the multiview programs are ready, each view is
+ * rendered to its layer framebuffer in a pass of its own.
+ */
+void wxrc_gl_render_xr_multiview(struct wxrc_gl *gl, struct wxrc_scene *scene,
+	XrView *xr_views, uint32_t width, uint32_t height, GLuint framebuffer,
+	const GLuint *layer_framebuffers);
+/**
+ * Computes the bounding box of surfaces in the plane of a pose, in pixels.
+ * Returns false if it's empty.
+ */
+bool wxrc_gl_get_surface_bounds(mat4 inv_pose_matrix,
+	struct wxrc_scene_surface *surfaces, size_t nsurfaces,
+	int *x1, int *y1, int *x2, int *y2);
+/**
+ * Computes the matrix mapping world coordinates to the clip space of a
+ * bounding box returned by wxrc_gl_get_surface_bounds.
+ */
+void wxrc_gl_get_bounds_vp_matrix(mat4 inv_pose_matrix, int x1, int y1,
+	int x2, int y2, mat4 vp_matrix);
+/**
+ * Renders surfaces to a quad layer image, cleared to transparent. vp_matrix
+ * maps world coordinates to the image.
+ */
+void wxrc_gl_render_quad(struct wxrc_gl *gl,
+	struct wxrc_scene_surface *surfaces, size_t nsurfaces, mat4 vp_matrix,
+	GLuint framebuffer, GLuint image, uint32_t width, uint32_t height);
+/**
+ * Downsamples the bottom-left width x height rectangle of an XR view image,
+ * whose full size is image_width x image_height, to a mirror copy.
+ */
+void wxrc_gl_render_mirror_copy(struct wxrc_gl *gl, GLuint image,
+	uint32_t width, uint32_t height, uint32_t image_width,
+	uint32_t image_height, GLuint framebuffer, uint32_t copy_width,
+	uint32_t copy_height);
+/**
+ * Draws a mirror copy to the current width x height framebuffer, letterboxed
+ * so that it keeps its aspect ratio.
+ */
+void wxrc_gl_render_mirror(struct wxrc_gl *gl, GLuint texture,
+	uint32_t copy_width, uint32_t copy_height, uint32_t width,
+	uint32_t height);
 
 void wxrc_get_projection_matrix(XrView *xr_view, mat4 projection_matrix);
 
@@ -0,0 +1,37 @@
+#ifndef _WXRC_RESOLUTION_H
+#define _WXRC_RESOLUTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Scales the part of the swapchain images the scene is rendered to, so that
+ * GPU time stays within the frame deadline. It scales down as soon as frames
+ * get too expensive, and back up only after a while with plenty of headroom,
+ * so that the resolution doesn't oscillate.
+ */
+struct wxrc_resolution_governor {
+	/* Fraction of the swapchain size rendered to, in each dimension */
+	float scale;
+	/* Estimated GPU time of a frame at the current scale, decays slowly
+	 * after spikes */
+	int64_t gpu_estimate_ns;
+	/* Consecutive frames with enough headroom to scale up */
+	uint32_t headroom_frames;
+};
+
+void wxrc_resolution_governor_init(struct wxrc_resolution_governor *gov);
+/**
+ * Feeds back how long the GPU took to render the last frame. Returns true if
+ * the scale has changed.
+ */
+bool wxrc_resolution_governor_report(struct wxrc_resolution_governor *gov,
+	int64_t gpu_ns, int64_t display_period_ns);
+/**
+ * Returns the size to render at, for a swapchain of the given size.
+ */
+void wxrc_resolution_governor_get_size(struct wxrc_resolution_governor *gov,
+	uint32_t max_width, uint32_t max_height, uint32_t *width,
+	uint32_t *height);
+
+#endif
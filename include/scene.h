@@ -0,0 +1,115 @@
+#ifndef _WXRC_SCENE_H
+#define _WXRC_SCENE_H
+
+#include <cglm/cglm.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_box.h>
+#include "surface.h"
+
+struct wlr_buffer;
+struct wlr_texture;
+struct wxrc_server;
+
+#define WXRC_SCENE_MAX_XR_VIEWS 4
+
+struct wxrc_scene_surface {
+	struct wlr_texture *texture;
+	mat4 model_matrix;
+
+	/* wxrc_surface.id, 0 if the surface isn't tracked (e.g. the cursor's
+	 * image) */
+	uint64_t id;
+	/* wxrc_surface.commit_seq, 0 if unknown */
+	uint64_t commit_seq;
+	/* Damage of the latest commits, newest first, see
+	 * wxrc_scene_surface_get_damage */
+	struct wxrc_surface_damage damage[WXRC_SURFACE_DAMAGE_HISTORY];
+	/* A rectangle known to be opaque, in buffer coordinates, may be empty */
+	struct wlr_box opaque;
+	int width, height; // buffer size
+};
+
+struct wxrc_scene_view {
+	bool xr_shell;
+	/* 2D views: indices into wxrc_scene.surfaces, in rendering order */
+	size_t first_surface, nsurfaces;
+	/* 2D views: wxrc_view.id, stable across scenes */
+	uint64_t id;
+	/* 2D views: latest commit_seq among the view's surfaces, 0 if unknown */
+	uint64_t commit_seq;
+	/* 2D views: position and orientation, without the surface scale */
+	mat4 pose_matrix;
+	/* 2D views: bounding sphere of the surfaces, in world coordinates */
+	vec3 bounds_center;
+	float bounds_radius;
+	/* XR shell views: one texture per XR view, NULL if missing */
+	struct wlr_texture *xr_textures[WXRC_SCENE_MAX_XR_VIEWS];
+};
+
+/**
+ * An immutable snapshot of everything the renderer needs to draw a frame. It's
+ * built on the Wayland thread and can be rendered from any thread, because it
+ * holds references on all client buffers it uses.
+ */
+struct wxrc_scene {
+	uint64_t seq;
+	struct wl_list link; // wxrc_server.scenes
+	struct wxrc_scene *next_retired;
+
+	/* Views in back-to-front order */
+	struct wxrc_scene_view *views;
+	size_t nviews, views_cap;
+	struct wxrc_scene_surface *surfaces;
+	size_t nsurfaces, surfaces_cap;
+
+	bool has_cursor;
+	struct wxrc_scene_surface cursor;
+	/* Position and orientation of the cursor, without its scale */
+	mat4 cursor_pose_matrix;
+
+	struct wlr_buffer **buffers;
+	size_t nbuffers, buffers_cap;
+	/* Signaled once the texture uploads of the scene's buffers are done,
+	 * EGL_NO_SYNC_KHR if unused. The render thread waits for it before
+	 * sampling them from its own context. */
+	EGLSyncKHR fence;
+};
+
+/**
+ * Takes a snapshot of the server's current state, and clears
+ * wxrc_server.scene_dirty. Must be called on the Wayland thread.
+ */
+struct wxrc_scene *wxrc_scene_create(struct wxrc_server *server);
+/**
+ * Releases the references held by the scene and frees it. Must be called on
+ * the Wayland thread.
+ */
+void wxrc_scene_destroy(struct wxrc_server *server, struct wxrc_scene *scene);
+
+/**
+ * Returns true if the surface may have changed since a consumer last saw it
+ * at seen_commit_seq.
+ */
+bool wxrc_scene_surface_changed(const struct wxrc_scene_surface *surface,
+	uint64_t seen_commit_seq);
+/**
+ * Returns the extents of the damage since a consumer last saw the surface at
+ * seen_commit_seq, in buffer coordinates. Returns false if it isn't known, in
+ * which case the whole surface must be considered damaged.
+ */
+bool wxrc_scene_surface_get_damage(const struct wxrc_scene_surface *surface,
+	uint64_t seen_commit_seq, struct wlr_box *damage);
+
+/**
+ * Destroys a texture once no scene can reference it anymore. Must be used
+ * instead of wlr_texture_destroy for textures not owned by a client buffer.
+ */
+void wxrc_scene_defer_texture_destroy(struct wxrc_server *server,
+	struct wlr_texture *texture);
+
+#endif
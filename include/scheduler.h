@@ -0,0 +1,45 @@
+#ifndef _WXRC_SCHEDULER_H
+#define _WXRC_SCHEDULER_H
+
+#include <stdint.h>
+
+/**
+ * Decides how long Wayland clients can be serviced before the compositor has
+ * to start rendering a frame. Rendering starts just in time to make the
+ * frame's deadline, so late client commits still land on the next frame.
+ */
+struct wxrc_frame_scheduler {
+	/* Estimated time needed to render and submit a frame, decays slowly
+	 * after spikes */
+	int64_t render_estimate_ns;
+	/* Safety margin added on top of the estimate, widened after missed
+	 * frames */
+	int64_t margin_ns;
+	/* Consecutive frames which made their display time */
+	uint32_t ontime_frames;
+	/* Longest time from a frame's start to its display time, i.e. when the
+	 * runtime would begin frames without any wakeup delay. Relaxes slowly
+	 * towards shorter times. 0 until measured. */
+	int64_t display_offset_ns;
+	/* Display time of the previous frame, 0 if unknown */
+	int64_t last_display_ns;
+};
+
+void wxrc_frame_scheduler_init(struct wxrc_frame_scheduler *sched);
+/**
+ * Returns the CLOCK_MONOTONIC time at which rendering needs to start for a
+ * frame which began at frame_begin_ns, and will be displayed at display_ns.
+ * display_ns is 0 if the runtime can't convert display times, in which case
+ * the deadline is relative to frame_begin_ns.
+ */
+int64_t wxrc_frame_scheduler_get_latch_deadline(
+	struct wxrc_frame_scheduler *sched, int64_t frame_begin_ns,
+	int64_t display_ns, int64_t display_period_ns);
+/**
+ * Feeds back how long rendering and submitting the last frame took, leaving
+ * out waits for the runtime and the GPU.
+ */
+void wxrc_frame_scheduler_report_render(struct wxrc_frame_scheduler *sched,
+	int64_t render_ns);
+
+#endif
@@ -10,8 +10,12 @@
 #include <wlr/types/wlr_xdg_shell.h>
 #include "input.h"
 #include "render.h"
+#include "render-thread.h"
+#include "scheduler.h"
+#include "timing.h"
 #include "xr-shell-protocol.h"
 
+struct wxrc_trace;
 struct wxrc_xr_backend;
 
 struct wxrc_server {
@@ -20,9 +24,34 @@ struct wxrc_server {
 	struct wlr_backend *backend;
 	struct wxrc_xr_backend *xr_backend;
 	struct wxrc_gl gl;
+	struct wxrc_frame_timings timings;
+	/* Frames rendered to the desktop outputs, on the Wayland thread */
+	struct wxrc_frame_timings output_timings;
+	struct wxrc_frame_scheduler scheduler;
+	struct wxrc_render_thread render_thread;
+	int64_t last_frame_done_ns;
+	/* Input and pose trace being recorded or replayed, may be NULL */
+	struct wxrc_trace *trace;
 
+	/* Poses of the last latched frame */
 	XrView *xr_views;
 
+	struct wl_list outputs; // wxrc_output.link
+
+	struct wl_list scenes; // wxrc_scene.link, oldest first
+	uint64_t scene_seq;
+	struct wl_list deferred_textures;
+	/* Set when anything a scene captures changes, so that scenes are only
+	 * created when needed */
+	bool scene_dirty;
+	/* Incremented on each surface commit, see wxrc_surface.commit_seq */
+	uint64_t commit_seq;
+	/* Committed shm buffers whose damage was uploaded to their previous
+	 * texture, and ones uploaded whole to a new texture because a scene
+	 * still holds the previous buffer */
+	uint64_t damage_uploads, full_uploads;
+	uint64_t last_surface_id;
+
 	struct wlr_compositor *compositor;
 	struct wlr_xdg_shell *xdg_shell;
 	struct wxrc_zxr_shell_v1 *xr_shell;
@@ -32,6 +61,7 @@ struct wxrc_server {
 	struct zwp_pointer_constraints_v1 *remote_pointer_constraints;
 
 	struct wl_list views;
+	uint64_t last_view_id;
 
 	struct wlr_seat *seat;
 	struct wlr_xcursor_manager *cursor_mgr;
@@ -46,8 +76,10 @@ struct wxrc_server {
 
 	struct wl_listener new_input;
 	struct wl_listener new_output;
+	struct wl_listener new_surface;
 	struct wl_listener new_xdg_surface;
 	struct wl_listener new_xr_surface;
+	struct wl_listener render_frame;
 	struct wl_listener request_set_cursor;
 	struct wl_listener request_set_selection;
 	struct wl_listener request_set_primary_selection;
@@ -0,0 +1,63 @@
+#ifndef _WXRC_SURFACE_H
+#define _WXRC_SURFACE_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_box.h>
+
+struct wlr_buffer;
+struct wlr_surface;
+struct wxrc_server;
+
+/* Number of commits whose damage is kept per surface */
+#define WXRC_SURFACE_DAMAGE_HISTORY 8
+
+/* Damage of a commit, relative to the previous commit of the same surface */
+struct wxrc_surface_damage {
+	/* wxrc_surface.commit_seq before and after the commit, 0 if unused */
+	uint64_t prev_commit_seq, commit_seq;
+	/* Extents, in buffer coordinates */
+	struct wlr_box box;
+};
+
+/**
+ * Compositor state attached to each wlr_surface, via its data pointer. It
+ * tracks what changed between scene snapshots, so that the renderer can skip
+ * work for surfaces which haven't been committed.
+ */
+struct wxrc_surface {
+	struct wxrc_server *server;
+	struct wlr_surface *wlr_surface;
+	/* Unique for the lifetime of the server, never 0 */
+	uint64_t id;
+
+	/* Value of wxrc_server.commit_seq when the surface was last committed */
+	uint64_t commit_seq;
+	/* Buffer size as of the last commit */
+	int width, height;
+	/* wlr_surface.buffer as of the last commit. Only compared, since it
+	 * may have been destroyed since. */
+	const struct wlr_buffer *buffer;
+	/* Damage of the latest commits, newest first. It isn't consumed by
+	 * scenes: consumers keep up with different scenes, see
+	 * wxrc_scene_surface_get_damage. */
+	struct wxrc_surface_damage damage[WXRC_SURFACE_DAMAGE_HISTORY];
+
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+/**
+ * Starts tracking surfaces created by the server's compositor.
+ */
+void wxrc_surface_init(struct wxrc_server *server);
+struct wxrc_surface *wxrc_surface_from_wlr_surface(
+	struct wlr_surface *wlr_surface);
+/**
+ * Returns the largest rectangle of the opaque region, in buffer coordinates.
+ * The box is empty if the surface has no opaque region.
+ */
+void wxrc_surface_get_opaque_box(struct wxrc_surface *surface,
+	struct wlr_box *box);
+
+#endif
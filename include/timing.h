@@ -0,0 +1,103 @@
+#ifndef _WXRC_TIMING_H
+#define _WXRC_TIMING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum wxrc_frame_phase {
+	WXRC_FRAME_PHASE_WAIT_FRAME,
+	WXRC_FRAME_PHASE_POLL_EVENTS,
+	WXRC_FRAME_PHASE_LATCH_WAIT,
+	WXRC_FRAME_PHASE_PUSH_FRAME,
+	WXRC_FRAME_PHASE_GPU_WAIT,
+	WXRC_FRAME_PHASE_COUNT,
+};
+
+/* Render passes timed on the GPU, see wxrc_gpu_timer */
+enum wxrc_gpu_pass {
+	/* Surface copies and flattened views */
+	WXRC_GPU_PASS_COPIES,
+	WXRC_GPU_PASS_GRID,
+	WXRC_GPU_PASS_VIEWS,
+	WXRC_GPU_PASS_CURSOR,
+	/* Upscaling the foveated periphery */
+	WXRC_GPU_PASS_FOVEATION,
+	/* Views rendered to quad layers */
+	WXRC_GPU_PASS_QUADS,
+	WXRC_GPU_PASS_MIRROR,
+	WXRC_GPU_PASS_COUNT,
+};
+
+/* Events counted per frame */
+enum wxrc_frame_counter {
+	/* Surface copies limited to the damaged area */
+	WXRC_FRAME_COUNTER_PARTIAL_COPIES,
+	/* Surface copies of the whole surface */
+	WXRC_FRAME_COUNTER_FULL_COPIES,
+	WXRC_FRAME_COUNTER_COUNT,
+};
+
+struct wxrc_frame_timing {
+	/* All timestamps are CLOCK_MONOTONIC nanoseconds */
+	int64_t begin_ns, end_ns;
+	int64_t phase_begin_ns[WXRC_FRAME_PHASE_COUNT];
+	int64_t phase_ns[WXRC_FRAME_PHASE_COUNT];
+	/* XrTime, in the runtime's time domain */
+	int64_t predicted_display_time;
+	int64_t predicted_display_period;
+	/* GPU time of each pass of an earlier frame, whose results came in
+	 * during this one. Only valid if has_gpu_passes is set. */
+	bool has_gpu_passes;
+	int64_t gpu_pass_ns[WXRC_GPU_PASS_COUNT];
+	int64_t counters[WXRC_FRAME_COUNTER_COUNT];
+	/* Foveation settings the frame was rendered with, inset size 0 if
+	 * disabled */
+	float foveation_inset_size, foveation_periphery_scale;
+};
+
+#define WXRC_FRAME_TIMING_HISTORY 1024
+
+/**
+ * Ring buffer of per-frame timings. There must be a single writer (the thread
+ * running the frame loop), but readers may run concurrently on any thread.
+ */
+struct wxrc_frame_timings {
+	struct wxrc_frame_timing frames[WXRC_FRAME_TIMING_HISTORY];
+	/* Number of frames completed so far */
+	_Atomic uint64_t head;
+};
+
+/** Returns the current CLOCK_MONOTONIC time in nanoseconds */
+int64_t wxrc_get_time_ns(void);
+
+/**
+ * Starts recording a new frame. The previous frame must have been ended with
+ * wxrc_frame_timing_end.
+ */
+void wxrc_frame_timing_begin(struct wxrc_frame_timings *timings);
+void wxrc_frame_timing_phase_begin(struct wxrc_frame_timings *timings,
+	enum wxrc_frame_phase phase);
+void wxrc_frame_timing_phase_end(struct wxrc_frame_timings *timings,
+	enum wxrc_frame_phase phase);
+void wxrc_frame_timing_set_gpu_passes(struct wxrc_frame_timings *timings,
+	const int64_t pass_ns[static WXRC_GPU_PASS_COUNT]);
+void wxrc_frame_timing_count(struct wxrc_frame_timings *timings,
+	const int64_t counters[static WXRC_FRAME_COUNTER_COUNT]);
+void wxrc_frame_timing_set_foveation(struct wxrc_frame_timings *timings,
+	float inset_size, float periphery_scale);
+/** Publishes the current frame to readers */
+void wxrc_frame_timing_end(struct wxrc_frame_timings *timings,
+	int64_t predicted_display_time, int64_t predicted_display_period);
+
+/**
+ * Logs min/avg/p99 durations of each phase and GPU pass over the recorded
+ * history, and the average of each counter. Phases which never ran and
+ * counters which stayed at zero aren't logged. The foveation settings of the
+ * frames are part of the label, so that reports of several runs can be
+ * compared.
+ */
+void wxrc_frame_timings_report(struct wxrc_frame_timings *timings,
+	const char *name);
+
+#endif
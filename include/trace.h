@@ -0,0 +1,62 @@
+#ifndef _WXRC_TRACE_H
+#define _WXRC_TRACE_H
+
+#include <openxr/openxr.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_pointer.h>
+
+struct wxrc_server;
+struct wxrc_trace;
+
+/**
+ * Starts recording head poses, input events and surface commits to a file.
+ * Must be called after the compositor has been created.
+ */
+struct wxrc_trace *wxrc_trace_create_recorder(struct wxrc_server *server,
+	const char *path);
+/**
+ * Loads a trace for replay. Input events are replayed through virtual input
+ * devices, head poses are meant to be fed to the null XR backend.
+ */
+struct wxrc_trace *wxrc_trace_create_replayer(struct wxrc_server *server,
+	const char *path);
+void wxrc_trace_destroy(struct wxrc_trace *trace);
+
+/**
+ * Records a latched frame, numbered by the render thread. When replaying,
+ * feeds the input events recorded up to this frame instead. Must be called on
+ * the Wayland thread.
+ */
+void wxrc_trace_handle_frame(struct wxrc_trace *trace, uint64_t frame_number,
+	const struct timespec *display_time, const XrView *xr_views,
+	uint32_t nviews);
+
+/* All of these do nothing if trace is NULL or replaying */
+void wxrc_trace_record_pointer_motion(struct wxrc_trace *trace,
+	const struct wlr_event_pointer_motion *event);
+void wxrc_trace_record_pointer_button(struct wxrc_trace *trace,
+	const struct wlr_event_pointer_button *event);
+void wxrc_trace_record_pointer_axis(struct wxrc_trace *trace,
+	const struct wlr_event_pointer_axis *event);
+void wxrc_trace_record_pointer_frame(struct wxrc_trace *trace);
+void wxrc_trace_record_keyboard_key(struct wxrc_trace *trace,
+	const struct wlr_event_keyboard_key *event);
+void wxrc_trace_record_keyboard_modifiers(struct wxrc_trace *trace,
+	const struct wlr_keyboard_modifiers *modifiers);
+
+/** Number of render thread frames covered by a replayed trace */
+size_t wxrc_trace_get_frame_count(struct wxrc_trace *trace);
+/**
+ * Copies the poses recorded for a render thread frame. Frames which weren't
+ * recorded get the poses of the latest one before them, or of the first one.
+ * Safe to call from any thread once the trace has been loaded. Returns false
+ * if the trace has no frames or a different number of views.
+ */
+bool wxrc_trace_get_frame_views(struct wxrc_trace *trace, size_t frame_number,
+	XrView *xr_views, uint32_t nviews);
+
+#endif
@@ -31,6 +31,8 @@ struct wxrc_view {
 	struct wxrc_server *server;
 	const struct wxrc_view_interface *impl;
 	struct wlr_surface *surface;
+	/* Unique for the lifetime of the server, never 0 */
+	uint64_t id;
 
 	vec3 position, rotation;
 	bool mapped;
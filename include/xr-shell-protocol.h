@@ -111,6 +111,15 @@ bool wxrc_wlr_buffer_is_zxr_composite_buffer_v1(struct wlr_buffer *buffer);
 struct wxrc_zxr_composite_buffer_v1 *wxrc_zxr_composite_buffer_v1_from_buffer(
 		struct wlr_buffer *buffer);
 
+/**
+ * Returns the wlr_buffer for a particular view, or NULL if no buffer is
+ * provided for this view.
+ */
+struct wlr_buffer *wxrc_zxr_composite_buffer_v1_buffer_for_view(
+		struct wxrc_zxr_composite_buffer_v1 *buffer,
+		struct wxrc_zxr_view_v1 *view,
+		enum zxr_composite_buffer_v1_buffer_type buffer_type);
+
 /**
  * Returns a wlr_texture for a particular view, or NULL if no buffer is provided
  * for this view.
@@ -10,6 +10,8 @@ const char *wxrc_xr_result_str(XrResult r);
 /** Gets a user-friendly description of this XrStructureType */
 const char *wxrc_xr_structure_type_str(XrStructureType t);
 
+/** Gets a user-friendly description of this XrSessionState */
+const char *wxrc_xr_session_state_str(XrSessionState s);
 /** Logs an XR result with wlr_log */
 void wxrc_log_xr_result(const char *entrypoint, XrResult r);
 
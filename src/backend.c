@@ -1,10 +1,14 @@
+#define _POSIX_C_SOURCE 200112L
 #include <assert.h>
+#include <GLES3/gl3.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-client.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/gles2.h>
 #include <wlr/util/log.h>
 #include "backend.h"
+#include "render.h"
 #include "xrutil.h"
 
 struct wxrc_xr_backend *get_xr_backend_from_backend(
@@ -46,16 +50,26 @@ exit:
 	return r;
 }
 
-static XrResult wxrc_xr_enumerate_instance_props(void) {
+/**
+ * Returns the instance extensions supported by the runtime, to be freed by the
+ * caller, or NULL on error.
+ */
+static XrExtensionProperties *wxrc_xr_enumerate_instance_props(
+		uint32_t *nprops_out) {
 	uint32_t nprops;
 	XrExtensionProperties *props = NULL;
 	XrResult r = xrEnumerateInstanceExtensionProperties(NULL, 0, &nprops, NULL);
 	if (XR_FAILED(r)) {
 		wxrc_log_xr_result("xrEnumerateInstanceExtensionProperties", r);
-		goto exit;
+		goto error;
 	}
 	wlr_log(WLR_DEBUG, "OpenXR Instance extension properties (%d):", nprops);
-	props = calloc(sizeof(XrExtensionProperties), nprops);
+	/* One more, so that it isn't NULL without any extension */
+	props = calloc(nprops + 1, sizeof(XrExtensionProperties));
+	if (props == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		goto error;
+	}
 	for (uint32_t i = 0; i < nprops; ++i) {
 		XrExtensionProperties *prop = &props[i];
 		prop->type = XR_TYPE_EXTENSION_PROPERTIES;
@@ -64,7 +78,7 @@ static XrResult wxrc_xr_enumerate_instance_props(void) {
 	r = xrEnumerateInstanceExtensionProperties(NULL, nprops, &nprops, props);
 	if (XR_FAILED(r)) {
 		wxrc_log_xr_result("xrEnumerateInstanceExtensionProperties", r);
-		goto exit;
+		goto error;
 	}
 
 	for (uint32_t i = 0; i < nprops; ++i) {
@@ -73,16 +87,49 @@ static XrResult wxrc_xr_enumerate_instance_props(void) {
 				prop->extensionVersion);
 	}
 
-exit:
+	*nprops_out = nprops;
+	return props;
+
+error:
 	free(props);
-	return r;
+	return NULL;
+}
+
+static bool wxrc_xr_instance_extension_supported(
+		const XrExtensionProperties *props, uint32_t nprops,
+		const char *name) {
+	for (uint32_t i = 0; i < nprops; ++i) {
+		if (strcmp(props[i].extensionName, name) == 0) {
+			return true;
+		}
+	}
+	return false;
 }
 
-static XrResult wxrc_create_xr_instance(XrInstance *instance) {
-	const char *extensions[] = {
+static XrResult wxrc_create_xr_instance(XrInstance *instance,
+		const XrExtensionProperties *props, uint32_t nprops) {
+	const char *extensions[8] = {
 		XR_KHR_OPENGL_ES_ENABLE_EXTENSION_NAME,
 		XR_MND_EGL_ENABLE_EXTENSION_NAME,
 	};
+	size_t nextensions = 2;
+
+	const char *optional_extensions[] = {
+		XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME,
+		XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME,
+	};
+	for (size_t i = 0; i < sizeof(optional_extensions) /
+			sizeof(optional_extensions[0]); i++) {
+		if (wxrc_xr_instance_extension_supported(props, nprops,
+				optional_extensions[i])) {
+			extensions[nextensions++] = optional_extensions[i];
+		} else {
+			wlr_log(WLR_INFO, "OpenXR runtime doesn't support %s",
+				optional_extensions[i]);
+		}
+	}
+	assert(nextensions <= sizeof(extensions) / sizeof(extensions[0]));
+
 	XrInstanceCreateInfo info = {
 		.type = XR_TYPE_INSTANCE_CREATE_INFO,
 		.next = NULL,
@@ -96,7 +143,7 @@ static XrResult wxrc_create_xr_instance(XrInstance *instance) {
 		},
 		.enabledApiLayerCount = 0,
 		.enabledApiLayerNames = NULL,
-		.enabledExtensionCount = sizeof(extensions) / sizeof(extensions[0]),
+		.enabledExtensionCount = nextensions,
 		.enabledExtensionNames = extensions,
 	};
 	wlr_log(WLR_DEBUG, "Creating XR instance");
@@ -120,7 +167,8 @@ static XrResult wxrc_create_xr_instance(XrInstance *instance) {
 	return r;
 }
 
-static XrResult wxrc_get_xr_system(XrInstance instance, XrSystemId *sysid) {
+static XrResult wxrc_get_xr_system(XrInstance instance, XrSystemId *sysid,
+		XrSystemGraphicsProperties *graphics_props) {
 	/* XXX: Do we care about handheld devices? */
 	XrSystemGetInfo sysinfo = {
 		.type = XR_TYPE_SYSTEM_GET_INFO,
@@ -148,6 +196,7 @@ static XrResult wxrc_get_xr_system(XrInstance instance, XrSystemId *sysid) {
 			props.trackingProperties.orientationTracking ? "yes" : "no",
 			props.trackingProperties.positionTracking ? "yes" : "no");
 
+	*graphics_props = props.graphicsProperties;
 	return r;
 }
 
@@ -245,7 +294,8 @@ static XrViewConfigurationView *wxrc_xr_enumerate_stereo_config_views(
 }
 
 static XrResult wxrc_create_xr_session(XrInstance instance,
-		XrSystemId sysid, XrSession *session, struct wlr_egl *egl) {
+		XrSystemId sysid, XrSession *session, struct wlr_egl *egl,
+		EGLContext context) {
 	PFN_xrGetOpenGLESGraphicsRequirementsKHR xrGetOpenGLESGraphicsRequirementsKHR;
 	XrResult r = xrGetInstanceProcAddr(instance, "xrGetOpenGLESGraphicsRequirementsKHR",
 		(PFN_xrVoidFunction *)&xrGetOpenGLESGraphicsRequirementsKHR);
@@ -283,7 +333,7 @@ static XrResult wxrc_create_xr_session(XrInstance instance,
 		.getProcAddress = eglGetProcAddress,
 		.display = egl->display,
 		.config = egl->config,
-		.context = egl->context,
+		.context = context,
 	};
 
 	XrSessionCreateInfo sessinfo = {
@@ -372,8 +422,214 @@ static XrResult wxrc_xr_create_local_reference_space(XrSession session,
 	return r;
 }
 
-static struct wxrc_xr_view *wxrc_xr_create_swapchains(XrSession session,
-		uint32_t nviews, XrViewConfigurationView *view_configs) {
+bool wxrc_xr_view_init_framebuffers(struct wxrc_xr_view *view) {
+	view->framebuffers = calloc(view->nimages, sizeof(GLuint));
+	if (view->framebuffers == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return false;
+	}
+
+	glGenFramebuffers(view->nimages, view->framebuffers);
+
+	if (view->depth_swapchain != XR_NULL_HANDLE) {
+		return true;
+	}
+	glGenTextures(1, &view->depth_buffer);
+	glBindTexture(GL_TEXTURE_2D, view->depth_buffer);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
+		view->config.recommendedImageRectWidth,
+		view->config.recommendedImageRectHeight,
+		0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+	return true;
+}
+
+bool wxrc_xr_view_init_multiview_framebuffers(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	view->nlayers = backend->nviews;
+	view->framebuffers = calloc(view->nimages, sizeof(GLuint));
+	view->layer_framebuffers =
+		calloc(view->nimages * view->nlayers, sizeof(GLuint));
+	if (view->framebuffers == NULL || view->layer_framebuffers == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return false;
+	}
+
+	uint32_t width = view->config.recommendedImageRectWidth;
+	uint32_t height = view->config.recommendedImageRectHeight;
+
+	if (view->depth_swapchain == XR_NULL_HANDLE) {
+		glGenTextures(1, &view->depth_buffer);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, view->depth_buffer);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0,
+			GL_DEPTH_COMPONENT24_OES, width, height, view->nlayers, 0,
+			GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	} else {
+		view->depth_attachments = calloc(view->nimages, sizeof(GLuint));
+		if (view->depth_attachments == NULL) {
+			wlr_log_errno(WLR_ERROR, "calloc failed");
+			return false;
+		}
+	}
+
+	/* Color attachments never change, unlike single view framebuffers
+	 * they're set up once and for all. So does the depth attachment, unless
+	 * it comes from a swapchain. */
+	glGenFramebuffers(view->nimages, view->framebuffers);
+	glGenFramebuffers(view->nimages * view->nlayers, view->layer_framebuffers);
+	for (uint32_t i = 0; i < view->nimages; i++) {
+		GLuint image = view->images[i].image;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, view->framebuffers[i]);
+		backend->glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER,
+			GL_COLOR_ATTACHMENT0, image, 0, 0, view->nlayers);
+		if (view->depth_buffer != 0) {
+			backend->glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER,
+				GL_DEPTH_ATTACHMENT, view->depth_buffer, 0, 0,
+				view->nlayers);
+		}
+
+		for (uint32_t j = 0; j < view->nlayers; j++) {
+			glBindFramebuffer(GL_FRAMEBUFFER,
+				view->layer_framebuffers[i * view->nlayers + j]);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER,
+				GL_COLOR_ATTACHMENT0, image, 0, j);
+			if (view->depth_buffer != 0) {
+				glFramebufferTextureLayer(GL_FRAMEBUFFER,
+					GL_DEPTH_ATTACHMENT, view->depth_buffer, 0, j);
+			}
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return true;
+}
+
+GLuint wxrc_xr_view_get_depth_texture(struct wxrc_xr_view *view) {
+	if (view->depth_swapchain == XR_NULL_HANDLE) {
+		return view->depth_buffer;
+	}
+	return view->depth_images[view->depth_image_index].image;
+}
+
+void wxrc_xr_view_update_multiview_depth(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view, uint32_t image_index) {
+	if (view->depth_swapchain == XR_NULL_HANDLE) {
+		return;
+	}
+	/* Runtimes usually cycle through both swapchains in lockstep, so this
+	 * only happens for the first frames */
+	GLuint depth = wxrc_xr_view_get_depth_texture(view);
+	if (view->depth_attachments[image_index] == depth) {
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, view->framebuffers[image_index]);
+	backend->glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER,
+		GL_DEPTH_ATTACHMENT, depth, 0, 0, view->nlayers);
+	for (uint32_t j = 0; j < view->nlayers; j++) {
+		glBindFramebuffer(GL_FRAMEBUFFER,
+			view->layer_framebuffers[image_index * view->nlayers + j]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER,
+			GL_DEPTH_ATTACHMENT, depth, 0, j);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	view->depth_attachments[image_index] = depth;
+}
+
+/**
+ * Checks whether views can share an array swapchain, which requires them to
+ * have the same size.
+ */
+static bool wxrc_xr_views_support_multiview(uint32_t nviews,
+		XrViewConfigurationView *view_configs) {
+	if (nviews != WXRC_GL_MULTIVIEW_NVIEWS) {
+		wlr_log(WLR_INFO, "Multiview needs %d views, got %d",
+			WXRC_GL_MULTIVIEW_NVIEWS, nviews);
+		return false;
+	}
+	for (uint32_t i = 1; i < nviews; i++) {
+		if (view_configs[i].recommendedImageRectWidth !=
+				view_configs[0].recommendedImageRectWidth ||
+				view_configs[i].recommendedImageRectHeight !=
+				view_configs[0].recommendedImageRectHeight) {
+			wlr_log(WLR_INFO, "Multiview needs views of the same size");
+			return false;
+		}
+	}
+	return true;
+}
+
+static XrResult wxrc_xr_enumerate_swapchain_images(XrSwapchain swapchain,
+		uint32_t *nimages, XrSwapchainImageOpenGLESKHR **images_ptr) {
+	XrResult r = xrEnumerateSwapchainImages(swapchain, 0, nimages, NULL);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrEnumerateSwapchainImages", r);
+		return r;
+	}
+
+	XrSwapchainImageOpenGLESKHR *images =
+		calloc(*nimages, sizeof(XrSwapchainImageOpenGLESKHR));
+	if (images == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return XR_ERROR_OUT_OF_MEMORY;
+	}
+	for (uint32_t i = 0; i < *nimages; i++) {
+		images[i].type = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_ES_KHR;
+		images[i].next = NULL;
+	}
+	r = xrEnumerateSwapchainImages(swapchain, *nimages, nimages,
+		(XrSwapchainImageBaseHeader *)images);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrEnumerateSwapchainImages", r);
+		free(images);
+		return r;
+	}
+	*images_ptr = images;
+	return r;
+}
+
+static XrResult wxrc_xr_view_enumerate_images(struct wxrc_xr_view *view) {
+	return wxrc_xr_enumerate_swapchain_images(view->swapchain,
+		&view->nimages, &view->images);
+}
+
+/**
+ * Picks the depth format closest to the depth buffer used without depth
+ * swapchains. Returns 0 if the runtime supports none.
+ */
+static int64_t wxrc_xr_pick_depth_format(const int64_t *formats,
+		uint32_t nformats) {
+	const int64_t preferred[] = {
+		GL_DEPTH_COMPONENT24_OES,
+		GL_DEPTH24_STENCIL8_OES,
+		GL_DEPTH_COMPONENT16,
+	};
+	for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++) {
+		for (uint32_t j = 0; j < nformats; j++) {
+			if (formats[j] == preferred[i]) {
+				return preferred[i];
+			}
+		}
+	}
+	return 0;
+}
+
+static struct wxrc_xr_view *wxrc_xr_create_swapchains(
+		struct wxrc_xr_backend *backend,
+		XrViewConfigurationView *view_configs) {
+	XrSession session = backend->session;
+	uint32_t nviews = backend->nviews;
+
+	if (backend->multiview &&
+			!wxrc_xr_views_support_multiview(nviews, view_configs)) {
+		backend->multiview = false;
+	}
+	/* With multiview, the first view holds a swapchain with a layer per
+	 * view, the other ones only hold their config */
+	uint32_t nswapchains = wxrc_xr_backend_get_nswapchains(backend);
+	uint32_t array_size = backend->multiview ? nviews : 1;
+
 	uint32_t nformats;
 	XrResult r = xrEnumerateSwapchainFormats(session, 0, &nformats, NULL);
 	if (XR_FAILED(r)) {
@@ -396,6 +652,16 @@ static struct wxrc_xr_view *wxrc_xr_create_swapchains(XrSession session,
 	int64_t format = formats[0];
 	wlr_log(WLR_DEBUG, "XR runtime supports %d swapchain formats, "
 		"picking format %" PRIi64, nformats, format);
+	backend->swapchain_format = format;
+
+	int64_t depth_format = 0;
+	if (backend->depth_layers) {
+		depth_format = wxrc_xr_pick_depth_format(formats, nformats);
+		if (depth_format == 0) {
+			wlr_log(WLR_INFO, "XR runtime supports no depth swapchain "
+				"format, not submitting depth");
+		}
+	}
 
 	free(formats);
 
@@ -407,7 +673,10 @@ static struct wxrc_xr_view *wxrc_xr_create_swapchains(XrSession session,
 
 	for (uint32_t i = 0; i < nviews; i++) {
 		views[i].config = view_configs[i];
+		views[i].swapchain = XR_NULL_HANDLE;
+	}
 
+	for (uint32_t i = 0; i < nswapchains; i++) {
 		XrSwapchainCreateInfo create_info = {
 			.type = XR_TYPE_SWAPCHAIN_CREATE_INFO,
 			.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT |
@@ -418,7 +687,7 @@ static struct wxrc_xr_view *wxrc_xr_create_swapchains(XrSession session,
 			.width = views[i].config.recommendedImageRectWidth,
 			.height = views[i].config.recommendedImageRectHeight,
 			.faceCount = 1,
-			.arraySize = 1,
+			.arraySize = array_size,
 			.mipCount = 1,
 			.next = NULL,
 		};
@@ -427,51 +696,39 @@ static struct wxrc_xr_view *wxrc_xr_create_swapchains(XrSession session,
 			wxrc_log_xr_result("xrCreateSwapchain", r);
 			goto error;
 		}
-	}
 
-	for (uint32_t i = 0; i < nviews; i++) {
-		struct wxrc_xr_view *view = &views[i];
-		r = xrEnumerateSwapchainImages(view->swapchain, 0,
-			&view->nimages, NULL);
+		if (depth_format == 0) {
+			continue;
+		}
+		create_info.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT |
+			XR_SWAPCHAIN_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		create_info.format = depth_format;
+		r = xrCreateSwapchain(session, &create_info,
+			&views[i].depth_swapchain);
 		if (XR_FAILED(r)) {
-			wxrc_log_xr_result("xrEnumerateSwapchainImages", r);
+			wxrc_log_xr_result("xrCreateSwapchain (depth)", r);
 			goto error;
 		}
+	}
 
-		view->images =
-			calloc(view->nimages, sizeof(XrSwapchainImageOpenGLESKHR));
-		if (view->images == NULL) {
-			wlr_log_errno(WLR_ERROR, "calloc failed");
-			r = XR_ERROR_OUT_OF_MEMORY;
+	for (uint32_t i = 0; i < nswapchains; i++) {
+		struct wxrc_xr_view *view = &views[i];
+		if (XR_FAILED(wxrc_xr_view_enumerate_images(view))) {
 			goto error;
 		}
-		for (uint32_t j = 0; j < view->nimages; j++) {
-			view->images[j].type = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_ES_KHR;
-			view->images[j].next = NULL;
-		}
-		r = xrEnumerateSwapchainImages(view->swapchain, view->nimages,
-			&view->nimages, (XrSwapchainImageBaseHeader *)view->images);
-		if (XR_FAILED(r)) {
-			wxrc_log_xr_result("xrEnumerateSwapchainImages", r);
-			free(view->images);
+		if (view->depth_swapchain != XR_NULL_HANDLE &&
+				XR_FAILED(wxrc_xr_enumerate_swapchain_images(
+				view->depth_swapchain, &view->ndepth_images,
+				&view->depth_images))) {
 			goto error;
 		}
 
-		view->framebuffers = calloc(view->nimages, sizeof(GLuint));
-		if (view->framebuffers == NULL) {
-			wlr_log_errno(WLR_ERROR, "calloc failed");
-			r = XR_ERROR_OUT_OF_MEMORY;
+		bool ok = backend->multiview ?
+			wxrc_xr_view_init_multiview_framebuffers(backend, view) :
+			wxrc_xr_view_init_framebuffers(view);
+		if (!ok) {
 			goto error;
 		}
-
-		glGenFramebuffers(view->nimages, view->framebuffers);
-
-		glGenTextures(1, &view->depth_buffer);
-		glBindTexture(GL_TEXTURE_2D, view->depth_buffer);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-			view->config.recommendedImageRectWidth,
-			view->config.recommendedImageRectHeight,
-			0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
 	}
 
 	return views;
@@ -485,65 +742,523 @@ static bool wxrc_xr_init(struct wxrc_xr_backend *backend) {
 	if (XR_FAILED(wxrc_xr_enumerate_layer_props())) {
 		return false;
 	}
-	if (XR_FAILED(wxrc_xr_enumerate_instance_props())) {
+	uint32_t nprops;
+	XrExtensionProperties *props = wxrc_xr_enumerate_instance_props(&nprops);
+	if (props == NULL) {
 		return false;
 	}
 
-	XrResult r = wxrc_create_xr_instance(&backend->instance);
+	XrResult r = wxrc_create_xr_instance(&backend->instance, props, nprops);
 	if (XR_FAILED(r)) {
+		free(props);
 		return false;
 	}
 
-	r = wxrc_get_xr_system(backend->instance, &backend->sysid);
+	/* Optional extensions are only enabled if supported */
+	backend->depth_layers = wxrc_xr_instance_extension_supported(props,
+		nprops, XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME);
+	bool convert_timespec = wxrc_xr_instance_extension_supported(props,
+		nprops, XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME);
+	free(props);
+
+	XrSystemGraphicsProperties graphics_props = {0};
+	r = wxrc_get_xr_system(backend->instance, &backend->sysid,
+		&graphics_props);
 	if (XR_FAILED(r)) {
 		return false;
 	}
+	backend->max_layers = graphics_props.maxLayerCount;
+	backend->max_swapchain_width = graphics_props.maxSwapchainImageWidth;
+	backend->max_swapchain_height = graphics_props.maxSwapchainImageHeight;
 
 	if (XR_FAILED(wxrc_xr_enumerate_view_configs(backend->instance,
 			backend->sysid))) {
 		return false;
 	}
 
+	if (convert_timespec) {
+		r = xrGetInstanceProcAddr(backend->instance,
+			"xrConvertTimeToTimespecTimeKHR",
+			(PFN_xrVoidFunction *)&backend->xrConvertTimeToTimespecTimeKHR);
+		if (XR_FAILED(r)) {
+			wxrc_log_xr_result("xrGetInstanceProcAddr "
+				"(xrConvertTimeToTimespecTimeKHR)", r);
+			backend->xrConvertTimeToTimespecTimeKHR = NULL;
+		}
+	}
+
 	return true;
 }
 
+static bool openxr_get_timespec(struct wxrc_xr_backend *backend,
+		XrTime time, struct timespec *ts) {
+	if (backend->xrConvertTimeToTimespecTimeKHR != NULL) {
+		XrResult r = backend->xrConvertTimeToTimespecTimeKHR(
+			backend->instance, time, ts);
+		if (XR_SUCCEEDED(r)) {
+			return true;
+		}
+		wxrc_log_xr_result("xrConvertTimeToTimespecTimeKHR", r);
+	}
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	return false;
+}
+
 static void wxrc_xr_view_finish(struct wxrc_xr_view *view) {
+	if (view->swapchain == XR_NULL_HANDLE) {
+		return;
+	}
 	glDeleteFramebuffers(view->nimages, view->framebuffers);
+	if (view->layer_framebuffers != NULL) {
+		glDeleteFramebuffers(view->nimages * view->nlayers,
+			view->layer_framebuffers);
+	}
 	free(view->framebuffers);
+	free(view->layer_framebuffers);
 	free(view->images);
 	xrDestroySwapchain(view->swapchain);
+	if (view->depth_swapchain != XR_NULL_HANDLE) {
+		free(view->depth_attachments);
+		free(view->depth_images);
+		xrDestroySwapchain(view->depth_swapchain);
+	} else {
+		glDeleteTextures(1, &view->depth_buffer);
+	}
 }
 
-static bool backend_start(struct wlr_backend *wlr_backend) {
-	struct wxrc_xr_backend *backend = get_xr_backend_from_backend(wlr_backend);
-	assert(!backend->started);
+static void wxrc_xr_backend_init_fences(struct wxrc_xr_backend *backend) {
+	const char *egl_exts = eglQueryString(backend->egl->display, EGL_EXTENSIONS);
+	if (!wxrc_has_extension(egl_exts, "EGL_KHR_fence_sync")) {
+		wlr_log(WLR_INFO, "EGL_KHR_fence_sync not supported, "
+			"falling back to glFinish");
+		return;
+	}
 
-	wlr_log(WLR_DEBUG, "Starting wlroots XR backend");
+	backend->eglCreateSyncKHR = (PFNEGLCREATESYNCKHRPROC)
+		eglGetProcAddress("eglCreateSyncKHR");
+	backend->eglDestroySyncKHR = (PFNEGLDESTROYSYNCKHRPROC)
+		eglGetProcAddress("eglDestroySyncKHR");
+	backend->eglClientWaitSyncKHR = (PFNEGLCLIENTWAITSYNCKHRPROC)
+		eglGetProcAddress("eglClientWaitSyncKHR");
+	if (backend->eglCreateSyncKHR == NULL ||
+			backend->eglDestroySyncKHR == NULL ||
+			backend->eglClientWaitSyncKHR == NULL) {
+		wlr_log(WLR_ERROR, "Failed to load EGL_KHR_fence_sync functions");
+		backend->eglCreateSyncKHR = NULL;
+	}
+}
 
-	const char *gl_exts = (const char *)glGetString(GL_EXTENSIONS);
-	if (gl_exts == NULL) {
-		wlr_log(WLR_ERROR, "Failed to get GL extensions");
+EGLSyncKHR wxrc_xr_backend_create_fence(struct wxrc_xr_backend *backend) {
+	if (backend->eglCreateSyncKHR != NULL) {
+		EGLSyncKHR fence = backend->eglCreateSyncKHR(backend->egl->display,
+			EGL_SYNC_FENCE_KHR, NULL);
+		if (fence != EGL_NO_SYNC_KHR) {
+			glFlush();
+			return fence;
+		}
+		wlr_log(WLR_ERROR, "eglCreateSyncKHR failed");
+	}
+
+	glFinish();
+	return EGL_NO_SYNC_KHR;
+}
+
+bool wxrc_xr_backend_fence_signaled(struct wxrc_xr_backend *backend,
+		EGLSyncKHR fence) {
+	if (fence == EGL_NO_SYNC_KHR) {
+		return true;
+	}
+	EGLint ret = backend->eglClientWaitSyncKHR(backend->egl->display, fence,
+		0, 0);
+	return ret != EGL_TIMEOUT_EXPIRED_KHR;
+}
+
+void wxrc_xr_backend_wait_fence(struct wxrc_xr_backend *backend,
+		EGLSyncKHR fence) {
+	if (fence == EGL_NO_SYNC_KHR) {
+		return;
+	}
+	EGLint ret = backend->eglClientWaitSyncKHR(backend->egl->display, fence,
+		EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+	if (ret == EGL_FALSE) {
+		wlr_log(WLR_ERROR, "eglClientWaitSyncKHR failed, "
+			"falling back to glFinish");
+		glFinish();
+	}
+	backend->eglDestroySyncKHR(backend->egl->display, fence);
+}
+
+void wxrc_xr_backend_destroy_fence(struct wxrc_xr_backend *backend,
+		EGLSyncKHR fence) {
+	if (fence == EGL_NO_SYNC_KHR) {
+		return;
+	}
+	backend->eglDestroySyncKHR(backend->egl->display, fence);
+}
+
+static bool openxr_begin_session(struct wxrc_xr_backend *backend) {
+	XrSessionBeginInfo session_begin_info = {
+		.type = XR_TYPE_SESSION_BEGIN_INFO,
+		.next = NULL,
+		.primaryViewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO,
+	};
+	XrResult r = xrBeginSession(backend->session, &session_begin_info);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrBeginSession", r);
 		return false;
 	}
-	if (strstr(gl_exts, "GL_OES_depth_texture") == NULL) {
-		wlr_log(WLR_ERROR, "GL_OES_depth_texture not supported");
+	return true;
+}
+
+static bool openxr_end_session(struct wxrc_xr_backend *backend) {
+	XrResult r = xrEndSession(backend->session);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrEndSession", r);
 		return false;
 	}
+	return true;
+}
 
-	XrViewConfigurationView *view_configs = wxrc_xr_enumerate_stereo_config_views(
-		backend->instance, backend->sysid, &backend->nviews);
-	if (view_configs == NULL) {
+static XrResult openxr_poll_event(struct wxrc_xr_backend *backend,
+		XrEventDataBuffer *event) {
+	return xrPollEvent(backend->instance, event);
+}
+
+static XrResult openxr_wait_frame(struct wxrc_xr_backend *backend,
+		XrFrameState *frame_state) {
+	return xrWaitFrame(backend->session, NULL, frame_state);
+}
+
+static XrResult openxr_begin_frame(struct wxrc_xr_backend *backend) {
+	return xrBeginFrame(backend->session, NULL);
+}
+
+static XrResult openxr_locate_views(struct wxrc_xr_backend *backend,
+		XrTime display_time, XrView *xr_views) {
+	XrViewLocateInfo view_locate_info = {
+		.type = XR_TYPE_VIEW_LOCATE_INFO,
+		.displayTime = display_time,
+		.space = backend->local_space,
+	};
+	XrViewState view_state = {
+		.type = XR_TYPE_VIEW_STATE,
+		.next = NULL,
+	};
+	return xrLocateViews(backend->session, &view_locate_info, &view_state,
+		backend->nviews, &backend->nviews, xr_views);
+}
+
+static XrResult wxrc_xr_acquire_swapchain_image(XrSwapchain swapchain,
+		uint32_t *image_index) {
+	XrResult r = xrAcquireSwapchainImage(swapchain, NULL, image_index);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrAcquireSwapchainImage", r);
+		return r;
+	}
+
+	XrSwapchainImageWaitInfo swapchain_wait_info = {
+		.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO,
+		.next = NULL,
+		.timeout = 1000,
+	};
+	r = xrWaitSwapchainImage(swapchain, &swapchain_wait_info);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrWaitSwapchainImage", r);
+		/* Otherwise the image stays acquired, and all later acquires
+		 * fail */
+		XrResult release_r = xrReleaseSwapchainImage(swapchain, NULL);
+		if (XR_FAILED(release_r)) {
+			wxrc_log_xr_result("xrReleaseSwapchainImage", release_r);
+		}
+	}
+	return r;
+}
+
+static XrResult openxr_acquire_image(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view, uint32_t *image_index) {
+	XrResult r = wxrc_xr_acquire_swapchain_image(view->swapchain,
+		image_index);
+	if (XR_FAILED(r) || view->depth_swapchain == XR_NULL_HANDLE) {
+		return r;
+	}
+
+	r = wxrc_xr_acquire_swapchain_image(view->depth_swapchain,
+		&view->depth_image_index);
+	if (XR_FAILED(r)) {
+		xrReleaseSwapchainImage(view->swapchain, NULL);
+	}
+	return r;
+}
+
+static XrResult openxr_release_image(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	XrResult r = xrReleaseSwapchainImage(view->swapchain, NULL);
+	if (view->depth_swapchain != XR_NULL_HANDLE) {
+		XrResult depth_r =
+			xrReleaseSwapchainImage(view->depth_swapchain, NULL);
+		if (XR_SUCCEEDED(r)) {
+			r = depth_r;
+		}
+	}
+	return r;
+}
+
+static bool openxr_create_quad_swapchain(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	XrSwapchainCreateInfo create_info = {
+		.type = XR_TYPE_SWAPCHAIN_CREATE_INFO,
+		.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT |
+			XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT,
+		.createFlags = 0,
+		.format = backend->swapchain_format,
+		.sampleCount = 1,
+		.width = view->config.recommendedImageRectWidth,
+		.height = view->config.recommendedImageRectHeight,
+		.faceCount = 1,
+		.arraySize = 1,
+		.mipCount = 1,
+		.next = NULL,
+	};
+	XrResult r = xrCreateSwapchain(backend->session, &create_info,
+		&view->swapchain);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrCreateSwapchain", r);
+		return false;
+	}
+
+	if (XR_FAILED(wxrc_xr_view_enumerate_images(view))) {
+		xrDestroySwapchain(view->swapchain);
+		return false;
+	}
+	return true;
+}
+
+static void openxr_destroy_quad_swapchain(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	free(view->images);
+	xrDestroySwapchain(view->swapchain);
+}
+
+static XrResult openxr_end_frame(struct wxrc_xr_backend *backend,
+		const XrFrameEndInfo *frame_end_info) {
+	return xrEndFrame(backend->session, frame_end_info);
+}
+
+bool wxrc_xr_backend_begin_session(struct wxrc_xr_backend *backend) {
+	assert(!backend->session_running);
+
+	wlr_log(WLR_DEBUG, "Starting XR session");
+	if (!backend->impl->begin_session(backend)) {
 		return false;
 	}
 
+	backend->session_running = true;
+	return true;
+}
+
+bool wxrc_xr_backend_end_session(struct wxrc_xr_backend *backend) {
+	assert(backend->session_running);
+
+	wlr_log(WLR_DEBUG, "Stopping XR session");
+	backend->session_running = false;
+	return backend->impl->end_session(backend);
+}
+
+bool wxrc_xr_backend_get_timespec(struct wxrc_xr_backend *backend,
+		XrTime time, struct timespec *ts) {
+	return backend->impl->get_timespec(backend, time, ts);
+}
+
+XrResult wxrc_xr_backend_poll_event(struct wxrc_xr_backend *backend,
+		XrEventDataBuffer *event) {
+	return backend->impl->poll_event(backend, event);
+}
+
+XrResult wxrc_xr_backend_wait_frame(struct wxrc_xr_backend *backend,
+		XrFrameState *frame_state) {
+	return backend->impl->wait_frame(backend, frame_state);
+}
+
+XrResult wxrc_xr_backend_begin_frame(struct wxrc_xr_backend *backend) {
+	return backend->impl->begin_frame(backend);
+}
+
+XrResult wxrc_xr_backend_locate_views(struct wxrc_xr_backend *backend,
+		XrTime display_time, XrView *xr_views) {
+	return backend->impl->locate_views(backend, display_time, xr_views);
+}
+
+XrResult wxrc_xr_backend_acquire_image(struct wxrc_xr_backend *backend,
+		uint32_t view_index, uint32_t *image_index) {
+	return backend->impl->acquire_image(backend, &backend->views[view_index],
+		image_index);
+}
+
+XrResult wxrc_xr_backend_release_image(struct wxrc_xr_backend *backend,
+		uint32_t view_index) {
+	return backend->impl->release_image(backend, &backend->views[view_index]);
+}
+
+XrResult wxrc_xr_backend_acquire_swapchain_image(
+		struct wxrc_xr_backend *backend, struct wxrc_xr_view *view,
+		uint32_t *image_index) {
+	return backend->impl->acquire_image(backend, view, image_index);
+}
+
+XrResult wxrc_xr_backend_release_swapchain_image(
+		struct wxrc_xr_backend *backend, struct wxrc_xr_view *view) {
+	return backend->impl->release_image(backend, view);
+}
+
+struct wxrc_xr_view *wxrc_xr_backend_create_quad_swapchain(
+		struct wxrc_xr_backend *backend, uint32_t width, uint32_t height) {
+	struct wxrc_xr_view *view = calloc(1, sizeof(*view));
+	if (view == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return NULL;
+	}
+	view->config = (XrViewConfigurationView){
+		.type = XR_TYPE_VIEW_CONFIGURATION_VIEW,
+		.recommendedImageRectWidth = width,
+		.maxImageRectWidth = width,
+		.recommendedImageRectHeight = height,
+		.maxImageRectHeight = height,
+		.recommendedSwapchainSampleCount = 1,
+		.maxSwapchainSampleCount = 1,
+	};
+
+	if (!backend->impl->create_quad_swapchain(backend, view)) {
+		free(view);
+		return NULL;
+	}
+
+	view->framebuffers = calloc(view->nimages, sizeof(GLuint));
+	if (view->framebuffers == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		backend->impl->destroy_quad_swapchain(backend, view);
+		free(view);
+		return NULL;
+	}
+	glGenFramebuffers(view->nimages, view->framebuffers);
+
+	return view;
+}
+
+void wxrc_xr_backend_destroy_quad_swapchain(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	if (view == NULL) {
+		return;
+	}
+	glDeleteFramebuffers(view->nimages, view->framebuffers);
+	free(view->framebuffers);
+	backend->impl->destroy_quad_swapchain(backend, view);
+	free(view);
+}
+
+uint32_t wxrc_xr_backend_get_nswapchains(struct wxrc_xr_backend *backend) {
+	return backend->multiview ? 1 : backend->nviews;
+}
+
+XrResult wxrc_xr_backend_end_frame(struct wxrc_xr_backend *backend,
+		const XrFrameEndInfo *frame_end_info) {
+	return backend->impl->end_frame(backend, frame_end_info);
+}
+
+struct wxrc_egl_saved_context {
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface draw_surface, read_surface;
+};
+
+static void wxrc_egl_save_context(struct wxrc_egl_saved_context *saved) {
+	saved->display = eglGetCurrentDisplay();
+	saved->context = eglGetCurrentContext();
+	saved->draw_surface = eglGetCurrentSurface(EGL_DRAW);
+	saved->read_surface = eglGetCurrentSurface(EGL_READ);
+}
+
+static void wxrc_egl_restore_context(struct wxrc_egl_saved_context *saved) {
+	if (saved->display == EGL_NO_DISPLAY) {
+		return;
+	}
+	if (!eglMakeCurrent(saved->display, saved->draw_surface,
+			saved->read_surface, saved->context)) {
+		wlr_log(WLR_ERROR, "eglMakeCurrent failed");
+	}
+}
+
+bool wxrc_xr_backend_make_current(struct wxrc_xr_backend *backend) {
+	if (!eglMakeCurrent(backend->egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			backend->render_context)) {
+		wlr_log(WLR_ERROR, "eglMakeCurrent failed");
+		return false;
+	}
+	return true;
+}
+
+void wxrc_xr_backend_unset_current(struct wxrc_xr_backend *backend) {
+	eglMakeCurrent(backend->egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		EGL_NO_CONTEXT);
+}
+
+static bool wxrc_xr_backend_create_render_context(
+		struct wxrc_xr_backend *backend) {
+	/* Shared with the wlroots context, so that client buffer textures can be
+	 * sampled from the render thread. Multiview shaders need GLES 3. */
+	EGLint attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, backend->multiview ? 3 : 2,
+		EGL_NONE,
+	};
+	backend->render_context = eglCreateContext(backend->egl->display,
+		backend->egl->config, backend->egl->context, attribs);
+	if (backend->render_context == EGL_NO_CONTEXT && backend->multiview) {
+		wlr_log(WLR_INFO, "Failed to create a GLES 3 context, "
+			"disabling multiview");
+		backend->multiview = false;
+		attribs[1] = 2;
+		backend->render_context = eglCreateContext(backend->egl->display,
+			backend->egl->config, backend->egl->context, attribs);
+	}
+	if (backend->render_context == EGL_NO_CONTEXT) {
+		wlr_log(WLR_ERROR, "eglCreateContext failed");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Loads the multiview entry points. Returns false if multiview isn't
+ * supported by the render context, which must be current.
+ */
+static bool wxrc_xr_backend_init_multiview(struct wxrc_xr_backend *backend) {
+	if (!wxrc_gl_has_extension("GL_OVR_multiview2")) {
+		wlr_log(WLR_INFO, "GL_OVR_multiview2 not supported");
+		return false;
+	}
+
+	/* GL_OVR_multiview2 requires GLES 3, whose core functions are exported
+	 * by libGLESv2 */
+	backend->glFramebufferTextureMultiviewOVR =
+		(PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC)eglGetProcAddress(
+		"glFramebufferTextureMultiviewOVR");
+	if (backend->glFramebufferTextureMultiviewOVR == NULL) {
+		wlr_log(WLR_INFO, "Failed to load glFramebufferTextureMultiviewOVR");
+		return false;
+	}
+	return true;
+}
+
+/* Must be called with the render context current */
+static bool wxrc_xr_backend_init_session(struct wxrc_xr_backend *backend,
+		XrViewConfigurationView *view_configs) {
 	XrResult r = wxrc_create_xr_session(backend->instance, backend->sysid,
-		&backend->session, backend->egl);
+		&backend->session, backend->egl, backend->render_context);
 	if (XR_FAILED(r)) {
 		return false;
 	}
 
 	if (XR_FAILED(wxrc_xr_enumerate_reference_spaces(backend->session))) {
-		return 1;
+		return false;
 	}
 
 	r = wxrc_xr_create_local_reference_space(backend->session, &backend->local_space);
@@ -551,25 +1266,92 @@ static bool backend_start(struct wlr_backend *wlr_backend) {
 		return false;
 	}
 
-	wlr_log(WLR_DEBUG, "Starting XR session");
-	XrSessionBeginInfo session_begin_info = {
-		.type = XR_TYPE_SESSION_BEGIN_INFO,
-		.next = NULL,
-		.primaryViewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO,
-	};
-	r = xrBeginSession(backend->session, &session_begin_info);
-	if (XR_FAILED(r)) {
-		wxrc_log_xr_result("xrBeginSession", r);
+	/* The session is begun by the render thread, once the runtime reports
+	 * it's ready */
+	backend->views = wxrc_xr_create_swapchains(backend, view_configs);
+	return backend->views != NULL;
+}
+
+static bool openxr_start(struct wxrc_xr_backend *backend) {
+	XrViewConfigurationView *view_configs = wxrc_xr_enumerate_stereo_config_views(
+		backend->instance, backend->sysid, &backend->nviews);
+	if (view_configs == NULL) {
+		return false;
+	}
+
+	bool ok = wxrc_xr_backend_init_session(backend, view_configs);
+	free(view_configs);
+	return ok;
+}
+
+static void openxr_destroy(struct wxrc_xr_backend *backend) {
+	if (backend->started) {
+		for (uint32_t i = 0; i < backend->nviews; i++) {
+			wxrc_xr_view_finish(&backend->views[i]);
+		}
+		free(backend->views);
+		xrDestroySpace(backend->local_space);
+	}
+	xrDestroySession(backend->session);
+	xrDestroyInstance(backend->instance);
+}
+
+static const struct wxrc_xr_backend_impl openxr_impl = {
+	.start = openxr_start,
+	.destroy = openxr_destroy,
+	.begin_session = openxr_begin_session,
+	.end_session = openxr_end_session,
+	.get_timespec = openxr_get_timespec,
+	.poll_event = openxr_poll_event,
+	.wait_frame = openxr_wait_frame,
+	.begin_frame = openxr_begin_frame,
+	.locate_views = openxr_locate_views,
+	.acquire_image = openxr_acquire_image,
+	.release_image = openxr_release_image,
+	.create_quad_swapchain = openxr_create_quad_swapchain,
+	.destroy_quad_swapchain = openxr_destroy_quad_swapchain,
+	.end_frame = openxr_end_frame,
+};
+
+static bool backend_start(struct wlr_backend *wlr_backend) {
+	struct wxrc_xr_backend *backend = get_xr_backend_from_backend(wlr_backend);
+	assert(!backend->started);
+
+	wlr_log(WLR_DEBUG, "Starting wlroots XR backend");
+
+	const char *gl_exts = (const char *)glGetString(GL_EXTENSIONS);
+	if (gl_exts == NULL) {
+		wlr_log(WLR_ERROR, "Failed to get GL extensions");
+		return false;
+	}
+	if (!wxrc_has_extension(gl_exts, "GL_OES_depth_texture")) {
+		wlr_log(WLR_ERROR, "GL_OES_depth_texture not supported");
 		return false;
 	}
 
-	backend->views =
-		wxrc_xr_create_swapchains(backend->session, backend->nviews, view_configs);
-	if (backend->views == NULL) {
+	wxrc_xr_backend_init_fences(backend);
+
+	if (!wxrc_xr_backend_create_render_context(backend)) {
 		return false;
 	}
 
-	free(view_configs);
+	/* The session, swapchains and framebuffers belong to the render
+	 * context, restore the wlroots context afterwards */
+	struct wxrc_egl_saved_context saved;
+	wxrc_egl_save_context(&saved);
+	bool ok = wxrc_xr_backend_make_current(backend);
+	if (ok && backend->multiview &&
+			!wxrc_xr_backend_init_multiview(backend)) {
+		backend->multiview = false;
+	}
+	ok = ok && backend->impl->start(backend);
+	wxrc_egl_restore_context(&saved);
+	if (!ok) {
+		return false;
+	}
+	wlr_log(WLR_INFO, "Multiview rendering %s",
+		backend->multiview ? "enabled" : "disabled");
+
 	backend->started = true;
 
 	return true;
@@ -586,15 +1368,17 @@ static void backend_destroy(struct wlr_backend *wlr_backend) {
 
 	wl_list_remove(&backend->local_display_destroy.link);
 
-	if (backend->started) {
-		for (uint32_t i = 0; i < backend->nviews; i++) {
-			wxrc_xr_view_finish(&backend->views[i]);
-		}
-		free(backend->views);
-		xrDestroySpace(backend->local_space);
+	struct wxrc_egl_saved_context saved;
+	wxrc_egl_save_context(&saved);
+	if (backend->render_context != EGL_NO_CONTEXT) {
+		wxrc_xr_backend_make_current(backend);
+	}
+	backend->impl->destroy(backend);
+	wxrc_egl_restore_context(&saved);
+
+	if (backend->render_context != EGL_NO_CONTEXT) {
+		eglDestroyContext(backend->egl->display, backend->render_context);
 	}
-	xrDestroySession(backend->session);
-	xrDestroyInstance(backend->instance);
 
 	free(backend);
 }
@@ -621,6 +1405,19 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	backend_destroy(&backend->base);
 }
 
+void wxrc_xr_backend_init(struct wxrc_xr_backend *backend,
+		const struct wxrc_xr_backend_impl *impl, struct wl_display *display,
+		struct wlr_renderer *renderer) {
+	wlr_backend_init(&backend->base, &backend_impl);
+	backend->impl = impl;
+
+	backend->egl = wlr_gles2_renderer_get_egl(renderer);
+	backend->renderer = renderer;
+
+	backend->local_display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &backend->local_display_destroy);
+}
+
 struct wxrc_xr_backend *wxrc_xr_backend_create(struct wl_display *display,
 		struct wlr_renderer *renderer) {
 	struct wxrc_xr_backend *backend = calloc(1, sizeof(*backend));
@@ -628,17 +1425,11 @@ struct wxrc_xr_backend *wxrc_xr_backend_create(struct wl_display *display,
 		wlr_log_errno(WLR_ERROR, "calloc failed");
 		return NULL;
 	}
-	wlr_backend_init(&backend->base, &backend_impl);
-
-	backend->egl = wlr_gles2_renderer_get_egl(renderer);
-	backend->renderer = renderer;
+	wxrc_xr_backend_init(backend, &openxr_impl, display, renderer);
 
 	if (!wxrc_xr_init(backend)) {
 		return NULL;
 	}
 
-	backend->local_display_destroy.notify = handle_display_destroy;
-	wl_display_add_destroy_listener(display, &backend->local_display_destroy);
-
 	return backend;
 }
@@ -0,0 +1,135 @@
+#include <EGL/egl.h>
+#include <wlr/util/log.h>
+#include "gpu-timer.h"
+#include "render.h"
+
+bool wxrc_gpu_timer_init(struct wxrc_gpu_timer *timer) {
+	*timer = (struct wxrc_gpu_timer){0};
+
+	if (!wxrc_gl_has_extension("GL_EXT_disjoint_timer_query")) {
+		wlr_log(WLR_INFO, "GL_EXT_disjoint_timer_query not supported, "
+			"not timing render passes");
+		return false;
+	}
+
+	timer->glGenQueriesEXT = (PFNGLGENQUERIESEXTPROC)
+		eglGetProcAddress("glGenQueriesEXT");
+	timer->glDeleteQueriesEXT = (PFNGLDELETEQUERIESEXTPROC)
+		eglGetProcAddress("glDeleteQueriesEXT");
+	timer->glBeginQueryEXT = (PFNGLBEGINQUERYEXTPROC)
+		eglGetProcAddress("glBeginQueryEXT");
+	timer->glEndQueryEXT = (PFNGLENDQUERYEXTPROC)
+		eglGetProcAddress("glEndQueryEXT");
+	timer->glGetQueryObjectuivEXT = (PFNGLGETQUERYOBJECTUIVEXTPROC)
+		eglGetProcAddress("glGetQueryObjectuivEXT");
+	timer->glGetQueryObjectui64vEXT = (PFNGLGETQUERYOBJECTUI64VEXTPROC)
+		eglGetProcAddress("glGetQueryObjectui64vEXT");
+	if (timer->glGenQueriesEXT == NULL || timer->glDeleteQueriesEXT == NULL ||
+			timer->glBeginQueryEXT == NULL || timer->glEndQueryEXT == NULL ||
+			timer->glGetQueryObjectuivEXT == NULL ||
+			timer->glGetQueryObjectui64vEXT == NULL) {
+		wlr_log(WLR_ERROR, "Failed to load GL_EXT_disjoint_timer_query");
+		return false;
+	}
+
+	for (size_t i = 0; i < WXRC_GPU_TIMER_NFRAMES; i++) {
+		timer->glGenQueriesEXT(WXRC_GPU_TIMER_MAX_QUERIES,
+			timer->frames[i].queries);
+	}
+
+	/* Clears the disjoint flag, earlier events don't matter */
+	GLint disjoint;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	timer->enabled = true;
+	return true;
+}
+
+void wxrc_gpu_timer_finish(struct wxrc_gpu_timer *timer) {
+	if (!timer->enabled) {
+		return;
+	}
+	wxrc_gpu_timer_end(timer);
+	for (size_t i = 0; i < WXRC_GPU_TIMER_NFRAMES; i++) {
+		timer->glDeleteQueriesEXT(WXRC_GPU_TIMER_MAX_QUERIES,
+			timer->frames[i].queries);
+	}
+	timer->enabled = false;
+}
+
+/**
+ * Adds up the results of a frame's queries. Returns false if they aren't
+ * available yet.
+ */
+static bool read_frame(struct wxrc_gpu_timer *timer,
+		struct wxrc_gpu_timer_frame *frame,
+		int64_t pass_ns[static WXRC_GPU_PASS_COUNT]) {
+	if (frame->nqueries == 0) {
+		return false;
+	}
+
+	/* Queries complete in order, the last one is available once they
+	 * all are */
+	GLuint available = GL_FALSE;
+	timer->glGetQueryObjectuivEXT(frame->queries[frame->nqueries - 1],
+		GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+	if (!available) {
+		return false;
+	}
+
+	memset(pass_ns, 0, WXRC_GPU_PASS_COUNT * sizeof(pass_ns[0]));
+	for (size_t i = 0; i < frame->nqueries; i++) {
+		GLuint64 elapsed_ns = 0;
+		timer->glGetQueryObjectui64vEXT(frame->queries[i],
+			GL_QUERY_RESULT_EXT, &elapsed_ns);
+		pass_ns[frame->passes[i]] += elapsed_ns;
+	}
+	return true;
+}
+
+bool wxrc_gpu_timer_begin_frame(struct wxrc_gpu_timer *timer,
+		int64_t pass_ns[static WXRC_GPU_PASS_COUNT]) {
+	if (!timer->enabled) {
+		return false;
+	}
+	wxrc_gpu_timer_end(timer);
+
+	timer->current = (timer->current + 1) % WXRC_GPU_TIMER_NFRAMES;
+	struct wxrc_gpu_timer_frame *frame = &timer->frames[timer->current];
+	bool ok = read_frame(timer, frame, pass_ns);
+	/* Queries which aren't available are dropped, restarting them
+	 * discards their results */
+	frame->nqueries = 0;
+
+	/* Results are undefined if the GPU has been reset or its clock has
+	 * changed since they were queried */
+	GLint disjoint = GL_FALSE;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	return ok && !disjoint;
+}
+
+void wxrc_gpu_timer_begin(struct wxrc_gpu_timer *timer,
+		enum wxrc_gpu_pass pass) {
+	if (!timer->enabled) {
+		return;
+	}
+	wxrc_gpu_timer_end(timer);
+
+	struct wxrc_gpu_timer_frame *frame = &timer->frames[timer->current];
+	if (frame->nqueries == WXRC_GPU_TIMER_MAX_QUERIES) {
+		return;
+	}
+	frame->passes[frame->nqueries] = pass;
+	timer->glBeginQueryEXT(GL_TIME_ELAPSED_EXT,
+		frame->queries[frame->nqueries]);
+	frame->nqueries++;
+	timer->running = true;
+}
+
+void wxrc_gpu_timer_end(struct wxrc_gpu_timer *timer) {
+	if (!timer->running) {
+		return;
+	}
+	timer->glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+	timer->running = false;
+}
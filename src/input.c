@@ -11,7 +11,9 @@
 #include <unistd.h>
 #include "input.h"
 #include "mathutil.h"
+#include "scene.h"
 #include "server.h"
+#include "trace.h"
 #include "view.h"
 #include "xrutil.h"
 
@@ -19,6 +21,8 @@ static void keyboard_handle_modifiers(
 		struct wl_listener *listener, void *data) {
 	struct wxrc_keyboard *keyboard =
 		wl_container_of(listener, keyboard, modifiers);
+	wxrc_trace_record_keyboard_modifiers(keyboard->server->trace,
+		&keyboard->device->keyboard->modifiers);
 	wlr_seat_set_keyboard(keyboard->server->seat, keyboard->device);
 	wlr_seat_keyboard_notify_modifiers(keyboard->server->seat,
 		&keyboard->device->keyboard->modifiers);
@@ -84,6 +88,8 @@ static void keyboard_handle_key(
 	struct wlr_event_keyboard_key *event = data;
 	struct wlr_seat *seat = server->seat;
 
+	wxrc_trace_record_keyboard_key(server->trace, event);
+
 	uint32_t keycode = event->keycode + 8;
 	const xkb_keysym_t *syms;
 	int nsyms = xkb_state_key_get_syms(
@@ -266,6 +272,9 @@ static void update_pointer_resize(struct wxrc_server *server, XrView *xr_view) {
 
 void wxrc_update_pointer(struct wxrc_server *server, XrView *xr_view,
 		uint32_t time) {
+	/* The cursor follows the head pose, and moved views follow the cursor */
+	server->scene_dirty = true;
+
 	switch (server->seatop) {
 	case WXRC_SEATOP_DEFAULT:
 		update_pointer_default(server, xr_view, time);
@@ -294,6 +303,8 @@ static void pointer_handle_motion(struct wl_listener *listener, void *data) {
 	struct wxrc_server *server = pointer->server;
 	struct wlr_event_pointer_motion *event = data;
 
+	wxrc_trace_record_pointer_motion(server->trace, event);
+
 	server->pointer_rotation[1] += -event->delta_x * 0.001;
 	server->pointer_rotation[0] += -event->delta_y * 0.001;
 
@@ -312,6 +323,8 @@ static void pointer_handle_button(struct wl_listener *listener, void *data) {
 	struct wxrc_server *server = pointer->server;
 	struct wlr_event_pointer_button *event = data;
 
+	wxrc_trace_record_pointer_button(server->trace, event);
+
 	switch (event->state) {
 	case WLR_BUTTON_PRESSED:;
 		float sx, sy;
@@ -361,6 +374,8 @@ static void pointer_handle_axis(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_axis *event = data;
 	struct wxrc_server *server = pointer->server;
 
+	wxrc_trace_record_pointer_axis(server->trace, event);
+
 	bool meta_pressed = false;
 	struct wxrc_keyboard *keyboard;
 	wl_list_for_each(keyboard, &server->keyboards, link) {
@@ -391,6 +406,7 @@ static void pointer_handle_axis(struct wl_listener *listener, void *data) {
 
 		glm_vec3_copy(pos, view->position);
 		glm_vec3_copy(rot, view->rotation);
+		server->scene_dirty = true;
 		return;
 	}
 
@@ -402,6 +418,7 @@ static void pointer_handle_axis(struct wl_listener *listener, void *data) {
 static void pointer_handle_frame(struct wl_listener *listener, void *data) {
 	struct wxrc_pointer *pointer = wl_container_of(listener, pointer, frame);
 
+	wxrc_trace_record_pointer_frame(pointer->server->trace);
 	wlr_seat_pointer_notify_frame(pointer->server->seat);
 }
 
@@ -446,7 +463,10 @@ static void handle_new_input(struct wl_listener *listener, void *data) {
 }
 
 static void cursor_reset(struct wxrc_cursor *cursor) {
-	wlr_texture_destroy(cursor->xcursor_texture);
+	cursor->server->scene_dirty = true;
+
+	/* The render thread may still be drawing it */
+	wxrc_scene_defer_texture_destroy(cursor->server, cursor->xcursor_texture);
 	cursor->xcursor_texture = NULL;
 	cursor->xcursor_image = NULL;
 
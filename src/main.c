@@ -2,11 +2,13 @@
 #include <assert.h>
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
+#include <inttypes.h>
 #include <openxr/openxr.h>
 #include <openxr/openxr_platform.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server.h>
@@ -23,145 +25,111 @@
 #include "input.h"
 #include "output.h"
 #include "render.h"
+#include "render-thread.h"
+#include "scene.h"
 #include "server.h"
+#include "surface.h"
+#include "timing.h"
+#include "trace.h"
 #include "view.h"
 #include "xrutil.h"
 #include "pointer-constraints-unstable-v1-client-protocol.h"
 
-static XrResult wxrc_xr_view_push_frame(struct wxrc_xr_view *view,
-		struct wxrc_server *server, XrView *xr_view,
-		XrCompositionLayerProjectionView *projection_view) {
-	uint32_t buffer_index;
-	XrResult r = xrAcquireSwapchainImage(view->swapchain, NULL, &buffer_index);
-	if (XR_FAILED(r)) {
-		wxrc_log_xr_result("xrAcquireSwapchainImage", r);
-		return r;
-	}
+/* Frame callback interval while the XR session isn't visible */
+#define WXRC_HIDDEN_FRAME_INTERVAL_NS (250 * 1000000)
 
-	XrSwapchainImageWaitInfo swapchain_wait_info = {
-		.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO,
-		.next = NULL,
-		.timeout = 1000,
-	};
-	r = xrWaitSwapchainImage(view->swapchain, &swapchain_wait_info);
-	if (XR_FAILED(r)) {
-		wxrc_log_xr_result("xrWaitSwapchainImage", r);
-		return r;
-	}
-
-	projection_view->type = XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW;
-	projection_view->next = NULL;
-	projection_view->pose = xr_view->pose;
-	projection_view->fov = xr_view->fov;
-	projection_view->subImage.swapchain = view->swapchain;
-	projection_view->subImage.imageArrayIndex = buffer_index;
-	projection_view->subImage.imageRect.offset.x = 0;
-	projection_view->subImage.imageRect.offset.y = 0;
-	projection_view->subImage.imageRect.extent.width =
-		view->config.recommendedImageRectWidth;
-	projection_view->subImage.imageRect.extent.height =
-		view->config.recommendedImageRectHeight;
-
-	wxrc_gl_render_xr_view(server, view, xr_view,
-		view->framebuffers[buffer_index], view->images[buffer_index].image,
-		view->depth_buffer);
-	glFinish();
-
-	r = xrReleaseSwapchainImage(view->swapchain, NULL);
-	if (XR_FAILED(r)) {
-		wxrc_log_xr_result("xrReleaseSwapchainImage", r);
-		return r;
-	}
-
-	return r;
+static void send_frame_done_iterator(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	struct timespec *t = data;
+	wlr_surface_send_frame_done(surface, t);
 }
 
-static bool wxrc_xr_push_frame(struct wxrc_server *server,
-		XrTime predicted_display_time, XrView *xr_views,
-		XrCompositionLayerProjectionView *projection_views) {
-	struct wxrc_xr_backend *backend = server->xr_backend;
+static void xr_view_update_mvp_matricies(
+		struct wxrc_server *server, struct wxrc_zxr_shell_view *view) {
+	for (size_t i = 0; i < server->xr_backend->nviews; ++i) {
+		XrView *xrview = &server->xr_views[i];
+		struct wxrc_xr_view *wxrc_view = &server->xr_backend->views[i];
 
-	for (uint32_t i = 0; i < backend->nviews; i++) {
-		xr_views[i].type = XR_TYPE_VIEW;
-		xr_views[i].next = NULL;
-	}
+		mat4 view_matrix, projection_matrix, vp_matrix;
+		wxrc_xr_view_get_matrix(xrview, view_matrix);
+		glm_mat4_inv(view_matrix, view_matrix);
 
-	XrViewLocateInfo view_locate_info = {
-		.type = XR_TYPE_VIEW_LOCATE_INFO,
-		.displayTime = predicted_display_time,
-		.space = backend->local_space,
-	};
-	XrViewState view_state = {
-		.type = XR_TYPE_VIEW_STATE,
-		.next = NULL,
-	};
-	XrResult r = xrLocateViews(backend->session, &view_locate_info, &view_state,
-		backend->nviews, &backend->nviews, xr_views);
-	if (XR_FAILED(r)) {
-		wxrc_log_xr_result("xrLocateViews", r);
-		return false;
-	}
+		wxrc_get_projection_matrix(xrview, projection_matrix);
+		glm_mat4_mul(projection_matrix, view_matrix, vp_matrix);
 
-	r = xrBeginFrame(backend->session, NULL);
-	if (XR_FAILED(r)) {
-		wxrc_log_xr_result("xrBeginFrame", r);
-		return false;
+		mat4 model_matrix, mvp_matrix;
+		wxrc_view_get_model_matrix(&view->base, model_matrix);
+		glm_mat4_mul(vp_matrix, model_matrix, mvp_matrix);
+
+		wxrc_zxr_surface_v1_send_mvp_matrix_for_view(
+				view->xr_surface, wxrc_view->wl_view, mvp_matrix);
 	}
+}
 
-	for (uint32_t i = 0; i < backend->nviews; i++) {
-		struct wxrc_xr_view *view = &backend->views[i];
-		wxrc_xr_view_push_frame(view, server,
-			&xr_views[i], &projection_views[i]);
+/**
+ * Sends frame callbacks to all surfaces. This is called as soon as client
+ * buffers have been latched for this frame, so that clients get as much time
+ * as possible to draw for the next one.
+ */
+static void wxrc_send_frame_done(struct wxrc_server *server,
+		struct timespec *when) {
+	struct wxrc_view *view;
+	wl_list_for_each(view, &server->views, link) {
+		if (wxrc_view_is_xr_shell(view)) {
+			struct wxrc_zxr_shell_view *xr_view = (void *)view;
+			xr_view_update_mvp_matricies(server, xr_view);
+		}
+		wxrc_view_for_each_surface(view, send_frame_done_iterator, when);
 	}
+	wl_display_flush_clients(server->wl_display);
+	server->last_frame_done_ns = wxrc_get_time_ns();
+}
 
-	XrCompositionLayerProjection projection_layer = {
-		.type = XR_TYPE_COMPOSITION_LAYER_PROJECTION,
-		.next = NULL,
-		.layerFlags = 0,
-		.space = backend->local_space,
-		.viewCount = backend->nviews,
-		.views = projection_views,
-	};
-	const XrCompositionLayerBaseHeader *projection_layers[] = {
-		(XrCompositionLayerBaseHeader *)&projection_layer,
-	};
-	XrFrameEndInfo frame_end_info = {
-		.type = XR_TYPE_FRAME_END_INFO,
-		.displayTime = predicted_display_time,
-		.layerCount = 1,
-		.layers = projection_layers,
-		.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE,
-		.next = NULL,
-	};
-	r = xrEndFrame(backend->session, &frame_end_info);
-	if (XR_FAILED(r)) {
-		wxrc_log_xr_result("xrEndFrame", r);
-		return false;
+/**
+ * Sends frame callbacks at a reduced rate, for when nothing is displayed.
+ */
+static void wxrc_send_hidden_frame_done(struct wxrc_server *server) {
+	int64_t now_ns = wxrc_get_time_ns();
+	if (now_ns - server->last_frame_done_ns < WXRC_HIDDEN_FRAME_INTERVAL_NS) {
+		return;
 	}
 
-	return true;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wxrc_send_frame_done(server, &now);
 }
 
-static void wxrc_xr_handle_event(XrEventDataBuffer *event, bool *running) {
-	switch (event->type) {
-	case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING:
-		*running = false;
-		break;
-	case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED:;
-		XrEventDataSessionStateChanged *state_change_event =
-			(XrEventDataSessionStateChanged *)event;
-		switch (state_change_event->state) {
-		case XR_SESSION_STATE_STOPPING:
-		case XR_SESSION_STATE_LOSS_PENDING:
-		case XR_SESSION_STATE_EXITING:
-			*running = false;
-			break;
-		default:
-			break;
+static void handle_render_frame(struct wl_listener *listener, void *data) {
+	struct wxrc_server *server =
+		wl_container_of(listener, server, render_frame);
+	struct wxrc_render_thread_frame_event *event = data;
+
+	/* Outputs only get frames when there's a new copy to show */
+	if (wxrc_mirror_acquire(&server->render_thread.mirror,
+			server->xr_backend)) {
+		struct wxrc_output *output;
+		wl_list_for_each(output, &server->outputs, link) {
+			output->mirror_damaged = true;
+			wlr_output_schedule_frame(output->output);
 		}
-	default:
-		break;
 	}
+
+	if (!event->visible) {
+		wxrc_send_hidden_frame_done(server);
+		return;
+	}
+
+	struct timespec *display_ts = &event->display_time;
+	uint32_t display_msec =
+		display_ts->tv_sec * 1000 + display_ts->tv_nsec / 1000000;
+	wxrc_update_pointer(server, &server->xr_views[0], display_msec);
+
+	/* Clients use this timestamp to pace themselves, so give them the time
+	 * the frame they've just been latched for is going to be displayed */
+	wxrc_send_frame_done(server, display_ts);
+
+	wxrc_trace_handle_frame(server->trace, event->frame_number, display_ts,
+		server->xr_views, server->xr_backend->nviews);
 }
 
 static int handle_signal(int sig, void *data) {
@@ -170,6 +138,18 @@ static int handle_signal(int sig, void *data) {
 	return 0;
 }
 
+static void report_timings(struct wxrc_server *server) {
+	wxrc_frame_timings_report(&server->timings, "XR frame");
+	wxrc_frame_timings_report(&server->output_timings, "Output frame");
+	wlr_log(WLR_INFO, "shm buffer uploads: %" PRIu64 " damaged, "
+		"%" PRIu64 " full", server->damage_uploads, server->full_uploads);
+}
+
+static int handle_report_timings(int sig, void *data) {
+	report_timings(data);
+	return 0;
+}
+
 static void send_geometry(struct wl_resource *resource) {
 	wl_output_send_geometry(resource, 0, 0,
 		1200, 1200, WL_OUTPUT_SUBPIXEL_UNKNOWN,
@@ -231,6 +211,12 @@ static void output_handle_frame(struct wl_listener *listener, void *data) {
 	struct wxrc_output *output = wl_container_of(listener, output, frame);
 	struct wxrc_server *server = output->server;
 	struct wlr_renderer *renderer = wlr_backend_get_renderer(server->backend);
+	struct wxrc_mirror *mirror = &server->render_thread.mirror;
+
+	GLuint mirror_texture = wxrc_mirror_get_texture(mirror);
+	if (mirror_texture != 0 && !output->mirror_damaged) {
+		return;
+	}
 
 	if (!wlr_output_attach_render(output->output, NULL)) {
 		return;
@@ -239,6 +225,25 @@ static void output_handle_frame(struct wl_listener *listener, void *data) {
 	int width = output->output->width;
 	int height = output->output->height;
 
+	wxrc_frame_timing_begin(&server->output_timings);
+	int64_t gpu_pass_ns[WXRC_GPU_PASS_COUNT];
+	if (wxrc_gpu_timer_begin_frame(&server->gl.gpu_timer, gpu_pass_ns)) {
+		wxrc_frame_timing_set_gpu_passes(&server->output_timings,
+			gpu_pass_ns);
+	}
+
+	if (mirror_texture != 0) {
+		wlr_renderer_begin(renderer, width, height);
+		wxrc_gl_render_mirror(&server->gl, mirror_texture,
+			mirror->width, mirror->height, width, height);
+		wlr_renderer_end(renderer);
+
+		output->mirror_damaged = false;
+		wlr_output_commit(output->output);
+		wxrc_frame_timing_end(&server->output_timings, 0, 0);
+		return;
+	}
+
 	mat4 view_matrix;
 	wxrc_xr_view_get_matrix(&server->xr_views[0], view_matrix);
 	glm_mat4_inv(view_matrix, view_matrix);
@@ -246,15 +251,20 @@ static void output_handle_frame(struct wl_listener *listener, void *data) {
 	mat4 projection_matrix;
 	glm_perspective_default((float)width / height, projection_matrix);
 
+	struct wxrc_scene *scene = wxrc_scene_create(server);
+
 	wlr_renderer_begin(renderer, width, height);
-	wxrc_gl_render_view(server, &server->xr_backend->views[0],
-		view_matrix, projection_matrix);
+	wxrc_gl_render_view(&server->gl, scene, 0, view_matrix, projection_matrix);
 	wlr_renderer_end(renderer);
+
+	wxrc_scene_destroy(server, scene);
 	wlr_output_commit(output->output);
+	wxrc_frame_timing_end(&server->output_timings, 0, 0);
 }
 
 static void output_handle_destroy(struct wl_listener *listener, void *data) {
 	struct wxrc_output *output = wl_container_of(listener, output, destroy);
+	wl_list_remove(&output->link);
 	wl_list_remove(&output->frame.link);
 	wl_list_remove(&output->destroy.link);
 	free(output);
@@ -267,6 +277,7 @@ static void handle_new_output(struct wl_listener *listener, void *data) {
 	struct wxrc_output *output = calloc(1, sizeof(*output));
 	output->output = wlr_output;
 	output->server = server;
+	wl_list_insert(&server->outputs, &output->link);
 
 	output->frame.notify = output_handle_frame;
 	wl_signal_add(&wlr_output->events.frame, &output->frame);
@@ -323,34 +334,6 @@ static void backend_iterator(struct wlr_backend *backend, void *data) {
 	wl_display_roundtrip(remote_display);
 }
 
-static void send_frame_done_iterator(struct wlr_surface *surface,
-		int sx, int sy, void *data) {
-	struct timespec *t = data;
-	wlr_surface_send_frame_done(surface, t);
-}
-
-static void xr_view_update_mvp_matricies(
-		struct wxrc_server *server, struct wxrc_zxr_shell_view *view) {
-	for (size_t i = 0; i < server->xr_backend->nviews; ++i) {
-		XrView *xrview = &server->xr_views[i];
-		struct wxrc_xr_view *wxrc_view = &server->xr_backend->views[i];
-
-		mat4 view_matrix, projection_matrix, vp_matrix;
-		wxrc_xr_view_get_matrix(xrview, view_matrix);
-		glm_mat4_inv(view_matrix, view_matrix);
-
-		wxrc_get_projection_matrix(xrview, projection_matrix);
-		glm_mat4_mul(projection_matrix, view_matrix, vp_matrix);
-
-		mat4 model_matrix, mvp_matrix;
-		wxrc_view_get_model_matrix(&view->base, model_matrix);
-		glm_mat4_mul(vp_matrix, model_matrix, mvp_matrix);
-
-		wxrc_zxr_surface_v1_send_mvp_matrix_for_view(
-				view->xr_surface, wxrc_view->wl_view, mvp_matrix);
-	}
-}
-
 struct wlr_renderer *create_renderer(struct wlr_egl *egl, EGLenum platform,
 		void *remote_display, EGLint *config_attribs, EGLint visual_id) {
 	EGLint wxrc_attribs[64];
@@ -367,23 +350,95 @@ struct wlr_renderer *create_renderer(struct wlr_egl *egl, EGLenum platform,
 		wxrc_attribs, visual_id);
 }
 
+/**
+ * Parses "inset[:scale]", with both values in (0, 1]. The periphery is rendered
+ * at half the resolution by default.
+ */
+static bool parse_foveation(const char *str, float *inset_size,
+		float *periphery_scale) {
+	char *end;
+	*inset_size = strtof(str, &end);
+	*periphery_scale = 0.5;
+	if (*end == ':') {
+		*periphery_scale = strtof(end + 1, &end);
+	}
+	return end != str && *end == '\0' &&
+		*inset_size > 0 && *inset_size <= 1 &&
+		*periphery_scale > 0 && *periphery_scale <= 1;
+}
+
+static bool parse_rate(const char *str, float *rate) {
+	char *end;
+	*rate = strtof(str, &end);
+	/* The copy interval is computed in nanoseconds */
+	return end != str && *end == '\0' &&
+		*rate >= 0.1f && *rate <= 1000;
+}
+
 int main(int argc, char *argv[]) {
 	struct wxrc_server server = {0};
 
 	wlr_log_init(WLR_DEBUG, NULL);
 
 	const char *startup_cmd = NULL;
+	const char *record_path = NULL, *replay_path = NULL;
+	bool multiview = false;
 	int opt;
-	while ((opt = getopt(argc, argv, "s:h")) != -1) {
+	while ((opt = getopt(argc, argv, "f:glmM:qr:R:s:h")) != -1) {
 		switch (opt) {
+		case 'f':
+			if (!parse_foveation(optarg,
+					&server.render_thread.foveation_inset_size,
+					&server.render_thread.foveation_periphery_scale)) {
+				fprintf(stderr, "invalid foveation '%s', expected "
+					"inset[:scale] with values in (0, 1]\n", optarg);
+				return 1;
+			}
+			break;
+		case 'g':
+			server.render_thread.hide_grid = true;
+			break;
+		case 'l':
+			server.render_thread.late_latch = true;
+			break;
+		case 'm':
+			multiview = true;
+			break;
+		case 'M':
+			if (!parse_rate(optarg, &server.render_thread.mirror_rate)) {
+				fprintf(stderr, "invalid mirror rate '%s', expected a "
+					"value between 0.1 and 1000\n", optarg);
+				return 1;
+			}
+			break;
+		case 'q':
+			server.render_thread.quad_layers = true;
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'R':
+			record_path = optarg;
+			break;
 		case 's':
 			startup_cmd = optarg;
 			break;
 		default:
-			fprintf(stderr, "usage: %s [-s startup-cmd]\n", argv[0]);
+			fprintf(stderr, "usage: %s [-f inset[:scale]] [-g] [-l] [-m] "
+				"[-M rate] [-q] [-r trace | -R trace] [-s startup-cmd]\n",
+				argv[0]);
 			return 1;
 		}
 	}
+	if (record_path != NULL && replay_path != NULL) {
+		fprintf(stderr, "-r and -R are mutually exclusive\n");
+		return 1;
+	}
+	/* The periphery is rendered to a single-layer texture */
+	if (multiview && server.render_thread.foveation_inset_size > 0) {
+		fprintf(stderr, "-f and -m are mutually exclusive\n");
+		return 1;
+	}
 
 	server.wl_display = wl_display_create();
 	if (server.wl_display == NULL) {
@@ -397,8 +452,10 @@ int main(int argc, char *argv[]) {
 	struct wl_event_source *signals[] = {
 		wl_event_loop_add_signal(wl_event_loop, SIGTERM, handle_signal, &running),
 		wl_event_loop_add_signal(wl_event_loop, SIGINT, handle_signal, &running),
+		wl_event_loop_add_signal(wl_event_loop, SIGUSR1,
+			handle_report_timings, &server),
 	};
-	if (signals[0] == NULL || signals[1] == NULL) {
+	if (signals[0] == NULL || signals[1] == NULL || signals[2] == NULL) {
 		wlr_log(WLR_ERROR, "wl_event_loop_add_signal failed");
 		return 1;
 	}
@@ -410,29 +467,45 @@ int main(int argc, char *argv[]) {
 	}
 	wlr_multi_for_each_backend(server.backend, backend_iterator, &server);
 
+	wl_list_init(&server.outputs);
 	server.new_output.notify = handle_new_output;
 	wl_signal_add(&server.backend->events.new_output, &server.new_output);
 
 	struct wlr_renderer *renderer = wlr_backend_get_renderer(server.backend);
-	server.xr_backend = wxrc_xr_backend_create(server.wl_display, renderer);
+	const char *xr_backend_name = getenv("WXRC_XR_BACKEND");
+	/* Traces are replayed on the null backend, which feeds the recorded
+	 * head poses to the render thread */
+	if (replay_path != NULL || (xr_backend_name != NULL &&
+			strcmp(xr_backend_name, "null") == 0)) {
+		server.xr_backend =
+			wxrc_null_xr_backend_create(server.wl_display, renderer);
+	} else {
+		server.xr_backend = wxrc_xr_backend_create(server.wl_display, renderer);
+	}
 	if (server.xr_backend == NULL || server.backend == NULL) {
 		wlr_log(WLR_ERROR, "backend creation failed");
 		return 1;
 	}
 	struct wxrc_xr_backend *xr_backend = server.xr_backend;
+	xr_backend->multiview = multiview;
 	wlr_multi_backend_add(server.backend, &xr_backend->base);
 
 	if (!wxrc_gl_init(&server.gl)) {
 		return 1;
 	}
+	/* The desktop mirror shows the same environment */
+	server.gl.hide_grid = server.render_thread.hide_grid;
 
 	wlr_renderer_init_wl_display(renderer, server.wl_display);
 
-	wlr_compositor_create(server.wl_display, renderer);
+	server.compositor = wlr_compositor_create(server.wl_display, renderer);
+	wxrc_surface_init(&server);
 	wlr_data_device_manager_create(server.wl_display);
 	wlr_data_control_manager_v1_create(server.wl_display);
 	wlr_primary_selection_v1_device_manager_create(server.wl_display);
 
+	wl_list_init(&server.scenes);
+	wl_list_init(&server.deferred_textures);
 	wxrc_input_init(&server);
 
 	wl_list_init(&server.views);
@@ -454,6 +527,19 @@ int main(int argc, char *argv[]) {
 	/* This needs to be done after the XR backend is started */
 	wxrc_xr_shell_init(&server, renderer);
 
+	if (record_path != NULL) {
+		server.trace = wxrc_trace_create_recorder(&server, record_path);
+		if (server.trace == NULL) {
+			return 1;
+		}
+	} else if (replay_path != NULL) {
+		server.trace = wxrc_trace_create_replayer(&server, replay_path);
+		if (server.trace == NULL) {
+			return 1;
+		}
+		wxrc_null_xr_backend_set_trace(xr_backend, server.trace);
+	}
+
 	setenv("WAYLAND_DISPLAY", wl_socket, true);
 	if (startup_cmd != NULL) {
 		pid_t pid = fork();
@@ -470,74 +556,58 @@ int main(int argc, char *argv[]) {
 	wl_global_create(server.wl_display, &wl_output_interface,
 			3, NULL, output_bind);
 
-	wlr_log(WLR_DEBUG, "Starting XR main loop");
+	wxrc_frame_scheduler_init(&server.scheduler);
+
 	server.xr_views = calloc(xr_backend->nviews, sizeof(XrView));
-	XrCompositionLayerProjectionView *projection_views =
-		calloc(xr_backend->nviews, sizeof(XrCompositionLayerProjectionView));
-	while (running) {
-		XrFrameState frame_state = {
-			.type = XR_TYPE_FRAME_STATE,
-			.next = NULL,
-		};
-		XrResult r = xrWaitFrame(xr_backend->session, NULL, &frame_state);
-		if (XR_FAILED(r)) {
-			wxrc_log_xr_result("xrWaitFrame", r);
-			return 1;
-		}
+	if (server.xr_views == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return 1;
+	}
 
-		XrEventDataBuffer event = {
-			.type = XR_TYPE_EVENT_DATA_BUFFER,
-			.next = NULL,
-		};
-		r = xrPollEvent(xr_backend->instance, &event);
-		if (r != XR_EVENT_UNAVAILABLE) {
-			if (XR_FAILED(r)) {
-				wxrc_log_xr_result("xrPollEvent", r);
-				return 1;
-			}
-			wxrc_xr_handle_event(&event, &running);
-		}
+	server.render_frame.notify = handle_render_frame;
+	wl_signal_add(&server.render_thread.events.frame, &server.render_frame);
+	if (!wxrc_render_thread_start(&server.render_thread, &server)) {
+		return 1;
+	}
 
+	while (running && wxrc_render_thread_is_running(&server.render_thread)) {
 		wl_display_flush_clients(server.wl_display);
-		int ret = wl_event_loop_dispatch(wl_event_loop, 1);
-		if (ret < 0) {
+		if (wl_event_loop_dispatch(wl_event_loop, -1) < 0) {
 			wlr_log(WLR_ERROR, "wl_event_loop_dispatch failed");
-			return 1;
-		}
-
-		if (!running) {
 			break;
 		}
 
-		/* TODO: time from predictedDisplayTime */
-		wxrc_update_pointer(&server, &server.xr_views[0], 0);
-
-		if (!wxrc_xr_push_frame(&server, frame_state.predictedDisplayTime,
-				server.xr_views, projection_views)) {
-			return 1;
+		/* Most wakeups, e.g. client requests which don't commit, leave
+		 * the scene as it is */
+		if (!server.scene_dirty) {
+			continue;
 		}
 
-		struct timespec now;
-		/* TODO: Derive this from predictedDisplayTime */
-		clock_gettime(CLOCK_MONOTONIC, &now);
-
-		struct wxrc_view *view;
-		wl_list_for_each(view, &server.views, link) {
-			if (wxrc_view_is_xr_shell(view)) {
-				struct wxrc_zxr_shell_view *xr_view = (void *)view;
-				xr_view_update_mvp_matricies(&server, xr_view);
-			}
-			wxrc_view_for_each_surface(view, send_frame_done_iterator, &now);
+		struct wxrc_scene *scene = wxrc_scene_create(&server);
+		if (scene != NULL) {
+			/* Texture uploads must be done before the render thread
+			 * samples them on its own context */
+			scene->fence = wxrc_xr_backend_create_fence(server.xr_backend);
+			wxrc_render_thread_publish_scene(&server.render_thread, scene);
 		}
 	}
 
+	wxrc_render_thread_stop(&server.render_thread);
+	wl_list_remove(&server.render_frame.link);
+	wxrc_mirror_reclaim(&server.render_thread.mirror, server.xr_backend);
+	bool failed = atomic_load(&server.render_thread.failed);
+
+	wxrc_trace_destroy(server.trace);
+
+	report_timings(&server);
+
 	wlr_log(WLR_DEBUG, "Tearing down XR instance");
-	free(projection_views);
 	free(server.xr_views);
 	wl_event_source_remove(signals[0]);
 	wl_event_source_remove(signals[1]);
+	wl_event_source_remove(signals[2]);
 	wxrc_gl_finish(&server.gl);
 	wl_display_destroy_clients(server.wl_display);
 	wl_display_destroy(server.wl_display);
-	return 0;
+	return failed ? 1 : 0;
 }
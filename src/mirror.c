@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "backend.h"
+#include "mirror.h"
+
+void wxrc_mirror_init(struct wxrc_mirror *mirror) {
+	atomic_init(&mirror->latest, -1);
+	mirror->has_read = false;
+	for (int i = 0; i < WXRC_MIRROR_NSLOTS; i++) {
+		mirror->fences[i] = EGL_NO_SYNC_KHR;
+	}
+}
+
+bool wxrc_mirror_init_copies(struct wxrc_mirror *mirror, uint32_t width,
+		uint32_t height, int64_t interval_ns) {
+	/* The Wayland thread reads the size and the texture names */
+	if (atomic_load(&mirror->latest) != -1) {
+		wlr_log(WLR_ERROR, "Mirror copies are still in use");
+		return false;
+	}
+
+	mirror->width = width;
+	mirror->height = height;
+	mirror->interval_ns = interval_ns;
+	mirror->last_copy_ns = 0;
+
+	glGenTextures(WXRC_MIRROR_NSLOTS, mirror->textures);
+	glGenFramebuffers(WXRC_MIRROR_NSLOTS, mirror->framebuffers);
+	for (int i = 0; i < WXRC_MIRROR_NSLOTS; i++) {
+		glBindTexture(GL_TEXTURE_2D, mirror->textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+			GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, mirror->framebuffers[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, mirror->textures[i], 0);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE) {
+			wlr_log(WLR_ERROR, "Mirror framebuffer incomplete (0x%X)",
+				status);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glDeleteFramebuffers(WXRC_MIRROR_NSLOTS, mirror->framebuffers);
+			glDeleteTextures(WXRC_MIRROR_NSLOTS, mirror->textures);
+			return false;
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	/* The render thread starts with slot 0, the Wayland thread with slot 2
+	 * and slot 1 is in between. read_slot is only read after the first
+	 * copy has been published. */
+	mirror->write_slot = 0;
+	mirror->read_slot = 2;
+	atomic_store(&mirror->latest, 1);
+	return true;
+}
+
+void wxrc_mirror_finish(struct wxrc_mirror *mirror) {
+	if (atomic_load(&mirror->latest) < 0) {
+		return;
+	}
+	/* Framebuffers aren't shared, they must be deleted from this
+	 * context */
+	glDeleteFramebuffers(WXRC_MIRROR_NSLOTS, mirror->framebuffers);
+	atomic_store(&mirror->latest, WXRC_MIRROR_RELEASED);
+}
+
+void wxrc_mirror_reclaim(struct wxrc_mirror *mirror,
+		struct wxrc_xr_backend *backend) {
+	if (atomic_load(&mirror->latest) != WXRC_MIRROR_RELEASED) {
+		return;
+	}
+	for (int i = 0; i < WXRC_MIRROR_NSLOTS; i++) {
+		wxrc_xr_backend_destroy_fence(backend, mirror->fences[i]);
+		mirror->fences[i] = EGL_NO_SYNC_KHR;
+	}
+	glDeleteTextures(WXRC_MIRROR_NSLOTS, mirror->textures);
+	mirror->has_read = false;
+	atomic_store(&mirror->latest, -1);
+}
+
+GLuint wxrc_mirror_begin_copy(struct wxrc_mirror *mirror,
+		struct wxrc_xr_backend *backend, int64_t now_ns) {
+	if (atomic_load(&mirror->latest) < 0 ||
+			now_ns - mirror->last_copy_ns < mirror->interval_ns) {
+		return 0;
+	}
+
+	/* Rather than waiting for the Wayland thread's context, skip the copy
+	 * and try again next frame */
+	EGLSyncKHR *fence = &mirror->fences[mirror->write_slot];
+	if (!wxrc_xr_backend_fence_signaled(backend, *fence)) {
+		return 0;
+	}
+	wxrc_xr_backend_destroy_fence(backend, *fence);
+	*fence = EGL_NO_SYNC_KHR;
+
+	mirror->last_copy_ns = now_ns;
+	return mirror->framebuffers[mirror->write_slot];
+}
+
+void wxrc_mirror_publish(struct wxrc_mirror *mirror) {
+	int prev = atomic_exchange(&mirror->latest,
+		mirror->write_slot | WXRC_MIRROR_FRESH);
+	/* Either a copy the Wayland thread has skipped, or the one it has
+	 * just given back */
+	mirror->write_slot = prev & ~WXRC_MIRROR_FRESH;
+}
+
+bool wxrc_mirror_acquire(struct wxrc_mirror *mirror,
+		struct wxrc_xr_backend *backend) {
+	/* Only the Wayland thread clears the flag, the render thread can
+	 * only publish an even newer copy or release the copies */
+	int latest = atomic_load(&mirror->latest);
+	if (latest >= 0 && (latest & WXRC_MIRROR_FRESH) && mirror->has_read) {
+		/* Sampling commands for the slot handed back may still be
+		 * queued, the render thread mustn't overwrite it before
+		 * they're done. Published along with the slot. */
+		mirror->fences[mirror->read_slot] =
+			wxrc_xr_backend_create_fence(backend);
+	}
+	do {
+		if (latest == WXRC_MIRROR_RELEASED) {
+			wxrc_mirror_reclaim(mirror, backend);
+			return false;
+		}
+		if (latest < 0 || !(latest & WXRC_MIRROR_FRESH)) {
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak(&mirror->latest, &latest,
+		mirror->read_slot));
+	mirror->read_slot = latest & ~WXRC_MIRROR_FRESH;
+	mirror->has_read = true;
+	return true;
+}
+
+GLuint wxrc_mirror_get_texture(struct wxrc_mirror *mirror) {
+	if (!mirror->has_read || atomic_load(&mirror->latest) < 0) {
+		return 0;
+	}
+	return mirror->textures[mirror->read_slot];
+}
@@ -0,0 +1,394 @@
+#define _POSIX_C_SOURCE 200112L
+#include <cglm/cglm.h>
+#include <errno.h>
+#include <GLES3/gl3.h>
+#include <math.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "backend.h"
+#include "timing.h"
+#include "trace.h"
+
+#define WXRC_NULL_NVIEWS 2
+#define WXRC_NULL_NIMAGES 3
+#define WXRC_NULL_VIEW_WIDTH 1024
+#define WXRC_NULL_VIEW_HEIGHT 1024
+/* The minimum layer count OpenXR runtimes must support */
+#define WXRC_NULL_MAX_LAYERS 16
+#define WXRC_NULL_MAX_SWAPCHAIN_SIZE 4096
+#define WXRC_NULL_DEFAULT_REFRESH_RATE 90
+/* Frame periods are whole nanoseconds, and must not round down to 0 */
+#define WXRC_NULL_MAX_REFRESH_RATE 1000
+/* Interpupillary distance, in meters */
+#define WXRC_NULL_IPD 0.064
+
+/**
+ * The null backend uses CLOCK_MONOTONIC nanoseconds as its XrTime.
+ */
+struct wxrc_null_xr_backend {
+	struct wxrc_xr_backend base;
+
+	int64_t period_ns;
+	int64_t start_ns;
+	int64_t next_display_ns;
+
+	/* Number of frames to run before exiting, 0 to run forever */
+	uint64_t max_frames;
+	uint64_t nframes;
+	bool exit_sent;
+
+	/* Trace to take head poses from, may be NULL */
+	struct wxrc_trace *trace;
+};
+
+static struct wxrc_null_xr_backend *null_backend_from_backend(
+		struct wxrc_xr_backend *backend) {
+	return (struct wxrc_null_xr_backend *)backend;
+}
+
+static uint64_t getenv_uint(const char *name, uint64_t default_value) {
+	const char *str = getenv(name);
+	if (str == NULL || str[0] == '\0') {
+		return default_value;
+	}
+	char *end;
+	errno = 0;
+	unsigned long long value = strtoull(str, &end, 10);
+	if (errno != 0 || end[0] != '\0') {
+		wlr_log(WLR_ERROR, "Invalid %s: %s", name, str);
+		return default_value;
+	}
+	return value;
+}
+
+static bool null_start(struct wxrc_xr_backend *backend) {
+	struct wxrc_null_xr_backend *null = null_backend_from_backend(backend);
+
+	backend->nviews = WXRC_NULL_NVIEWS;
+	backend->views = calloc(backend->nviews, sizeof(struct wxrc_xr_view));
+	if (backend->views == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return false;
+	}
+
+	/* Both views have the same size, so multiview is always possible */
+	uint32_t nswapchains = wxrc_xr_backend_get_nswapchains(backend);
+	for (uint32_t i = 0; i < backend->nviews; i++) {
+		struct wxrc_xr_view *view = &backend->views[i];
+		view->config = (XrViewConfigurationView){
+			.type = XR_TYPE_VIEW_CONFIGURATION_VIEW,
+			.recommendedImageRectWidth = WXRC_NULL_VIEW_WIDTH,
+			.maxImageRectWidth = WXRC_NULL_VIEW_WIDTH,
+			.recommendedImageRectHeight = WXRC_NULL_VIEW_HEIGHT,
+			.maxImageRectHeight = WXRC_NULL_VIEW_HEIGHT,
+			.recommendedSwapchainSampleCount = 1,
+			.maxSwapchainSampleCount = 1,
+		};
+		view->swapchain = XR_NULL_HANDLE;
+		if (i >= nswapchains) {
+			continue;
+		}
+
+		view->nimages = WXRC_NULL_NIMAGES;
+		view->images =
+			calloc(view->nimages, sizeof(XrSwapchainImageOpenGLESKHR));
+		if (view->images == NULL) {
+			wlr_log_errno(WLR_ERROR, "calloc failed");
+			return false;
+		}
+		for (uint32_t j = 0; j < view->nimages; j++) {
+			view->images[j].type = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_ES_KHR;
+			glGenTextures(1, &view->images[j].image);
+			if (backend->multiview) {
+				glBindTexture(GL_TEXTURE_2D_ARRAY, view->images[j].image);
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8_OES,
+					view->config.recommendedImageRectWidth,
+					view->config.recommendedImageRectHeight,
+					backend->nviews, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+			} else {
+				glBindTexture(GL_TEXTURE_2D, view->images[j].image);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+					view->config.recommendedImageRectWidth,
+					view->config.recommendedImageRectHeight,
+					0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				glBindTexture(GL_TEXTURE_2D, 0);
+			}
+		}
+
+		bool ok = backend->multiview ?
+			wxrc_xr_view_init_multiview_framebuffers(backend, view) :
+			wxrc_xr_view_init_framebuffers(view);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	null->start_ns = wxrc_get_time_ns();
+	null->next_display_ns = null->start_ns + null->period_ns;
+
+	backend->session_state = XR_SESSION_STATE_FOCUSED;
+	backend->session_running = true;
+
+	wlr_log(WLR_INFO, "Null XR backend: %dx%d views at %.2f Hz",
+		WXRC_NULL_VIEW_WIDTH, WXRC_NULL_VIEW_HEIGHT,
+		1e9 / null->period_ns);
+	if (null->max_frames > 0) {
+		wlr_log(WLR_INFO, "Null XR backend: exiting after %llu frames",
+			(unsigned long long)null->max_frames);
+	}
+
+	return true;
+}
+
+static void null_destroy(struct wxrc_xr_backend *backend) {
+	if (backend->views == NULL) {
+		return;
+	}
+	for (uint32_t i = 0; i < backend->nviews; i++) {
+		struct wxrc_xr_view *view = &backend->views[i];
+		if (view->framebuffers != NULL) {
+			glDeleteFramebuffers(view->nimages, view->framebuffers);
+			glDeleteTextures(1, &view->depth_buffer);
+		}
+		if (view->layer_framebuffers != NULL) {
+			glDeleteFramebuffers(view->nimages * view->nlayers,
+				view->layer_framebuffers);
+		}
+		if (view->images != NULL) {
+			for (uint32_t j = 0; j < view->nimages; j++) {
+				glDeleteTextures(1, &view->images[j].image);
+			}
+		}
+		free(view->framebuffers);
+		free(view->layer_framebuffers);
+		free(view->images);
+	}
+	free(backend->views);
+}
+
+static bool null_begin_session(struct wxrc_xr_backend *backend) {
+	return true;
+}
+
+static bool null_end_session(struct wxrc_xr_backend *backend) {
+	return true;
+}
+
+static bool null_get_timespec(struct wxrc_xr_backend *backend, XrTime time,
+		struct timespec *ts) {
+	ts->tv_sec = time / 1000000000;
+	ts->tv_nsec = time % 1000000000;
+	return true;
+}
+
+static XrResult null_poll_event(struct wxrc_xr_backend *backend,
+		XrEventDataBuffer *event) {
+	struct wxrc_null_xr_backend *null = null_backend_from_backend(backend);
+
+	if (null->max_frames == 0 || null->nframes < null->max_frames ||
+			null->exit_sent) {
+		return XR_EVENT_UNAVAILABLE;
+	}
+
+	XrEventDataSessionStateChanged *state_changed =
+		(XrEventDataSessionStateChanged *)event;
+	state_changed->type = XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED;
+	state_changed->next = NULL;
+	state_changed->session = XR_NULL_HANDLE;
+	state_changed->state = XR_SESSION_STATE_EXITING;
+	state_changed->time = wxrc_get_time_ns();
+	null->exit_sent = true;
+	return XR_SUCCESS;
+}
+
+static XrResult null_wait_frame(struct wxrc_xr_backend *backend,
+		XrFrameState *frame_state) {
+	struct wxrc_null_xr_backend *null = null_backend_from_backend(backend);
+
+	/* Frames start one period before they're displayed. If we're late,
+	 * skip to the next slot like a real runtime would. */
+	int64_t wake_ns = null->next_display_ns - null->period_ns;
+	int64_t now_ns = wxrc_get_time_ns();
+	if (wake_ns < now_ns) {
+		int64_t skipped =
+			(now_ns - wake_ns + null->period_ns - 1) / null->period_ns;
+		wake_ns += skipped * null->period_ns;
+		null->next_display_ns += skipped * null->period_ns;
+	}
+
+	struct timespec ts;
+	null_get_timespec(backend, wake_ns, &ts);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		// Try again
+	}
+
+	frame_state->predictedDisplayTime = null->next_display_ns;
+	frame_state->predictedDisplayPeriod = null->period_ns;
+	frame_state->shouldRender = XR_TRUE;
+	null->next_display_ns += null->period_ns;
+	return XR_SUCCESS;
+}
+
+static XrResult null_begin_frame(struct wxrc_xr_backend *backend) {
+	return XR_SUCCESS;
+}
+
+/**
+ * Looks left and right while slowly nodding, so that windows move across the
+ * whole field of view. Only depends on the display time, so that runs are
+ * reproducible.
+ */
+static XrResult null_locate_views(struct wxrc_xr_backend *backend,
+		XrTime display_time, XrView *xr_views) {
+	struct wxrc_null_xr_backend *null = null_backend_from_backend(backend);
+
+	/* Frames are numbered like the render thread's, both count
+	 * xrEndFrame calls */
+	if (null->trace != NULL && wxrc_trace_get_frame_views(null->trace,
+			null->nframes, xr_views, backend->nviews)) {
+		return XR_SUCCESS;
+	}
+
+	float t = (display_time - null->start_ns) / 1e9;
+	float yaw = glm_rad(40.0) * sinf(2 * GLM_PI * 0.2 * t);
+	float pitch = glm_rad(15.0) * sinf(2 * GLM_PI * 0.13 * t);
+
+	versor yaw_quat, pitch_quat, orientation;
+	glm_quatv(yaw_quat, yaw, (vec3){ 0.0, 1.0, 0.0 });
+	glm_quatv(pitch_quat, pitch, (vec3){ 1.0, 0.0, 0.0 });
+	glm_quat_mul(yaw_quat, pitch_quat, orientation);
+
+	for (uint32_t i = 0; i < backend->nviews; i++) {
+		float eye_offset = (i == 0 ? -0.5 : 0.5) * WXRC_NULL_IPD;
+		vec3 position;
+		glm_quat_rotatev(orientation, (vec3){ eye_offset, 0.0, 0.0 },
+			position);
+
+		xr_views[i].pose.orientation = (XrQuaternionf){
+			.x = orientation[0],
+			.y = orientation[1],
+			.z = orientation[2],
+			.w = orientation[3],
+		};
+		xr_views[i].pose.position = (XrVector3f){
+			.x = position[0],
+			.y = position[1],
+			.z = position[2],
+		};
+		xr_views[i].fov = (XrFovf){
+			.angleLeft = glm_rad(-45.0),
+			.angleRight = glm_rad(45.0),
+			.angleUp = glm_rad(45.0),
+			.angleDown = glm_rad(-45.0),
+		};
+	}
+
+	return XR_SUCCESS;
+}
+
+static XrResult null_acquire_image(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view, uint32_t *image_index) {
+	struct wxrc_null_xr_backend *null = null_backend_from_backend(backend);
+
+	/* Images are acquired at most once per frame, cycle through them like
+	 * a runtime would */
+	*image_index = null->nframes % view->nimages;
+	return XR_SUCCESS;
+}
+
+static XrResult null_release_image(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	return XR_SUCCESS;
+}
+
+static bool null_create_quad_swapchain(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	view->swapchain = XR_NULL_HANDLE;
+	view->nimages = WXRC_NULL_NIMAGES;
+	view->images = calloc(view->nimages, sizeof(XrSwapchainImageOpenGLESKHR));
+	if (view->images == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return false;
+	}
+	for (uint32_t i = 0; i < view->nimages; i++) {
+		view->images[i].type = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_ES_KHR;
+		glGenTextures(1, &view->images[i].image);
+		glBindTexture(GL_TEXTURE_2D, view->images[i].image);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+			view->config.recommendedImageRectWidth,
+			view->config.recommendedImageRectHeight,
+			0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return true;
+}
+
+static void null_destroy_quad_swapchain(struct wxrc_xr_backend *backend,
+		struct wxrc_xr_view *view) {
+	for (uint32_t i = 0; i < view->nimages; i++) {
+		glDeleteTextures(1, &view->images[i].image);
+	}
+	free(view->images);
+}
+
+static XrResult null_end_frame(struct wxrc_xr_backend *backend,
+		const XrFrameEndInfo *frame_end_info) {
+	struct wxrc_null_xr_backend *null = null_backend_from_backend(backend);
+	null->nframes++;
+	return XR_SUCCESS;
+}
+
+static const struct wxrc_xr_backend_impl null_impl = {
+	.start = null_start,
+	.destroy = null_destroy,
+	.begin_session = null_begin_session,
+	.end_session = null_end_session,
+	.get_timespec = null_get_timespec,
+	.poll_event = null_poll_event,
+	.wait_frame = null_wait_frame,
+	.begin_frame = null_begin_frame,
+	.locate_views = null_locate_views,
+	.acquire_image = null_acquire_image,
+	.release_image = null_release_image,
+	.create_quad_swapchain = null_create_quad_swapchain,
+	.destroy_quad_swapchain = null_destroy_quad_swapchain,
+	.end_frame = null_end_frame,
+};
+
+struct wxrc_xr_backend *wxrc_null_xr_backend_create(
+		struct wl_display *display, struct wlr_renderer *renderer) {
+	struct wxrc_null_xr_backend *null = calloc(1, sizeof(*null));
+	if (null == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return NULL;
+	}
+	wxrc_xr_backend_init(&null->base, &null_impl, display, renderer);
+	null->base.max_layers = WXRC_NULL_MAX_LAYERS;
+	null->base.max_swapchain_width = WXRC_NULL_MAX_SWAPCHAIN_SIZE;
+	null->base.max_swapchain_height = WXRC_NULL_MAX_SWAPCHAIN_SIZE;
+
+	uint64_t refresh_rate = getenv_uint("WXRC_NULL_REFRESH_RATE",
+		WXRC_NULL_DEFAULT_REFRESH_RATE);
+	if (refresh_rate == 0 || refresh_rate > WXRC_NULL_MAX_REFRESH_RATE) {
+		wlr_log(WLR_ERROR, "WXRC_NULL_REFRESH_RATE must be between 1 and "
+			"%d Hz, using %d Hz", WXRC_NULL_MAX_REFRESH_RATE,
+			WXRC_NULL_DEFAULT_REFRESH_RATE);
+		refresh_rate = WXRC_NULL_DEFAULT_REFRESH_RATE;
+	}
+	null->period_ns = 1000000000 / refresh_rate;
+	null->max_frames = getenv_uint("WXRC_NULL_FRAMES", 0);
+
+	return &null->base;
+}
+
+void wxrc_null_xr_backend_set_trace(struct wxrc_xr_backend *backend,
+		struct wxrc_trace *trace) {
+	struct wxrc_null_xr_backend *null = null_backend_from_backend(backend);
+
+	null->trace = trace;
+	null->max_frames = wxrc_trace_get_frame_count(trace);
+	if (null->max_frames == 0) {
+		wlr_log(WLR_ERROR, "Trace doesn't contain any frame");
+	}
+}
@@ -0,0 +1,325 @@
+#define _POSIX_C_SOURCE 200809L
+#include <EGL/egl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "program-cache.h"
+#include "render.h"
+
+/*
+ * A cached program is a header followed by the binary returned by
+ * glGetProgramBinaryOES. Binaries are only valid for the driver which produced
+ * them, which is part of the key, but the driver still gets the final word:
+ * binaries it rejects are dropped from the cache.
+ */
+
+#define WXRC_PROGRAM_CACHE_MAGIC "wxrcprg"
+#define WXRC_PROGRAM_CACHE_VERSION 1
+
+struct program_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t format;
+};
+
+/* 64-bit FNV-1a */
+#define FNV_OFFSET_BASIS UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t hash_string(uint64_t hash, const char *str) {
+	/* The terminator is hashed too, so that consecutive strings can't be
+	 * split differently and still give the same hash */
+	do {
+		hash ^= (uint8_t)*str;
+		hash *= FNV_PRIME;
+	} while (*str++ != '\0');
+	return hash;
+}
+
+static char *format_path(const char *fmt, const char *a, const char *b) {
+	int len = snprintf(NULL, 0, fmt, a, b);
+	char *path = malloc(len + 1);
+	if (path == NULL) {
+		wlr_log_errno(WLR_ERROR, "malloc failed");
+		return NULL;
+	}
+	snprintf(path, len + 1, fmt, a, b);
+	return path;
+}
+
+static bool make_dir(const char *path) {
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		wlr_log_errno(WLR_ERROR, "Failed to create %s", path);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Returns $XDG_CACHE_HOME/wxrc, defaulting to ~/.cache/wxrc, after creating it
+ * if needed.
+ */
+static char *create_cache_dir(void) {
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	char *parent;
+	if (cache_home != NULL && cache_home[0] != '\0') {
+		parent = strdup(cache_home);
+	} else {
+		const char *home = getenv("HOME");
+		if (home == NULL) {
+			return NULL;
+		}
+		parent = format_path("%s/%s", home, ".cache");
+	}
+	if (parent == NULL) {
+		return NULL;
+	}
+
+	char *dir = NULL;
+	if (make_dir(parent)) {
+		dir = format_path("%s/%s", parent, "wxrc");
+		if (dir != NULL && !make_dir(dir)) {
+			free(dir);
+			dir = NULL;
+		}
+	}
+	free(parent);
+	return dir;
+}
+
+bool wxrc_program_cache_init(struct wxrc_program_cache *cache) {
+	*cache = (struct wxrc_program_cache){0};
+
+	if (!wxrc_gl_has_extension("GL_OES_get_program_binary")) {
+		wlr_log(WLR_INFO, "GL_OES_get_program_binary not supported, "
+			"not caching programs");
+		return false;
+	}
+	/* Some drivers expose the extension without any binary format */
+	GLint nformats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &nformats);
+	if (nformats <= 0) {
+		wlr_log(WLR_INFO, "No program binary format, not caching programs");
+		return false;
+	}
+
+	cache->glGetProgramBinaryOES = (PFNGLGETPROGRAMBINARYOESPROC)
+		eglGetProcAddress("glGetProgramBinaryOES");
+	cache->glProgramBinaryOES = (PFNGLPROGRAMBINARYOESPROC)
+		eglGetProcAddress("glProgramBinaryOES");
+	if (cache->glGetProgramBinaryOES == NULL ||
+			cache->glProgramBinaryOES == NULL) {
+		wlr_log(WLR_ERROR, "Failed to load GL_OES_get_program_binary");
+		return false;
+	}
+
+	cache->dir = create_cache_dir();
+	if (cache->dir == NULL) {
+		return false;
+	}
+
+	static const GLenum driver_strings[] = {
+		GL_VENDOR,
+		GL_RENDERER,
+		GL_VERSION,
+		GL_SHADING_LANGUAGE_VERSION,
+	};
+	cache->driver_hash = FNV_OFFSET_BASIS;
+	for (size_t i = 0; i < sizeof(driver_strings) / sizeof(driver_strings[0]);
+			i++) {
+		const char *str = (const char *)glGetString(driver_strings[i]);
+		cache->driver_hash =
+			hash_string(cache->driver_hash, str != NULL ? str : "");
+	}
+
+	return true;
+}
+
+void wxrc_program_cache_finish(struct wxrc_program_cache *cache) {
+	free(cache->dir);
+	cache->dir = NULL;
+}
+
+uint64_t wxrc_program_cache_key(struct wxrc_program_cache *cache,
+		const char *const *strings, size_t nstrings) {
+	uint64_t hash = cache->driver_hash;
+	for (size_t i = 0; i < nstrings; i++) {
+		hash = hash_string(hash, strings[i]);
+	}
+	return hash;
+}
+
+static char *get_program_path(struct wxrc_program_cache *cache,
+		uint64_t key) {
+	char name[17];
+	snprintf(name, sizeof(name), "%016" PRIx64, key);
+	return format_path("%s/%s", cache->dir, name);
+}
+
+static void *read_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		/* Not cached yet */
+		return NULL;
+	}
+
+	void *data = NULL;
+	if (fseek(f, 0, SEEK_END) != 0) {
+		goto exit;
+	}
+	long len = ftell(f);
+	if (len <= 0 || fseek(f, 0, SEEK_SET) != 0) {
+		goto exit;
+	}
+	data = malloc(len);
+	if (data == NULL) {
+		wlr_log_errno(WLR_ERROR, "malloc failed");
+		goto exit;
+	}
+	if (fread(data, len, 1, f) != 1) {
+		wlr_log_errno(WLR_ERROR, "Failed to read %s", path);
+		free(data);
+		data = NULL;
+		goto exit;
+	}
+	*size = len;
+
+exit:
+	fclose(f);
+	return data;
+}
+
+GLuint wxrc_program_cache_load(struct wxrc_program_cache *cache,
+		uint64_t key) {
+	if (cache->dir == NULL) {
+		return 0;
+	}
+	char *path = get_program_path(cache, key);
+	if (path == NULL) {
+		return 0;
+	}
+
+	size_t size = 0;
+	uint8_t *data = read_file(path, &size);
+	if (data == NULL) {
+		free(path);
+		return 0;
+	}
+
+	GLuint program = 0;
+	struct program_cache_header header;
+	if (size <= sizeof(header)) {
+		goto invalid;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, WXRC_PROGRAM_CACHE_MAGIC,
+			sizeof(header.magic)) != 0 ||
+			header.version != WXRC_PROGRAM_CACHE_VERSION) {
+		goto invalid;
+	}
+
+	program = glCreateProgram();
+	cache->glProgramBinaryOES(program, header.format, data + sizeof(header),
+		size - sizeof(header));
+	GLint ok;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		glDeleteProgram(program);
+		program = 0;
+		goto invalid;
+	}
+
+	free(data);
+	free(path);
+	return program;
+
+invalid:
+	/* E.g. the driver has been updated without changing its version */
+	wlr_log(WLR_DEBUG, "Dropping invalid cached program %s", path);
+	unlink(path);
+	free(data);
+	free(path);
+	return 0;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+void wxrc_program_cache_store(struct wxrc_program_cache *cache,
+		uint64_t key, GLuint program) {
+	if (cache->dir == NULL) {
+		return;
+	}
+
+	GLint binary_size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &binary_size);
+	if (binary_size <= 0) {
+		return;
+	}
+
+	struct program_cache_header header = {
+		.magic = WXRC_PROGRAM_CACHE_MAGIC,
+		.version = WXRC_PROGRAM_CACHE_VERSION,
+	};
+	uint8_t *data = malloc(sizeof(header) + binary_size);
+	if (data == NULL) {
+		wlr_log_errno(WLR_ERROR, "malloc failed");
+		return;
+	}
+	GLsizei len = 0;
+	GLenum format = 0;
+	cache->glGetProgramBinaryOES(program, binary_size, &len, &format,
+		data + sizeof(header));
+	if (len <= 0) {
+		free(data);
+		return;
+	}
+	header.format = format;
+	memcpy(data, &header, sizeof(header));
+
+	char *path = get_program_path(cache, key);
+	char *tmp_path = path != NULL ?
+		format_path("%s%s", path, ".XXXXXX") : NULL;
+	if (tmp_path == NULL) {
+		free(path);
+		free(data);
+		return;
+	}
+
+	/* Written aside and renamed, so that loads never see a partial file,
+	 * even if both threads store the same program at once */
+	int fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create %s", tmp_path);
+	} else if (!write_all(fd, data, sizeof(header) + len)) {
+		wlr_log_errno(WLR_ERROR, "Failed to write %s", tmp_path);
+		close(fd);
+		unlink(tmp_path);
+	} else {
+		close(fd);
+		if (rename(tmp_path, path) != 0) {
+			wlr_log_errno(WLR_ERROR, "Failed to rename %s", tmp_path);
+			unlink(tmp_path);
+		}
+	}
+
+	free(tmp_path);
+	free(path);
+	free(data);
+}
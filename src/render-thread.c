@@ -0,0 +1,1097 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "backend.h"
+#include "render-thread.h"
+#include "scene.h"
+#include "server.h"
+#include "timing.h"
+#include "xrutil.h"
+
+/* How long to sleep between polls while the XR session isn't running */
+#define WXRC_IDLE_INTERVAL_NS (250 * 1000000)
+/* Identifies the cursor's quad layer, view IDs are never 0 */
+#define WXRC_QUAD_CURSOR_ID 0
+
+/**
+ * A 2D view or the cursor, submitted as a quad layer. The runtime keeps
+ * showing the last released image, so the swapchain is only rendered to when
+ * the content changes.
+ */
+struct wxrc_quad_layer {
+	uint64_t id; // wxrc_scene_view.id or WXRC_QUAD_CURSOR_ID
+	struct wxrc_xr_view *swapchain;
+	XrCompositionLayerQuad layer;
+
+	/* Content of the last rendered image. The bounding box is in pixels,
+	 * in the plane of the view. */
+	bool rendered;
+	uint64_t commit_seq;
+	size_t nsurfaces;
+	int x1, y1, x2, y2;
+
+	/* Per frame state */
+	bool used, acquired;
+
+	struct wl_list link; // wxrc_render_thread.quads
+};
+
+static void render_thread_wake(struct wxrc_render_thread *rt) {
+	uint64_t one = 1;
+	if (write(rt->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		wlr_log_errno(WLR_ERROR, "write to eventfd failed");
+	}
+}
+
+static void sleep_until(int64_t deadline_ns) {
+	struct timespec ts = {
+		.tv_sec = deadline_ns / 1000000000,
+		.tv_nsec = deadline_ns % 1000000000,
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		// Try again
+	}
+}
+
+static void render_thread_retire_scene(struct wxrc_render_thread *rt,
+		struct wxrc_scene *scene) {
+	if (scene == NULL) {
+		return;
+	}
+	struct wxrc_scene *head = atomic_load(&rt->retired_scenes);
+	do {
+		scene->next_retired = head;
+	} while (!atomic_compare_exchange_weak(&rt->retired_scenes, &head, scene));
+}
+
+/**
+ * Switches to the latest published scene, if any. The previous scene is handed
+ * back to the Wayland thread: the GPU is done with it, since we've waited for
+ * the last frame to complete.
+ */
+static void render_thread_latch_scene(struct wxrc_render_thread *rt) {
+	struct wxrc_scene *scene = atomic_exchange(&rt->pending_scene, NULL);
+	if (scene == NULL) {
+		return;
+	}
+	render_thread_retire_scene(rt, rt->scene);
+	rt->scene = scene;
+
+	/* The Wayland thread uploaded the scene's textures on its own
+	 * context */
+	wxrc_xr_backend_wait_fence(rt->server->xr_backend, scene->fence);
+	scene->fence = EGL_NO_SYNC_KHR;
+}
+
+static void render_thread_notify_frame(struct wxrc_render_thread *rt,
+		bool visible, XrTime display_time) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	pthread_mutex_lock(&rt->frame_lock);
+	rt->frame_pending = true;
+	rt->frame.visible = visible;
+	rt->frame.frame_number = rt->nframes;
+	if (visible) {
+		wxrc_xr_backend_get_timespec(backend, display_time,
+			&rt->frame.display_time);
+		memcpy(rt->frame_views, rt->xr_views,
+			backend->nviews * sizeof(XrView));
+	}
+	pthread_mutex_unlock(&rt->frame_lock);
+
+	render_thread_wake(rt);
+}
+
+/**
+ * Returns the size of the image rect a view is rendered to this frame. The
+ * rest of the swapchain image is left out.
+ */
+static void render_thread_get_image_size(struct wxrc_render_thread *rt,
+		struct wxrc_xr_view *view, uint32_t *width, uint32_t *height) {
+	wxrc_resolution_governor_get_size(&rt->resolution,
+		view->config.recommendedImageRectWidth,
+		view->config.recommendedImageRectHeight, width, height);
+}
+
+/**
+ * Fills the projection layer view for an XR view, which has been rendered to
+ * a layer of a swapchain.
+ */
+static void render_thread_init_projection_view(struct wxrc_render_thread *rt,
+		uint32_t index, struct wxrc_xr_view *view, uint32_t array_index) {
+	XrView *xr_view = &rt->xr_views[index];
+	XrCompositionLayerProjectionView *projection_view =
+		&rt->projection_views[index];
+
+	projection_view->type = XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW;
+	projection_view->next = NULL;
+	projection_view->pose = xr_view->pose;
+	projection_view->fov = xr_view->fov;
+	projection_view->subImage.swapchain = view->swapchain;
+	projection_view->subImage.imageArrayIndex = array_index;
+	uint32_t width, height;
+	render_thread_get_image_size(rt, view, &width, &height);
+	projection_view->subImage.imageRect.offset.x = 0;
+	projection_view->subImage.imageRect.offset.y = 0;
+	projection_view->subImage.imageRect.extent.width = width;
+	projection_view->subImage.imageRect.extent.height = height;
+
+	if (!rt->gl.write_depth) {
+		return;
+	}
+	/* Lets the runtime reproject positionally if we miss a frame */
+	XrCompositionLayerDepthInfoKHR *depth_info = &rt->depth_infos[index];
+	*depth_info = (XrCompositionLayerDepthInfoKHR){
+		.type = XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR,
+		.next = NULL,
+		.subImage = projection_view->subImage,
+		.minDepth = 0.0,
+		.maxDepth = 1.0,
+		.nearZ = WXRC_GL_NEAR_Z,
+		.farZ = WXRC_GL_FAR_Z,
+	};
+	depth_info->subImage.swapchain = view->depth_swapchain;
+	projection_view->next = depth_info;
+}
+
+static void wxrc_xr_view_render(struct wxrc_render_thread *rt, uint32_t index,
+		uint32_t buffer_index) {
+	struct wxrc_xr_view *view = &rt->server->xr_backend->views[index];
+
+	render_thread_init_projection_view(rt, index, view, 0);
+
+	uint32_t width, height;
+	render_thread_get_image_size(rt, view, &width, &height);
+	wxrc_gl_render_xr_view(&rt->gl, rt->scene, index, &rt->xr_views[index],
+		width, height, view->framebuffers[buffer_index],
+		view->images[buffer_index].image,
+		wxrc_xr_view_get_depth_texture(view));
+}
+
+/**
+ * Renders all views at once into the layers of the first view's swapchain.
+ */
+static void wxrc_xr_multiview_render(struct wxrc_render_thread *rt,
+		uint32_t buffer_index) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+	struct wxrc_xr_view *view = &backend->views[0];
+
+	for (uint32_t i = 0; i < backend->nviews; i++) {
+		render_thread_init_projection_view(rt, i, view, i);
+	}
+	wxrc_xr_view_update_multiview_depth(backend, view, buffer_index);
+
+	uint32_t width, height;
+	render_thread_get_image_size(rt, view, &width, &height);
+	wxrc_gl_render_xr_multiview(&rt->gl, rt->scene, rt->xr_views,
+		width, height, view->framebuffers[buffer_index],
+		&view->layer_framebuffers[buffer_index * view->nlayers]);
+}
+
+/**
+ * Copies the first view's image for the desktop mirror, unless the last copy
+ * is recent enough. Returns true if a copy has been made, it must be published
+ * once the GPU is done with it.
+ */
+static bool render_thread_copy_mirror(struct wxrc_render_thread *rt) {
+	struct wxrc_xr_view *view = &rt->server->xr_backend->views[0];
+
+	GLuint framebuffer = wxrc_mirror_begin_copy(&rt->mirror,
+		rt->server->xr_backend, wxrc_get_time_ns());
+	if (framebuffer == 0) {
+		return false;
+	}
+
+	uint32_t width, height;
+	render_thread_get_image_size(rt, view, &width, &height);
+	wxrc_gl_render_mirror_copy(&rt->gl,
+		view->images[rt->buffer_indices[0]].image, width, height,
+		view->config.recommendedImageRectWidth,
+		view->config.recommendedImageRectHeight, framebuffer,
+		rt->mirror.width, rt->mirror.height);
+	return true;
+}
+
+static bool render_thread_add_layer(struct wxrc_render_thread *rt,
+		size_t *nlayers, const XrCompositionLayerBaseHeader *layer) {
+	if (*nlayers == rt->layers_cap) {
+		size_t cap = rt->layers_cap == 0 ? 16 : rt->layers_cap * 2;
+		const XrCompositionLayerBaseHeader **layers =
+			realloc(rt->layers, cap * sizeof(layers[0]));
+		if (layers == NULL) {
+			wlr_log_errno(WLR_ERROR, "realloc failed");
+			return false;
+		}
+		rt->layers = layers;
+		rt->layers_cap = cap;
+	}
+	rt->layers[(*nlayers)++] = layer;
+	return true;
+}
+
+static struct wxrc_quad_layer *render_thread_get_quad(
+		struct wxrc_render_thread *rt, uint64_t id) {
+	struct wxrc_quad_layer *quad;
+	wl_list_for_each(quad, &rt->quads, link) {
+		if (quad->id == id) {
+			return quad;
+		}
+	}
+
+	quad = calloc(1, sizeof(*quad));
+	if (quad == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return NULL;
+	}
+	quad->id = id;
+	wl_list_insert(&rt->quads, &quad->link);
+	return quad;
+}
+
+static void quad_layer_destroy(struct wxrc_render_thread *rt,
+		struct wxrc_quad_layer *quad) {
+	wxrc_xr_backend_destroy_quad_swapchain(rt->server->xr_backend,
+		quad->swapchain);
+	wl_list_remove(&quad->link);
+	free(quad);
+}
+
+/**
+ * Updates a quad layer showing surfaces which lie in the plane of
+ * pose_matrix. The image is only rendered if the content has changed since
+ * the last one, a commit_seq of 0 means it's unknown. Returns false if the
+ * layer has nothing to show.
+ */
+static bool render_thread_update_quad(struct wxrc_render_thread *rt,
+		struct wxrc_quad_layer *quad, mat4 pose_matrix,
+		struct wxrc_scene_surface *surfaces, size_t nsurfaces,
+		uint64_t commit_seq) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	quad->used = true;
+
+	mat4 inv_pose_matrix;
+	glm_mat4_inv(pose_matrix, inv_pose_matrix);
+
+	int x1, y1, x2, y2;
+	if (!wxrc_gl_get_surface_bounds(inv_pose_matrix, surfaces, nsurfaces,
+			&x1, &y1, &x2, &y2)) {
+		return false;
+	}
+
+	/* Larger views are downscaled */
+	uint32_t width = x2 - x1, height = y2 - y1;
+	if (width > backend->max_swapchain_width) {
+		width = backend->max_swapchain_width;
+	}
+	if (height > backend->max_swapchain_height) {
+		height = backend->max_swapchain_height;
+	}
+
+	if (quad->swapchain == NULL ||
+			quad->swapchain->config.recommendedImageRectWidth != width ||
+			quad->swapchain->config.recommendedImageRectHeight != height) {
+		wxrc_xr_backend_destroy_quad_swapchain(backend, quad->swapchain);
+		quad->rendered = false;
+		quad->swapchain =
+			wxrc_xr_backend_create_quad_swapchain(backend, width, height);
+		if (quad->swapchain == NULL) {
+			return false;
+		}
+	}
+
+	bool changed = !quad->rendered || commit_seq == 0 ||
+		commit_seq != quad->commit_seq || nsurfaces != quad->nsurfaces ||
+		x1 != quad->x1 || y1 != quad->y1 || x2 != quad->x2 || y2 != quad->y2;
+	if (changed) {
+		struct wxrc_xr_view *swapchain = quad->swapchain;
+		uint32_t image_index;
+		XrResult r = wxrc_xr_backend_acquire_swapchain_image(backend,
+			swapchain, &image_index);
+		if (XR_FAILED(r)) {
+			return quad->rendered;
+		}
+
+		mat4 vp_matrix;
+		wxrc_gl_get_bounds_vp_matrix(inv_pose_matrix, x1, y1, x2, y2,
+			vp_matrix);
+
+		wxrc_gl_render_quad(&rt->gl, surfaces, nsurfaces, vp_matrix,
+			swapchain->framebuffers[image_index],
+			swapchain->images[image_index].image, width, height);
+
+		quad->acquired = true;
+		quad->commit_seq = commit_seq;
+		quad->nsurfaces = nsurfaces;
+		quad->x1 = x1;
+		quad->y1 = y1;
+		quad->x2 = x2;
+		quad->y2 = y2;
+	}
+
+	/* The pose may change without the content changing, e.g. while a view
+	 * is being moved */
+	mat4 layer_matrix;
+	glm_translate_to(pose_matrix, (vec3){
+		(quad->x1 + quad->x2) / 2.0 / WXRC_SURFACE_SCALE,
+		(quad->y1 + quad->y2) / 2.0 / WXRC_SURFACE_SCALE,
+		0.0,
+	}, layer_matrix);
+	versor orientation;
+	glm_mat4_quat(layer_matrix, orientation);
+
+	quad->layer = (XrCompositionLayerQuad){
+		.type = XR_TYPE_COMPOSITION_LAYER_QUAD,
+		.next = NULL,
+		/* Surfaces are rendered with premultiplied alpha */
+		.layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT,
+		.space = backend->local_space,
+		.eyeVisibility = XR_EYE_VISIBILITY_BOTH,
+		.subImage = {
+			.swapchain = quad->swapchain->swapchain,
+			.imageRect = {
+				.offset = { .x = 0, .y = 0 },
+				.extent = {
+					.width = quad->swapchain->config.recommendedImageRectWidth,
+					.height = quad->swapchain->config.recommendedImageRectHeight,
+				},
+			},
+			.imageArrayIndex = 0,
+		},
+		.pose = {
+			.orientation = {
+				.x = orientation[0],
+				.y = orientation[1],
+				.z = orientation[2],
+				.w = orientation[3],
+			},
+			.position = {
+				.x = layer_matrix[3][0],
+				.y = layer_matrix[3][1],
+				.z = layer_matrix[3][2],
+			},
+		},
+		.size = {
+			.width = (quad->x2 - quad->x1) / WXRC_SURFACE_SCALE,
+			.height = (quad->y2 - quad->y1) / WXRC_SURFACE_SCALE,
+		},
+	};
+	return true;
+}
+
+/**
+ * Updates the quad layers of all 2D views and the cursor, and destroys the
+ * ones which aren't in the scene anymore. Adds the layers to rt->layers, in
+ * back-to-front order.
+ */
+static void render_thread_update_quads(struct wxrc_render_thread *rt,
+		size_t *nlayers) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+	struct wxrc_scene *scene = rt->scene;
+
+	struct wxrc_quad_layer *quad, *tmp;
+	wl_list_for_each(quad, &rt->quads, link) {
+		quad->used = false;
+	}
+
+	if (scene == NULL) {
+		goto destroy_unused;
+	}
+
+	/* If the runtime can't take that many layers, leave out the views
+	 * which are the furthest back */
+	size_t nquads = scene->has_cursor ? 1 : 0;
+	for (size_t i = 0; i < scene->nviews; i++) {
+		if (!scene->views[i].xr_shell) {
+			nquads++;
+		}
+	}
+	size_t max_quads = backend->max_layers > 1 ? backend->max_layers - 1 : 0;
+	size_t skip = nquads > max_quads ? nquads - max_quads : 0;
+	if (skip > 0) {
+		wlr_log(WLR_DEBUG, "Too many quad layers, hiding %zu views", skip);
+	}
+
+	for (size_t i = 0; i < scene->nviews; i++) {
+		struct wxrc_scene_view *view = &scene->views[i];
+		if (view->xr_shell) {
+			continue;
+		}
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+
+		quad = render_thread_get_quad(rt, view->id);
+		if (quad != NULL && render_thread_update_quad(rt, quad,
+				view->pose_matrix, &scene->surfaces[view->first_surface],
+				view->nsurfaces, view->commit_seq)) {
+			render_thread_add_layer(rt, nlayers,
+				(XrCompositionLayerBaseHeader *)&quad->layer);
+		}
+	}
+
+	if (scene->has_cursor && skip == 0) {
+		/* Cursor images can change without a surface commit, but they're
+		 * small enough to be rendered every frame */
+		quad = render_thread_get_quad(rt, WXRC_QUAD_CURSOR_ID);
+		if (quad != NULL && render_thread_update_quad(rt, quad,
+				scene->cursor_pose_matrix, &scene->cursor, 1, 0)) {
+			render_thread_add_layer(rt, nlayers,
+				(XrCompositionLayerBaseHeader *)&quad->layer);
+		}
+	}
+
+destroy_unused:
+	wl_list_for_each_safe(quad, tmp, &rt->quads, link) {
+		if (!quad->used) {
+			quad_layer_destroy(rt, quad);
+		}
+	}
+}
+
+static void render_thread_release_quads(struct wxrc_render_thread *rt) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	struct wxrc_quad_layer *quad;
+	wl_list_for_each(quad, &rt->quads, link) {
+		if (!quad->acquired) {
+			continue;
+		}
+		XrResult r =
+			wxrc_xr_backend_release_swapchain_image(backend, quad->swapchain);
+		if (XR_FAILED(r)) {
+			wxrc_log_xr_result("xrReleaseSwapchainImage", r);
+		}
+		quad->acquired = false;
+		quad->rendered = true;
+	}
+}
+
+static bool render_thread_locate_views(struct wxrc_render_thread *rt,
+		XrTime predicted_display_time) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	for (uint32_t i = 0; i < backend->nviews; i++) {
+		rt->xr_views[i].type = XR_TYPE_VIEW;
+		rt->xr_views[i].next = NULL;
+	}
+
+	XrResult r = wxrc_xr_backend_locate_views(backend, predicted_display_time,
+		rt->xr_views);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrLocateViews", r);
+		return false;
+	}
+	return true;
+}
+
+static void report_resolution(struct wxrc_render_thread *rt, int64_t gpu_ns,
+		XrDuration display_period) {
+	if (wxrc_resolution_governor_report(&rt->resolution, gpu_ns,
+			display_period)) {
+		wlr_log(WLR_DEBUG, "Rendering views at %.0f%% resolution",
+			rt->resolution.scale * 100.0);
+	}
+}
+
+/**
+ * Renders and submits a frame. Sets wait_ns to the time spent waiting for the
+ * runtime and the GPU.
+ */
+static bool wxrc_xr_push_frame(struct wxrc_render_thread *rt,
+		XrTime predicted_display_time, XrDuration predicted_display_period,
+		int64_t *wait_ns) {
+	struct wxrc_server *server = rt->server;
+	struct wxrc_xr_backend *backend = server->xr_backend;
+	XrCompositionLayerProjection projection_layer;
+
+	int64_t gpu_pass_ns[WXRC_GPU_PASS_COUNT];
+	bool gpu_timed =
+		wxrc_gpu_timer_begin_frame(&rt->gl.gpu_timer, gpu_pass_ns);
+	if (gpu_timed) {
+		wxrc_frame_timing_set_gpu_passes(&server->timings, gpu_pass_ns);
+	}
+
+	/* Results come back a few frames late: leave out the ones rendered
+	 * at another scale, the governor has already reacted to them */
+	float *timed_scale = &rt->timed_scales[rt->gl.gpu_timer.current];
+	if (gpu_timed && *timed_scale == rt->resolution.scale) {
+		report_resolution(rt, gpu_pass_ns[WXRC_GPU_PASS_GRID] +
+			gpu_pass_ns[WXRC_GPU_PASS_VIEWS] +
+			gpu_pass_ns[WXRC_GPU_PASS_CURSOR] +
+			gpu_pass_ns[WXRC_GPU_PASS_FOVEATION],
+			predicted_display_period);
+	}
+	*timed_scale = 0;
+
+	render_thread_latch_scene(rt);
+	wxrc_gl_update_surface_textures(&rt->gl, rt->scene);
+	wxrc_frame_timing_count(&server->timings, rt->gl.counters);
+	wxrc_frame_timing_set_foveation(&server->timings,
+		rt->gl.foveation.inset_size, rt->gl.foveation.periphery_scale);
+
+	if (!rt->late_latch &&
+			!render_thread_locate_views(rt, predicted_display_time)) {
+		return false;
+	}
+
+	XrResult r = wxrc_xr_backend_begin_frame(backend);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrBeginFrame", r);
+		return false;
+	}
+
+	int64_t acquire_begin_ns = wxrc_get_time_ns();
+	uint32_t nswapchains = wxrc_xr_backend_get_nswapchains(backend);
+	uint32_t acquired = 0;
+	for (uint32_t i = 0; i < nswapchains; i++) {
+		if (XR_FAILED(wxrc_xr_backend_acquire_image(backend, i,
+				&rt->buffer_indices[i]))) {
+			break;
+		}
+		acquired++;
+	}
+	*wait_ns = wxrc_get_time_ns() - acquire_begin_ns;
+
+	/* Waiting for swapchain images may block, so the pose predicted for
+	 * this display time has likely been refined in the meantime. Use the
+	 * freshest one for both rendering and the projection layer. */
+	bool located = !rt->late_latch ||
+		render_thread_locate_views(rt, predicted_display_time);
+
+	/* Record both eyes back-to-back and only synchronize with the GPU once,
+	 * before handing the images over to the runtime */
+	int64_t gpu_begin_ns = wxrc_get_time_ns();
+	if (located && backend->multiview && acquired == nswapchains) {
+		wxrc_xr_multiview_render(rt, rt->buffer_indices[0]);
+	} else if (located && !backend->multiview) {
+		for (uint32_t i = 0; i < acquired; i++) {
+			wxrc_xr_view_render(rt, i, rt->buffer_indices[i]);
+		}
+	}
+	bool views_rendered = located && acquired == nswapchains;
+	if (views_rendered) {
+		*timed_scale = rt->resolution.scale;
+	}
+
+	/* Neither depends on the resolution */
+	int64_t extra_begin_ns = wxrc_get_time_ns();
+	bool mirror_copied = located && !backend->multiview && acquired > 0 &&
+		render_thread_copy_mirror(rt);
+
+	size_t nlayers = 0;
+	if (views_rendered) {
+		projection_layer = (XrCompositionLayerProjection){
+			.type = XR_TYPE_COMPOSITION_LAYER_PROJECTION,
+			.next = NULL,
+			.layerFlags = 0,
+			.space = backend->local_space,
+			.viewCount = backend->nviews,
+			.views = rt->projection_views,
+		};
+		render_thread_add_layer(rt, &nlayers,
+			(XrCompositionLayerBaseHeader *)&projection_layer);
+	}
+	if (rt->quad_layers) {
+		render_thread_update_quads(rt, &nlayers);
+	}
+	int64_t extra_ns = wxrc_get_time_ns() - extra_begin_ns;
+
+	EGLSyncKHR fence = wxrc_xr_backend_create_fence(backend);
+
+	/* Client buffers have been latched, let the Wayland thread send frame
+	 * callbacks while the GPU is busy */
+	render_thread_notify_frame(rt, true, predicted_display_time);
+
+	int64_t fence_begin_ns = wxrc_get_time_ns();
+	wxrc_frame_timing_phase_begin(&server->timings, WXRC_FRAME_PHASE_GPU_WAIT);
+	wxrc_xr_backend_wait_fence(backend, fence);
+	wxrc_frame_timing_phase_end(&server->timings, WXRC_FRAME_PHASE_GPU_WAIT);
+	*wait_ns += wxrc_get_time_ns() - fence_begin_ns;
+
+	if (mirror_copied) {
+		wxrc_mirror_publish(&rt->mirror);
+	}
+
+	/* Without GPU timers, fall back to the time until the fence signaled.
+	 * It still includes recording the views and the GPU time of the mirror
+	 * copy and quad layers, so this errs on the safe side. */
+	if (!rt->gl.gpu_timer.enabled && views_rendered) {
+		report_resolution(rt, wxrc_get_time_ns() - gpu_begin_ns - extra_ns,
+			predicted_display_period);
+	}
+
+	for (uint32_t i = 0; i < acquired; i++) {
+		r = wxrc_xr_backend_release_image(backend, i);
+		if (XR_FAILED(r)) {
+			wxrc_log_xr_result("xrReleaseSwapchainImage", r);
+		}
+	}
+	render_thread_release_quads(rt);
+
+	XrFrameEndInfo frame_end_info = {
+		.type = XR_TYPE_FRAME_END_INFO,
+		.displayTime = predicted_display_time,
+		.layerCount = nlayers,
+		.layers = rt->layers,
+		.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE,
+		.next = NULL,
+	};
+	int64_t end_begin_ns = wxrc_get_time_ns();
+	r = wxrc_xr_backend_end_frame(backend, &frame_end_info);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrEndFrame", r);
+		return false;
+	}
+	*wait_ns += wxrc_get_time_ns() - end_begin_ns;
+
+	/* Once the frame is out, so that the first one never waits for the
+	 * optional programs */
+	wxrc_gl_poll_programs(&rt->gl);
+
+	return true;
+}
+
+/**
+ * Submits a frame without any layers, to keep the runtime's frame loop going
+ * while nothing is displayed.
+ */
+static bool wxrc_xr_push_empty_frame(struct wxrc_render_thread *rt,
+		XrTime predicted_display_time) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	XrResult r = wxrc_xr_backend_begin_frame(backend);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrBeginFrame", r);
+		return false;
+	}
+
+	XrFrameEndInfo frame_end_info = {
+		.type = XR_TYPE_FRAME_END_INFO,
+		.displayTime = predicted_display_time,
+		.layerCount = 0,
+		.layers = NULL,
+		.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE,
+		.next = NULL,
+	};
+	r = wxrc_xr_backend_end_frame(backend, &frame_end_info);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrEndFrame", r);
+		return false;
+	}
+
+	render_thread_notify_frame(rt, false, predicted_display_time);
+	return true;
+}
+
+static bool wxrc_xr_session_visible(struct wxrc_xr_backend *backend) {
+	switch (backend->session_state) {
+	case XR_SESSION_STATE_VISIBLE:
+	case XR_SESSION_STATE_FOCUSED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool wxrc_xr_handle_session_state(struct wxrc_render_thread *rt,
+		XrSessionState state) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	wlr_log(WLR_DEBUG, "XR session state changed: %s -> %s",
+		wxrc_xr_session_state_str(backend->session_state),
+		wxrc_xr_session_state_str(state));
+	backend->session_state = state;
+
+	switch (state) {
+	case XR_SESSION_STATE_READY:
+		if (!backend->session_running) {
+			return wxrc_xr_backend_begin_session(backend);
+		}
+		break;
+	case XR_SESSION_STATE_STOPPING:
+		if (backend->session_running) {
+			return wxrc_xr_backend_end_session(backend);
+		}
+		break;
+	case XR_SESSION_STATE_LOSS_PENDING:
+	case XR_SESSION_STATE_EXITING:
+		atomic_store(&rt->running, false);
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+static bool wxrc_xr_handle_event(struct wxrc_render_thread *rt,
+		XrEventDataBuffer *event) {
+	switch (event->type) {
+	case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING:
+		atomic_store(&rt->running, false);
+		break;
+	case XR_TYPE_EVENT_DATA_EVENTS_LOST:;
+		XrEventDataEventsLost *events_lost = (XrEventDataEventsLost *)event;
+		wlr_log(WLR_ERROR, "Lost %d XR events",
+			(int)events_lost->lostEventCount);
+		break;
+	case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED:;
+		XrEventDataSessionStateChanged *state_change_event =
+			(XrEventDataSessionStateChanged *)event;
+		return wxrc_xr_handle_session_state(rt, state_change_event->state);
+	default:
+		break;
+	}
+	return true;
+}
+
+/**
+ * Drains the XR event queue. Returns false on error.
+ */
+static bool wxrc_xr_poll_events(struct wxrc_render_thread *rt) {
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	while (true) {
+		XrEventDataBuffer event = {
+			.type = XR_TYPE_EVENT_DATA_BUFFER,
+			.next = NULL,
+		};
+		XrResult r = wxrc_xr_backend_poll_event(backend, &event);
+		if (r == XR_EVENT_UNAVAILABLE) {
+			return true;
+		}
+		if (XR_FAILED(r)) {
+			wxrc_log_xr_result("xrPollEvent", r);
+			return false;
+		}
+		if (!wxrc_xr_handle_event(rt, &event)) {
+			return false;
+		}
+	}
+}
+
+/**
+ * Runs a single iteration of the frame loop. Returns false on error.
+ */
+static bool render_thread_frame(struct wxrc_render_thread *rt) {
+	struct wxrc_server *server = rt->server;
+	struct wxrc_xr_backend *backend = server->xr_backend;
+
+	wxrc_frame_timing_begin(&server->timings);
+
+	wxrc_frame_timing_phase_begin(&server->timings,
+		WXRC_FRAME_PHASE_POLL_EVENTS);
+	bool polled = wxrc_xr_poll_events(rt);
+	wxrc_frame_timing_phase_end(&server->timings,
+		WXRC_FRAME_PHASE_POLL_EVENTS);
+	if (!polled) {
+		return false;
+	}
+
+	if (!atomic_load(&rt->running)) {
+		return true;
+	}
+
+	if (!backend->session_running) {
+		/* We can't wait for frames, idle until the runtime wants us
+		 * back */
+		sleep_until(wxrc_get_time_ns() + WXRC_IDLE_INTERVAL_NS);
+		render_thread_notify_frame(rt, false, 0);
+		return true;
+	}
+
+	XrFrameState frame_state = {
+		.type = XR_TYPE_FRAME_STATE,
+		.next = NULL,
+	};
+	wxrc_frame_timing_phase_begin(&server->timings,
+		WXRC_FRAME_PHASE_WAIT_FRAME);
+	XrResult r = wxrc_xr_backend_wait_frame(backend, &frame_state);
+	wxrc_frame_timing_phase_end(&server->timings,
+		WXRC_FRAME_PHASE_WAIT_FRAME);
+	if (XR_FAILED(r)) {
+		wxrc_log_xr_result("xrWaitFrame", r);
+		return false;
+	}
+	int64_t frame_begin_ns = wxrc_get_time_ns();
+
+	struct timespec display_ts;
+	int64_t display_ns = 0;
+	if (wxrc_xr_backend_get_timespec(backend, frame_state.predictedDisplayTime,
+			&display_ts)) {
+		display_ns = (int64_t)display_ts.tv_sec * 1000000000 +
+			display_ts.tv_nsec;
+	}
+
+	/* Give clients as much time as possible to submit new buffers */
+	int64_t latch_deadline_ns = wxrc_frame_scheduler_get_latch_deadline(
+		&server->scheduler, frame_begin_ns, display_ns,
+		frame_state.predictedDisplayPeriod);
+	wxrc_frame_timing_phase_begin(&server->timings,
+		WXRC_FRAME_PHASE_LATCH_WAIT);
+	sleep_until(latch_deadline_ns);
+	wxrc_frame_timing_phase_end(&server->timings,
+		WXRC_FRAME_PHASE_LATCH_WAIT);
+
+	if (!frame_state.shouldRender || !wxrc_xr_session_visible(backend)) {
+		if (!wxrc_xr_push_empty_frame(rt, frame_state.predictedDisplayTime)) {
+			return false;
+		}
+		rt->nframes++;
+		wxrc_frame_timing_end(&server->timings,
+			frame_state.predictedDisplayTime,
+			frame_state.predictedDisplayPeriod);
+		return true;
+	}
+
+	int64_t render_begin_ns = wxrc_get_time_ns();
+
+	wxrc_frame_timing_phase_begin(&server->timings,
+		WXRC_FRAME_PHASE_PUSH_FRAME);
+	int64_t wait_ns = 0;
+	bool pushed = wxrc_xr_push_frame(rt, frame_state.predictedDisplayTime,
+		frame_state.predictedDisplayPeriod, &wait_ns);
+	wxrc_frame_timing_phase_end(&server->timings,
+		WXRC_FRAME_PHASE_PUSH_FRAME);
+	if (!pushed) {
+		return false;
+	}
+	rt->nframes++;
+
+	wxrc_frame_scheduler_report_render(&server->scheduler,
+		wxrc_get_time_ns() - render_begin_ns - wait_ns);
+
+	wxrc_frame_timing_end(&server->timings,
+		frame_state.predictedDisplayTime,
+		frame_state.predictedDisplayPeriod);
+	return true;
+}
+
+static void *render_thread_main(void *data) {
+	struct wxrc_render_thread *rt = data;
+	struct wxrc_xr_backend *backend = rt->server->xr_backend;
+
+	if (!wxrc_xr_backend_make_current(backend)) {
+		atomic_store(&rt->failed, true);
+		goto exit;
+	}
+
+	/* Programs aren't shared with the Wayland thread, which renders the
+	 * desktop mirror with its own */
+	if (!wxrc_gl_init(&rt->gl)) {
+		atomic_store(&rt->failed, true);
+		goto exit_current;
+	}
+	/* The swapchain has already been created with a layer per view. Views
+	 * are rendered to their layer one by one until the multiview programs
+	 * are built, or if they can't be. */
+	if (backend->multiview) {
+		wxrc_gl_init_multiview(&rt->gl);
+	}
+
+	rt->gl.quad_layers = rt->quad_layers;
+	rt->gl.hide_grid = rt->hide_grid;
+	rt->gl.foveation.inset_size = rt->foveation_inset_size;
+	rt->gl.foveation.periphery_scale = rt->foveation_periphery_scale;
+	if (rt->foveation_inset_size > 0) {
+		wlr_log(WLR_INFO, "Foveated rendering: %.0f%% inset, periphery at "
+			"%.0f%% resolution", rt->foveation_inset_size * 100.0,
+			rt->foveation_periphery_scale * 100.0);
+	}
+	/* The upscaled periphery has no depth */
+	rt->gl.write_depth =
+		backend->views[0].depth_swapchain != XR_NULL_HANDLE &&
+		rt->foveation_inset_size == 0;
+	if (rt->gl.write_depth) {
+		wlr_log(WLR_INFO, "Submitting depth for reprojection");
+	}
+	if (wxrc_gl_init_mipmaps(&rt->gl)) {
+		wlr_log(WLR_INFO, "Sampling surfaces from mipmapped copies");
+	}
+	if (wxrc_gl_init_atlas(&rt->gl)) {
+		wlr_log(WLR_INFO, "Batching small surfaces in a texture atlas");
+	}
+	/* Multiview images are array textures, and quad layers aren't in the
+	 * images at all */
+	if (rt->mirror_rate > 0 && (backend->multiview || rt->quad_layers)) {
+		wlr_log(WLR_INFO, "Can't mirror the swapchain with multiview or "
+			"quad layers, rendering the scene for the desktop mirror");
+	} else if (rt->mirror_rate > 0) {
+		struct wxrc_xr_view *view = &backend->views[0];
+		uint32_t width = view->config.recommendedImageRectWidth;
+		uint32_t height = view->config.recommendedImageRectHeight;
+		if (wxrc_mirror_init_copies(&rt->mirror,
+				(width + 1) / 2, (height + 1) / 2,
+				1000000000.0 / rt->mirror_rate)) {
+			wlr_log(WLR_INFO, "Mirroring the first view on the desktop "
+				"at up to %g Hz", rt->mirror_rate);
+		}
+	}
+
+	wlr_log(WLR_DEBUG, "Starting XR main loop");
+	while (atomic_load(&rt->running)) {
+		if (!render_thread_frame(rt)) {
+			atomic_store(&rt->failed, true);
+			break;
+		}
+	}
+
+	struct wxrc_quad_layer *quad, *tmp;
+	wl_list_for_each_safe(quad, tmp, &rt->quads, link) {
+		quad_layer_destroy(rt, quad);
+	}
+	wxrc_mirror_finish(&rt->mirror);
+	wxrc_gl_finish(&rt->gl);
+exit_current:
+	wxrc_xr_backend_unset_current(backend);
+exit:
+	atomic_store(&rt->running, false);
+	render_thread_wake(rt);
+	return NULL;
+}
+
+static void destroy_retired_scenes(struct wxrc_render_thread *rt) {
+	struct wxrc_scene *scene = atomic_exchange(&rt->retired_scenes, NULL);
+	while (scene != NULL) {
+		struct wxrc_scene *next = scene->next_retired;
+		wxrc_scene_destroy(rt->server, scene);
+		scene = next;
+	}
+}
+
+static int handle_render_thread_event(int fd, uint32_t mask, void *data) {
+	struct wxrc_render_thread *rt = data;
+	struct wxrc_server *server = rt->server;
+
+	uint64_t count;
+	if (read(rt->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		wlr_log_errno(WLR_ERROR, "read from eventfd failed");
+	}
+
+	destroy_retired_scenes(rt);
+
+	pthread_mutex_lock(&rt->frame_lock);
+	bool pending = rt->frame_pending;
+	struct wxrc_render_thread_frame_event event = rt->frame;
+	if (pending && event.visible) {
+		memcpy(server->xr_views, rt->frame_views,
+			server->xr_backend->nviews * sizeof(XrView));
+	}
+	rt->frame_pending = false;
+	pthread_mutex_unlock(&rt->frame_lock);
+
+	if (pending) {
+		wl_signal_emit(&rt->events.frame, &event);
+	}
+	return 0;
+}
+
+bool wxrc_render_thread_start(struct wxrc_render_thread *rt,
+		struct wxrc_server *server) {
+	uint32_t nviews = server->xr_backend->nviews;
+
+	rt->server = server;
+	wl_signal_init(&rt->events.frame);
+	atomic_init(&rt->running, true);
+	atomic_init(&rt->failed, false);
+	atomic_init(&rt->pending_scene, NULL);
+	atomic_init(&rt->retired_scenes, NULL);
+	wl_list_init(&rt->quads);
+	wxrc_resolution_governor_init(&rt->resolution);
+	wxrc_mirror_init(&rt->mirror);
+
+	rt->xr_views = calloc(nviews, sizeof(XrView));
+	rt->frame_views = calloc(nviews, sizeof(XrView));
+	rt->projection_views =
+		calloc(nviews, sizeof(XrCompositionLayerProjectionView));
+	rt->depth_infos = calloc(nviews, sizeof(XrCompositionLayerDepthInfoKHR));
+	rt->buffer_indices = calloc(nviews, sizeof(uint32_t));
+	if (rt->xr_views == NULL || rt->frame_views == NULL ||
+			rt->projection_views == NULL || rt->depth_infos == NULL ||
+			rt->buffer_indices == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		goto error_alloc;
+	}
+
+	rt->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (rt->event_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "eventfd failed");
+		goto error_alloc;
+	}
+
+	struct wl_event_loop *wl_event_loop =
+		wl_display_get_event_loop(server->wl_display);
+	rt->event_source = wl_event_loop_add_fd(wl_event_loop, rt->event_fd,
+		WL_EVENT_READABLE, handle_render_thread_event, rt);
+	if (rt->event_source == NULL) {
+		wlr_log(WLR_ERROR, "wl_event_loop_add_fd failed");
+		goto error_fd;
+	}
+
+	pthread_mutex_init(&rt->frame_lock, NULL);
+
+	/* The render thread makes the render context current, make sure
+	 * nothing we've submitted so far is pending on ours */
+	glFlush();
+
+	int ret = pthread_create(&rt->thread, NULL, render_thread_main, rt);
+	if (ret != 0) {
+		wlr_log(WLR_ERROR, "pthread_create failed: %s", strerror(ret));
+		goto error_mutex;
+	}
+
+	return true;
+
+error_mutex:
+	pthread_mutex_destroy(&rt->frame_lock);
+	wl_event_source_remove(rt->event_source);
+error_fd:
+	close(rt->event_fd);
+error_alloc:
+	free(rt->xr_views);
+	free(rt->frame_views);
+	free(rt->projection_views);
+	free(rt->depth_infos);
+	free(rt->buffer_indices);
+	return false;
+}
+
+void wxrc_render_thread_stop(struct wxrc_render_thread *rt) {
+	atomic_store(&rt->running, false);
+	pthread_join(rt->thread, NULL);
+
+	destroy_retired_scenes(rt);
+	wxrc_scene_destroy(rt->server, rt->scene);
+	rt->scene = NULL;
+	wxrc_scene_destroy(rt->server,
+		atomic_exchange(&rt->pending_scene, NULL));
+
+	wl_event_source_remove(rt->event_source);
+	close(rt->event_fd);
+	pthread_mutex_destroy(&rt->frame_lock);
+	free(rt->xr_views);
+	free(rt->frame_views);
+	free(rt->projection_views);
+	free(rt->depth_infos);
+	free(rt->buffer_indices);
+	free(rt->layers);
+}
+
+bool wxrc_render_thread_is_running(struct wxrc_render_thread *rt) {
+	return atomic_load(&rt->running);
+}
+
+void wxrc_render_thread_publish_scene(struct wxrc_render_thread *rt,
+		struct wxrc_scene *scene) {
+	/* Replace the previous scene if the render thread hasn't picked it up
+	 * yet, it's never going to be rendered */
+	struct wxrc_scene *prev = atomic_exchange(&rt->pending_scene, scene);
+	wxrc_scene_destroy(rt->server, prev);
+}
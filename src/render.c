@@ -3,14 +3,18 @@
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <GLES3/gl3.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/util/log.h>
 #include <wlr/render/gles2.h>
 #include "mathutil.h"
 #include "render.h"
-#include "server.h"
 #include "backend.h"
-#include "view.h"
+#include "scene.h"
 #include "xrutil.h"
 
 static const GLchar grid_vertex_shader_src[] =
@@ -18,31 +22,37 @@ static const GLchar grid_vertex_shader_src[] =
 	"\n"
 	"attribute vec3 pos;\n"
 	"uniform mat4 mvp;\n"
+	"uniform float ncells;\n"
 	"\n"
 	"varying vec3 vertex_pos;\n"
+	"varying vec2 vertex_tex_coord;\n"
 	"\n"
 	"void main() {\n"
 	"	vertex_pos = pos;\n"
+	"	vertex_tex_coord = pos.xy * ncells;\n"
 	"	gl_Position = mvp * vec4(pos, 1.0);\n"
 	"}\n";
 
+/* Lines are sampled from a mipmapped texture rather than tested per pixel, so
+ * that they're anti-aliased and no fragment is discarded */
 static const GLchar grid_fragment_shader_src[] =
 	"#version 100\n"
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
 	"precision mediump float;\n"
+	"#endif\n"
 	"\n"
+	"uniform sampler2D tex;\n"
 	"uniform vec4 fg_color;\n"
 	"\n"
 	"varying vec3 vertex_pos;\n"
+	"varying vec2 vertex_tex_coord;\n"
 	"\n"
 	"void main() {\n"
-	"	if (fract(vertex_pos.x * 100.0) < 0.01 ||\n"
-	"			fract(vertex_pos.y * 100.0) < 0.01) {\n"
-	"		float a = distance(vertex_pos, vec3(0)) * 7.0;\n"
-	"		a = min(a, 1.0);\n"
-	"		gl_FragColor = mix(fg_color, vec4(0), a);\n"
-	"	} else {\n"
-	"		discard;\n"
-	"	}\n"
+	"	float coverage = texture2D(tex, vertex_tex_coord).r;\n"
+	"	float a = min(length(vertex_pos.xy) * 2.0, 1.0);\n"
+	"	gl_FragColor = fg_color * (coverage * (1.0 - a));\n"
 	"}\n";
 
 static const GLchar texture_vertex_shader_src[] =
@@ -51,15 +61,17 @@ static const GLchar texture_vertex_shader_src[] =
 	"attribute vec2 tex_coord;\n"
 	"uniform mat4 mvp;\n"
 	"uniform bool invert_y;\n"
+	"uniform vec4 tex_rect;\n"
 	"\n"
 	"varying vec2 vertex_tex_coord;\n"
 	"\n"
 	"void main() {\n"
-	"	vertex_tex_coord = tex_coord;\n"
+	"	vec2 pos = tex_rect.xy + tex_coord * tex_rect.zw;\n"
+	"	vertex_tex_coord = pos;\n"
 	"	if (invert_y) {\n"
 	"		vertex_tex_coord.y = 1.0 - vertex_tex_coord.y;\n"
 	"	}\n"
-	"	gl_Position = mvp * vec4(tex_coord, 0.0, 1.0);\n"
+	"	gl_Position = mvp * vec4(pos, 0.0, 1.0);\n"
 	"}\n";
 
 static const GLchar texture_rgb_fragment_shader_src[] =
@@ -91,356 +103,2114 @@ static const GLchar texture_external_fragment_shader_src[] =
 	"	gl_FragColor = texture2D(tex, vertex_tex_coord);\n"
 	"}\n";
 
+static const GLchar atlas_vertex_shader_src[] =
+	"#version 100\n"
+	"\n"
+	"attribute vec2 tex_coord;\n"
+	"attribute mat4 model;\n"
+	"attribute vec4 uv_rect;\n"
+	"uniform mat4 vp;\n"
+	"uniform float half_texel;\n"
+	"\n"
+	"varying vec2 vertex_tex_coord;\n"
+	"varying vec4 vertex_uv_bounds;\n"
+	"\n"
+	"void main() {\n"
+	"	vertex_tex_coord = uv_rect.xy + tex_coord * uv_rect.zw;\n"
+	"	vertex_uv_bounds = vec4(uv_rect.xy + half_texel,\n"
+	"		uv_rect.xy + uv_rect.zw - half_texel);\n"
+	"	gl_Position = vp * model * vec4(tex_coord, 0.0, 1.0);\n"
+	"}\n";
+
+/* Texture coordinates are clamped to the slot, so that linear filtering
+ * doesn't bleed neighbouring slots in */
+static const GLchar atlas_fragment_shader_src[] =
+	"#version 100\n"
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"\n"
+	"uniform sampler2D tex;\n"
+	"\n"
+	"varying vec2 vertex_tex_coord;\n"
+	"varying vec4 vertex_uv_bounds;\n"
+	"\n"
+	"void main() {\n"
+	"	gl_FragColor = texture2D(tex, clamp(vertex_tex_coord,\n"
+	"		vertex_uv_bounds.xy, vertex_uv_bounds.zw));\n"
+	"}\n";
+
+/* Multiview variants: each draw covers all views, mvp is indexed by view */
+
+static const GLchar multiview_grid_vertex_shader_src[] =
+	"#version 300 es\n"
+	"#extension GL_OVR_multiview2 : require\n"
+	"layout(num_views = 2) in;\n"
+	"\n"
+	"in vec3 pos;\n"
+	"uniform mat4 mvp[2];\n"
+	"uniform float ncells;\n"
+	"\n"
+	"out vec3 vertex_pos;\n"
+	"out vec2 vertex_tex_coord;\n"
+	"\n"
+	"void main() {\n"
+	"	vertex_pos = pos;\n"
+	"	vertex_tex_coord = pos.xy * ncells;\n"
+	"	gl_Position = mvp[gl_ViewID_OVR] * vec4(pos, 1.0);\n"
+	"}\n";
+
+static const GLchar multiview_grid_fragment_shader_src[] =
+	"#version 300 es\n"
+	"precision highp float;\n"
+	"\n"
+	"uniform sampler2D tex;\n"
+	"uniform vec4 fg_color;\n"
+	"\n"
+	"in vec3 vertex_pos;\n"
+	"in vec2 vertex_tex_coord;\n"
+	"out vec4 frag_color;\n"
+	"\n"
+	"void main() {\n"
+	"	float coverage = texture(tex, vertex_tex_coord).r;\n"
+	"	float a = min(length(vertex_pos.xy) * 2.0, 1.0);\n"
+	"	frag_color = fg_color * (coverage * (1.0 - a));\n"
+	"}\n";
+
+static const GLchar multiview_texture_vertex_shader_src[] =
+	"#version 300 es\n"
+	"#extension GL_OVR_multiview2 : require\n"
+	"layout(num_views = 2) in;\n"
+	"\n"
+	"in vec2 tex_coord;\n"
+	"uniform mat4 mvp[2];\n"
+	"uniform bool invert_y;\n"
+	"uniform vec4 tex_rect;\n"
+	"\n"
+	"out vec2 vertex_tex_coord;\n"
+	"\n"
+	"void main() {\n"
+	"	vec2 pos = tex_rect.xy + tex_coord * tex_rect.zw;\n"
+	"	vertex_tex_coord = pos;\n"
+	"	if (invert_y) {\n"
+	"		vertex_tex_coord.y = 1.0 - vertex_tex_coord.y;\n"
+	"	}\n"
+	"	gl_Position = mvp[gl_ViewID_OVR] * vec4(pos, 0.0, 1.0);\n"
+	"}\n";
+
+static const GLchar multiview_texture_rgb_fragment_shader_src[] =
+	"#version 300 es\n"
+	"precision mediump float;\n"
+	"\n"
+	"uniform sampler2D tex;\n"
+	"uniform bool has_alpha;\n"
+	"\n"
+	"in vec2 vertex_tex_coord;\n"
+	"out vec4 frag_color;\n"
+	"\n"
+	"void main() {\n"
+	"	frag_color = texture(tex, vertex_tex_coord);\n"
+	"	if (!has_alpha) {\n"
+	"		frag_color.a = 1.0;\n"
+	"	}\n"
+	"}\n";
+
+static const GLchar multiview_texture_external_fragment_shader_src[] =
+	"#version 300 es\n"
+	"#extension GL_OES_EGL_image_external_essl3 : require\n"
+	"precision mediump float;\n"
+	"\n"
+	"uniform samplerExternalOES tex;\n"
+	"\n"
+	"in vec2 vertex_tex_coord;\n"
+	"out vec4 frag_color;\n"
+	"\n"
+	"void main() {\n"
+	"	frag_color = texture(tex, vertex_tex_coord);\n"
+	"}\n";
+
+static const GLchar multiview_atlas_vertex_shader_src[] =
+	"#version 300 es\n"
+	"#extension GL_OVR_multiview2 : require\n"
+	"layout(num_views = 2) in;\n"
+	"\n"
+	"in vec2 tex_coord;\n"
+	"in mat4 model;\n"
+	"in vec4 uv_rect;\n"
+	"uniform mat4 vp[2];\n"
+	"uniform float half_texel;\n"
+	"\n"
+	"out vec2 vertex_tex_coord;\n"
+	"out vec4 vertex_uv_bounds;\n"
+	"\n"
+	"void main() {\n"
+	"	vertex_tex_coord = uv_rect.xy + tex_coord * uv_rect.zw;\n"
+	"	vertex_uv_bounds = vec4(uv_rect.xy + half_texel,\n"
+	"		uv_rect.xy + uv_rect.zw - half_texel);\n"
+	"	gl_Position = vp[gl_ViewID_OVR] * model * vec4(tex_coord, 0.0, 1.0);\n"
+	"}\n";
+
+static const GLchar multiview_atlas_fragment_shader_src[] =
+	"#version 300 es\n"
+	"precision highp float;\n"
+	"\n"
+	"uniform sampler2D tex;\n"
+	"\n"
+	"in vec2 vertex_tex_coord;\n"
+	"in vec4 vertex_uv_bounds;\n"
+	"out vec4 frag_color;\n"
+	"\n"
+	"void main() {\n"
+	"	frag_color = texture(tex, clamp(vertex_tex_coord,\n"
+	"		vertex_uv_bounds.xy, vertex_uv_bounds.zw));\n"
+	"}\n";
+
+static int get_gles_major_version(void) {
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major = 0;
+	if (version != NULL) {
+		sscanf(version, "OpenGL ES %d", &major);
+	}
+	return major;
+}
+
+bool wxrc_has_extension(const char *exts, const char *name) {
+	if (exts == NULL) {
+		return false;
+	}
+	size_t len = strlen(name);
+	const char *ext = exts;
+	while ((ext = strstr(ext, name)) != NULL) {
+		/* Not a prefix or suffix of another name */
+		if ((ext == exts || ext[-1] == ' ') &&
+				(ext[len] == ' ' || ext[len] == '\0')) {
+			return true;
+		}
+		ext += len;
+	}
+	return false;
+}
+
+bool wxrc_gl_has_extension(const char *name) {
+	return wxrc_has_extension((const char *)glGetString(GL_EXTENSIONS), name);
+}
+
+/**
+ * Submits a shader for compilation. Its status is only checked after all
+ * programs have been submitted, so that drivers compiling in the background
+ * (GL_KHR_parallel_shader_compile) can build them all at once.
+ */
 static GLuint wxrc_gl_compile_shader(GLuint type, const GLchar *src) {
 	GLuint shader = glCreateShader(type);
 	glShaderSource(shader, 1, &src, NULL);
 	glCompileShader(shader);
+	return shader;
+}
 
+static bool check_shader(GLuint shader, const char *name, const char *stage) {
 	GLint ok;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
 	if (!ok) {
 		char log[512];
 		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
-		wlr_log(WLR_ERROR, "Failed to compile shader: %s", log);
-		return 0;
+		wlr_log(WLR_ERROR, "Failed to compile %s %s shader: %s",
+			name, stage, log);
+		return false;
 	}
-
-	return shader;
+	return true;
 }
 
 struct wxrc_shader_build_job {
 	const char *name;
 	const GLchar *vertex_src;
 	const GLchar *fragment_src;
+	/* Name of the per-vertex attribute, bound to WXRC_VERTEX_ATTRIB */
+	const char *vertex_attrib;
+	/* Takes the per-instance model and uv_rect attributes */
+	bool instanced;
 	GLuint *program_ptr;
-};
-
-bool wxrc_gl_init(struct wxrc_gl *gl) {
-	struct wxrc_shader_build_job jobs[] = {
-		{
-			.name = "grid",
-			.vertex_src = grid_vertex_shader_src,
-			.fragment_src = grid_fragment_shader_src,
-			.program_ptr = &gl->grid_program,
-		},
-		{
-			.name = "texture_rgb",
-			.vertex_src = texture_vertex_shader_src,
-			.fragment_src = texture_rgb_fragment_shader_src,
-			.program_ptr = &gl->texture_rgb_program,
-		},
-		{
-			.name = "texture_external",
-			.vertex_src = texture_vertex_shader_src,
-			.fragment_src = texture_external_fragment_shader_src,
-			.program_ptr = &gl->texture_external_program,
-		},
-	};
-
-	for (size_t i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
-		struct wxrc_shader_build_job *job = &jobs[i];
-
-		GLuint vertex_shader =
-			wxrc_gl_compile_shader(GL_VERTEX_SHADER, job->vertex_src);
-		if (vertex_shader == 0) {
-			wlr_log(WLR_ERROR, "Failed to compile %s vertex shader",
-				job->name);
-			return false;
-		}
-		GLuint fragment_shader =
-			wxrc_gl_compile_shader(GL_FRAGMENT_SHADER, job->fragment_src);
-		if (fragment_shader == 0) {
-			wlr_log(WLR_ERROR, "Failed to compile %s fragment shader",
-				job->name);
-			return false;
-		}
 
-		GLuint shader_program = glCreateProgram();
-		glAttachShader(shader_program, vertex_shader);
-		glAttachShader(shader_program, fragment_shader);
-		glLinkProgram(shader_program);
-		GLint ok;
-		glGetProgramiv(shader_program, GL_LINK_STATUS, &ok);
-		if (!ok) {
-			char log[512];
-			glGetProgramInfoLog(shader_program, sizeof(log), NULL, log);
-			wlr_log(WLR_ERROR, "Failed to link %s shader program: %s",
-				job->name, log);
-			return false;
-		}
+	/* Filled in by build_programs */
+	uint64_t cache_key;
+	GLuint vertex_shader, fragment_shader;
+};
 
-		glDeleteShader(vertex_shader);
-		glDeleteShader(fragment_shader);
+struct wxrc_program_sources {
+	const GLchar *grid_vertex, *grid_fragment;
+	const GLchar *texture_vertex;
+	const GLchar *texture_rgb_fragment, *texture_external_fragment;
+	const GLchar *atlas_vertex, *atlas_fragment;
+};
 
-		*job->program_ptr = shader_program;
-	}
+static const struct wxrc_program_sources program_sources = {
+	.grid_vertex = grid_vertex_shader_src,
+	.grid_fragment = grid_fragment_shader_src,
+	.texture_vertex = texture_vertex_shader_src,
+	.texture_rgb_fragment = texture_rgb_fragment_shader_src,
+	.texture_external_fragment = texture_external_fragment_shader_src,
+	.atlas_vertex = atlas_vertex_shader_src,
+	.atlas_fragment = atlas_fragment_shader_src,
+};
 
-	return true;
-}
+static const struct wxrc_program_sources multiview_program_sources = {
+	.grid_vertex = multiview_grid_vertex_shader_src,
+	.grid_fragment = multiview_grid_fragment_shader_src,
+	.texture_vertex = multiview_texture_vertex_shader_src,
+	.texture_rgb_fragment = multiview_texture_rgb_fragment_shader_src,
+	.texture_external_fragment =
+		multiview_texture_external_fragment_shader_src,
+	.atlas_vertex = multiview_atlas_vertex_shader_src,
+	.atlas_fragment = multiview_atlas_fragment_shader_src,
+};
 
-void wxrc_gl_finish(struct wxrc_gl *gl) {
-	glDeleteProgram(gl->grid_program);
-	glDeleteProgram(gl->texture_rgb_program);
-	glDeleteProgram(gl->texture_external_program);
-}
+/* All programs take their vertices from the same attribute location, so that
+ * it can stay enabled for the whole render pass */
+#define WXRC_VERTEX_ATTRIB 0
+/* Per-instance attributes of the atlas programs, the model matrix takes one
+ * location per column */
+#define WXRC_MODEL_ATTRIB 1
+#define WXRC_UV_RECT_ATTRIB 5
 
 static const float fg_color[] = { 1.0, 1.0, 1.0, 1.0 };
 static const float bg_color[] = { 0.08, 0.07, 0.16, 1.0 };
 
-static void render_grid(struct wxrc_gl *gl, mat4 vp_matrix) {
-	GLuint prog = gl->grid_program;
-
-	GLint pos_loc = glGetAttribLocation(prog, "pos");
-	GLint mvp_loc = glGetUniformLocation(prog, "mvp");
-	GLint fg_color_loc = glGetUniformLocation(prog, "fg_color");
-
-	glUseProgram(prog);
+/* The grid fades out at this distance from the origin, it's only drawn up
+ * to there. In meters. */
+#define GRID_RADIUS (50.0 / 7.0)
+/* Distance between grid lines, and their width, in meters */
+#define GRID_SPACING 0.5
+#define GRID_LINE_WIDTH 0.005
+/* Texels per grid cell, must be a power of two so that GLES 2 can repeat it */
+#define GRID_TEXTURE_SIZE 128
+
+static const float grid_points[] = {
+	-0.5, -0.5, 0.0,
+	-0.5, 0.5, 0.0,
+	0.5, -0.5, 0.0,
+	0.5, 0.5, 0.0,
+};
 
-	glUniform4fv(fg_color_loc, 1, (GLfloat *)fg_color);
+static const float quad_points[] = {
+	0.0, 0.0,
+	0.0, 1.0,
+	1.0, 0.0,
+	1.0, 1.0,
+};
 
-	mat4 model_matrix;
-	glm_mat4_identity(model_matrix);
-	glm_translate(model_matrix, (vec3){ 0.0, -1.0, 0.0 });
-	glm_scale(model_matrix, (vec3){ 50.0, 50.0, 50.0 });
-	glm_rotate(model_matrix, glm_rad(90.0), (vec3){ 1.0, 0.0, 0.0 });
+static GLuint create_vertex_buffer(const float *points, size_t size) {
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, size, points, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return vbo;
+}
 
-	mat4 mvp_matrix = GLM_MAT4_IDENTITY_INIT;
-	glm_mat4_mul(vp_matrix, model_matrix, mvp_matrix);
+static void init_texture_program(struct wxrc_gl_texture_program *prog) {
+	prog->mvp_loc = glGetUniformLocation(prog->program, "mvp");
+	prog->invert_y_loc = glGetUniformLocation(prog->program, "invert_y");
+	prog->has_alpha_loc = glGetUniformLocation(prog->program, "has_alpha");
+	prog->tex_rect_loc = glGetUniformLocation(prog->program, "tex_rect");
+	prog->invert_y = prog->has_alpha = -1;
+	prog->tex_rect[2] = -1;
 
-	glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, (GLfloat *)mvp_matrix);
+	glUseProgram(prog->program);
+	glUniform1i(glGetUniformLocation(prog->program, "tex"), 0);
+}
 
-	size_t npoints = 4;
-	const float points[] = {
-		-0.5, -0.5, 0.0,
-		-0.5, 0.5, 0.0,
-		0.5, -0.5, 0.0,
-		0.5, 0.5, 0.0,
+static void submit_program(struct wxrc_gl *gl,
+		struct wxrc_shader_build_job *job) {
+	const char *key_strings[] = {
+		job->vertex_src,
+		job->fragment_src,
+		job->vertex_attrib,
+		job->instanced ? "instanced" : "",
 	};
+	job->cache_key = wxrc_program_cache_key(&gl->program_cache, key_strings,
+		sizeof(key_strings) / sizeof(key_strings[0]));
+	*job->program_ptr =
+		wxrc_program_cache_load(&gl->program_cache, job->cache_key);
+	if (*job->program_ptr != 0) {
+		return;
+	}
 
-	GLint coords_per_point = sizeof(points) / sizeof(points[0]) / npoints;
-	glVertexAttribPointer(pos_loc, coords_per_point,
-		GL_FLOAT, GL_FALSE, 0, points);
-	glEnableVertexAttribArray(pos_loc);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, npoints);
-
-	glDisableVertexAttribArray(pos_loc);
-
-	glUseProgram(0);
+	job->vertex_shader =
+		wxrc_gl_compile_shader(GL_VERTEX_SHADER, job->vertex_src);
+	job->fragment_shader =
+		wxrc_gl_compile_shader(GL_FRAGMENT_SHADER, job->fragment_src);
+
+	GLuint shader_program = glCreateProgram();
+	glAttachShader(shader_program, job->vertex_shader);
+	glAttachShader(shader_program, job->fragment_shader);
+	glBindAttribLocation(shader_program, WXRC_VERTEX_ATTRIB,
+		job->vertex_attrib);
+	if (job->instanced) {
+		glBindAttribLocation(shader_program, WXRC_MODEL_ATTRIB, "model");
+		glBindAttribLocation(shader_program, WXRC_UV_RECT_ATTRIB, "uv_rect");
+	}
+	glLinkProgram(shader_program);
+	*job->program_ptr = shader_program;
 }
 
-static void render_texture(struct wxrc_gl *gl, struct wlr_texture *tex,
-		mat4 mvp_matrix) {
-	if (!wlr_texture_is_gles2(tex)) {
-		wlr_log(WLR_ERROR, "unsupported texture type");
-		return;
+static bool finish_program(struct wxrc_gl *gl,
+		struct wxrc_shader_build_job *job) {
+	if (job->vertex_shader == 0) {
+		/* Loaded from the cache */
+		return true;
 	}
 
-	struct wlr_gles2_texture_attribs attribs = {0};
-	wlr_gles2_texture_get_attribs(tex, &attribs);
-
-	GLuint prog;
-	switch (attribs.target) {
-	case GL_TEXTURE_2D:
-		prog = gl->texture_rgb_program;
-		break;
-	case GL_TEXTURE_EXTERNAL_OES:
-		prog = gl->texture_external_program;
-		break;
-	default:
-		wlr_log(WLR_ERROR, "unsupported texture target %d", attribs.target);
-		return;
+	bool ok = check_shader(job->vertex_shader, job->name, "vertex") &&
+		check_shader(job->fragment_shader, job->name, "fragment");
+	glDeleteShader(job->vertex_shader);
+	glDeleteShader(job->fragment_shader);
+	job->vertex_shader = job->fragment_shader = 0;
+	if (!ok) {
+		return false;
 	}
 
-	GLint tex_coord_loc = glGetAttribLocation(prog, "tex_coord");
-	GLint mvp_loc = glGetUniformLocation(prog, "mvp");
-	GLint tex_loc = glGetUniformLocation(prog, "tex");
-	GLint has_alpha_loc = glGetUniformLocation(prog, "has_alpha");
-	GLint invert_y_loc = glGetUniformLocation(prog, "invert_y");
+	GLint linked;
+	glGetProgramiv(*job->program_ptr, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		char log[512];
+		glGetProgramInfoLog(*job->program_ptr, sizeof(log), NULL, log);
+		wlr_log(WLR_ERROR, "Failed to link %s shader program: %s",
+			job->name, log);
+		return false;
+	}
 
-	glUseProgram(prog);
+	wxrc_program_cache_store(&gl->program_cache, job->cache_key,
+		*job->program_ptr);
+	return true;
+}
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(attribs.target, attribs.tex);
-	glTexParameteri(attribs.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(attribs.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glUniform1i(tex_loc, 0);
+static void submit_programs(struct wxrc_gl *gl,
+		struct wxrc_shader_build_job *jobs, size_t njobs) {
+	for (size_t i = 0; i < njobs; i++) {
+		submit_program(gl, &jobs[i]);
+	}
+}
 
-	glUniform1i(invert_y_loc, !attribs.inverted_y);
+/**
+ * Returns true if checking the status of the submitted programs won't block.
+ */
+static bool programs_completed(struct wxrc_gl *gl,
+		struct wxrc_shader_build_job *jobs, size_t njobs) {
+	if (!gl->parallel_compile) {
+		return true;
+	}
+	for (size_t i = 0; i < njobs; i++) {
+		if (jobs[i].vertex_shader == 0) {
+			/* Loaded from the cache */
+			continue;
+		}
+		GLint completed;
+		glGetProgramiv(*jobs[i].program_ptr, GL_COMPLETION_STATUS_KHR,
+			&completed);
+		if (!completed) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	if (has_alpha_loc >= 0) {
-		glUniform1i(has_alpha_loc, attribs.has_alpha);
+/**
+ * Waits for the submitted programs. If any of them failed to build, they're
+ * all deleted.
+ */
+static bool wait_programs(struct wxrc_gl *gl,
+		struct wxrc_shader_build_job *jobs, size_t njobs) {
+	bool ok = true;
+	for (size_t i = 0; i < njobs; i++) {
+		ok = finish_program(gl, &jobs[i]) && ok;
 	}
+	if (!ok) {
+		for (size_t i = 0; i < njobs; i++) {
+			glDeleteProgram(*jobs[i].program_ptr);
+			*jobs[i].program_ptr = 0;
+		}
+	}
+	return ok;
+}
 
-	glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, (GLfloat *)mvp_matrix);
+/**
+ * Loads programs from the cache, and builds the others. All compilations are
+ * submitted before waiting for any of them.
+ */
+static bool build_programs(struct wxrc_gl *gl,
+		struct wxrc_shader_build_job *jobs, size_t njobs) {
+	submit_programs(gl, jobs, njobs);
+	return wait_programs(gl, jobs, njobs);
+}
 
-	size_t npoints = 4;
-	const float points[] = {
-		0.0, 0.0,
-		0.0, 1.0,
-		1.0, 0.0,
-		1.0, 1.0,
+/* Number of programs of struct wxrc_gl_programs, without the atlas one */
+#define WXRC_GL_NPROGRAMS 3
+
+static void get_program_jobs(struct wxrc_gl_programs *programs,
+		const struct wxrc_program_sources *sources,
+		struct wxrc_shader_build_job jobs[static WXRC_GL_NPROGRAMS]) {
+	jobs[0] = (struct wxrc_shader_build_job){
+		.name = "grid",
+		.vertex_src = sources->grid_vertex,
+		.fragment_src = sources->grid_fragment,
+		.vertex_attrib = "pos",
+		.program_ptr = &programs->grid.program,
 	};
+	jobs[1] = (struct wxrc_shader_build_job){
+		.name = "texture_rgb",
+		.vertex_src = sources->texture_vertex,
+		.fragment_src = sources->texture_rgb_fragment,
+		.vertex_attrib = "tex_coord",
+		.program_ptr = &programs->texture_rgb.program,
+	};
+	jobs[2] = (struct wxrc_shader_build_job){
+		.name = "texture_external",
+		.vertex_src = sources->texture_vertex,
+		.fragment_src = sources->texture_external_fragment,
+		.vertex_attrib = "tex_coord",
+		.program_ptr = &programs->texture_external.program,
+	};
+}
 
-	GLint coords_per_point = sizeof(points) / sizeof(points[0]) / npoints;
-	glVertexAttribPointer(tex_coord_loc, coords_per_point,
-		GL_FLOAT, GL_FALSE, 0, points);
-	glEnableVertexAttribArray(tex_coord_loc);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, npoints);
+static void init_program_uniforms(struct wxrc_gl_programs *programs) {
+	/* Uniforms which never change are only set once */
+	programs->grid.mvp_loc = glGetUniformLocation(programs->grid.program, "mvp");
+	glUseProgram(programs->grid.program);
+	glUniform4fv(glGetUniformLocation(programs->grid.program, "fg_color"), 1,
+		(GLfloat *)fg_color);
+	glUniform1f(glGetUniformLocation(programs->grid.program, "ncells"),
+		2 * GRID_RADIUS / GRID_SPACING);
+	glUniform1i(glGetUniformLocation(programs->grid.program, "tex"), 0);
+
+	init_texture_program(&programs->texture_rgb);
+	init_texture_program(&programs->texture_external);
+	glUseProgram(0);
+}
 
-	glDisableVertexAttribArray(tex_coord_loc);
+static bool init_programs(struct wxrc_gl *gl,
+		struct wxrc_gl_programs *programs,
+		const struct wxrc_program_sources *sources) {
+	struct wxrc_shader_build_job jobs[WXRC_GL_NPROGRAMS];
+	get_program_jobs(programs, sources, jobs);
+	if (!build_programs(gl, jobs, WXRC_GL_NPROGRAMS)) {
+		return false;
+	}
+	init_program_uniforms(programs);
+	return true;
+}
 
-	glUseProgram(0);
+static void finish_programs(struct wxrc_gl_programs *programs) {
+	glDeleteProgram(programs->grid.program);
+	glDeleteProgram(programs->texture_rgb.program);
+	glDeleteProgram(programs->texture_external.program);
+	glDeleteProgram(programs->atlas.program);
+	memset(programs, 0, sizeof(*programs));
 }
 
-struct render_data {
-	struct wxrc_gl *gl;
-	struct wxrc_view *view;
-	mat4 vp_matrix;
+/**
+ * Optional programs, which aren't needed for the first frame. They're built in
+ * the background and switched to once ready, see wxrc_gl_poll_programs.
+ */
+struct wxrc_gl_program_build {
+	struct wxrc_shader_build_job jobs[WXRC_GL_NPROGRAMS];
+	size_t njobs;
+	/* Atlas programs only: enabled once they're ready */
+	struct wxrc_gl_atlas *atlas;
 };
 
-static void render_surface_iterator(struct wlr_surface *surface,
-		int sx, int sy, void *_data) {
-	struct render_data *data = _data;
+/**
+ * Returns how much of a texel spanning [x, x + 1) is covered by the line at
+ * the start of the cell, in texels.
+ */
+static float grid_line_coverage(int x) {
+	float width = GRID_LINE_WIDTH / GRID_SPACING * GRID_TEXTURE_SIZE;
+	return fminf(fmaxf(width - x, 0.0), 1.0);
+}
 
-	if (surface->buffer == NULL || surface->buffer->texture == NULL) {
-		return;
+/**
+ * Bakes one cell of the grid, with all its mipmap levels. The levels are
+ * box-filtered here, since not all GLES 2 implementations can generate
+ * mipmaps for luminance textures.
+ */
+static GLuint create_grid_texture(void) {
+	/* Each level is built from the previous one, in the other half */
+	uint8_t *levels[2];
+	levels[0] = malloc(2 * GRID_TEXTURE_SIZE * GRID_TEXTURE_SIZE);
+	if (levels[0] == NULL) {
+		wlr_log_errno(WLR_ERROR, "malloc failed");
+		return 0;
+	}
+	levels[1] = levels[0] + GRID_TEXTURE_SIZE * GRID_TEXTURE_SIZE;
+	uint8_t *level = levels[0];
+	for (int y = 0; y < GRID_TEXTURE_SIZE; y++) {
+		float cy = grid_line_coverage(y);
+		for (int x = 0; x < GRID_TEXTURE_SIZE; x++) {
+			float cx = grid_line_coverage(x);
+			float coverage = cx + cy - cx * cy;
+			level[y * GRID_TEXTURE_SIZE + x] = roundf(coverage * 255.0);
+		}
 	}
 
-	mat4 model_matrix;
-	wxrc_view_get_2d_model_matrix(data->view, surface, sx, sy, model_matrix);
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	int size = GRID_TEXTURE_SIZE;
+	for (GLint i = 0; ; i++) {
+		glTexImage2D(GL_TEXTURE_2D, i, GL_LUMINANCE, size, size, 0,
+			GL_LUMINANCE, GL_UNSIGNED_BYTE, level);
+		if (size == 1) {
+			break;
+		}
 
-	mat4 mvp_matrix;
-	glm_mat4_mul(data->vp_matrix, model_matrix, mvp_matrix);
+		uint8_t *next = levels[(i + 1) % 2];
+		int next_size = size / 2;
+		for (int y = 0; y < next_size; y++) {
+			for (int x = 0; x < next_size; x++) {
+				const uint8_t *src = &level[2 * y * size + 2 * x];
+				next[y * next_size + x] =
+					(src[0] + src[1] + src[size] + src[size + 1] + 2) / 4;
+			}
+		}
+		level = next;
+		size = next_size;
+	}
 
-	render_texture(data->gl, surface->buffer->texture, mvp_matrix);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	free(levels[0]);
+	return tex;
 }
 
-static void render_2d_view(struct wxrc_gl *gl,
-		mat4 vp_matrix, struct wxrc_view *view) {
-	struct render_data data = {
-		.gl = gl,
-		.view = view,
-	};
-	glm_mat4_copy(vp_matrix, data.vp_matrix);
+bool wxrc_gl_init(struct wxrc_gl *gl) {
+	wxrc_program_cache_init(&gl->program_cache);
+
+	if (wxrc_gl_has_extension("GL_KHR_parallel_shader_compile")) {
+		PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_shader_compiler_threads =
+			(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)eglGetProcAddress(
+			"glMaxShaderCompilerThreadsKHR");
+		if (max_shader_compiler_threads != NULL) {
+			/* As many threads as the driver sees fit */
+			max_shader_compiler_threads(0xFFFFFFFF);
+			gl->parallel_compile = true;
+		}
+	}
 
-	wxrc_view_for_each_surface(view, render_surface_iterator, &data);
-}
+	/* Only the programs needed for the first frame are waited for */
+	if (!init_programs(gl, &gl->programs, &program_sources)) {
+		wxrc_program_cache_finish(&gl->program_cache);
+		return false;
+	}
 
-static void render_xr_shell_view(struct wxrc_gl *gl, mat4 vp_matrix,
-		struct wxrc_xr_view *xr_view, struct wxrc_view *view) {
-	struct wlr_surface *surface = view->surface;
+	wxrc_gpu_timer_init(&gl->gpu_timer);
 
-	struct wlr_buffer *buffer = surface->buffer;
-	if (buffer == NULL) {
-		return;
-	}
+	gl->grid_vbo = create_vertex_buffer(grid_points, sizeof(grid_points));
+	gl->quad_vbo = create_vertex_buffer(quad_points, sizeof(quad_points));
+	gl->grid_texture = create_grid_texture();
 
-	/* TODO: Test for other kinds of buffers */
-	struct wxrc_zxr_composite_buffer_v1 *comp_buffer =
-		wxrc_zxr_composite_buffer_v1_from_buffer(buffer);
-	struct wlr_texture *tex = wxrc_zxr_composite_buffer_v1_for_view(
-		comp_buffer, xr_view->wl_view,
-		ZXR_COMPOSITE_BUFFER_V1_BUFFER_TYPE_PIXEL_BUFFER);
-	if (tex == NULL) {
-		/* TODO: Don't show on one view if we can't show on all views */
-		wlr_log(WLR_DEBUG, "Attempted to render XR surface without texture");
-		return;
-	}
+	return true;
+}
 
-	mat4 mvp_matrix = GLM_MAT4_IDENTITY_INIT;
-	glm_translate(mvp_matrix, (vec3){ -1.0, -1.0, 0.0 });
-	glm_scale(mvp_matrix, (vec3){ 2.0, 2.0, 1.0 });
-	render_texture(gl, tex, mvp_matrix);
+bool wxrc_gl_init_multiview(struct wxrc_gl *gl) {
+	struct wxrc_gl_program_build *build = calloc(1, sizeof(*build));
+	if (build == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return false;
+	}
+	get_program_jobs(&gl->multiview_programs, &multiview_program_sources,
+		build->jobs);
+	build->njobs = WXRC_GL_NPROGRAMS;
+	submit_programs(gl, build->jobs, build->njobs);
+	gl->multiview_build = build;
+	return true;
 }
 
-static void render_view(struct wxrc_gl *gl, mat4 vp_matrix,
-		struct wxrc_xr_view *xr_view, struct wxrc_view *view) {
-	if (wxrc_view_is_xr_shell(view)) {
-		render_xr_shell_view(gl, vp_matrix, xr_view, view);
-	} else {
-		render_2d_view(gl, vp_matrix, view);
+bool wxrc_gl_init_mipmaps(struct wxrc_gl *gl) {
+	/* GLES 2 can only generate mipmaps for power-of-two textures */
+	if (get_gles_major_version() < 3 &&
+			!wxrc_gl_has_extension("GL_OES_texture_npot")) {
+		wlr_log(WLR_INFO, "GL_OES_texture_npot not supported");
+		return false;
 	}
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl->max_texture_size);
+	gl->mipmaps = true;
+	return true;
 }
 
-static void render_cursor(struct wxrc_server *server,
-		struct wxrc_gl *gl, mat4 vp_matrix, mat4 cursor_matrix) {
-	int hotspot_x, hotspot_y, scale;
-	struct wlr_texture *tex = wxrc_cursor_get_texture(&server->cursor,
-		&hotspot_x, &hotspot_y, &scale);
-	if (tex == NULL) {
-		return;
+static bool load_instancing(struct wxrc_gl_atlas *atlas) {
+	/* Core GLES 3 functions are exported by libGLESv2, EGL 1.4 only has to
+	 * return extension functions from eglGetProcAddress */
+	if (get_gles_major_version() >= 3) {
+		atlas->glDrawArraysInstanced = glDrawArraysInstanced;
+		atlas->glVertexAttribDivisor = glVertexAttribDivisor;
+		return true;
 	}
 
-	int width, height;
-	wlr_texture_get_size(tex, &width, &height);
+	const char *suffix;
+	if (wxrc_gl_has_extension("GL_EXT_instanced_arrays")) {
+		suffix = "EXT";
+	} else if (wxrc_gl_has_extension("GL_ANGLE_instanced_arrays")) {
+		suffix = "ANGLE";
+	} else if (wxrc_gl_has_extension("GL_NV_instanced_arrays") &&
+			wxrc_gl_has_extension("GL_NV_draw_instanced")) {
+		suffix = "NV";
+	} else {
+		wlr_log(WLR_INFO, "Instanced arrays not supported");
+		return false;
+	}
 
-	float scale_x = (float)width / WXRC_SURFACE_SCALE / scale;
-	float scale_y = (float)height / WXRC_SURFACE_SCALE / scale;
+	char name[64];
+	snprintf(name, sizeof(name), "glDrawArraysInstanced%s", suffix);
+	atlas->glDrawArraysInstanced =
+		(PFNGLDRAWARRAYSINSTANCEDEXTPROC)eglGetProcAddress(name);
+	snprintf(name, sizeof(name), "glVertexAttribDivisor%s", suffix);
+	atlas->glVertexAttribDivisor =
+		(PFNGLVERTEXATTRIBDIVISOREXTPROC)eglGetProcAddress(name);
+	if (atlas->glDrawArraysInstanced == NULL ||
+			atlas->glVertexAttribDivisor == NULL) {
+		wlr_log(WLR_INFO, "Failed to load instancing entry points");
+		return false;
+	}
+	return true;
+}
 
-	mat4 model_matrix;
-	glm_mat4_copy(cursor_matrix, model_matrix);
-	glm_scale(model_matrix, (vec3){ scale_x, scale_y, 1.0 });
+static void get_atlas_program_job(struct wxrc_gl_atlas_program *prog,
+		const struct wxrc_program_sources *sources,
+		struct wxrc_shader_build_job *job) {
+	*job = (struct wxrc_shader_build_job){
+		.name = "atlas",
+		.vertex_src = sources->atlas_vertex,
+		.fragment_src = sources->atlas_fragment,
+		.vertex_attrib = "tex_coord",
+		.instanced = true,
+		.program_ptr = &prog->program,
+	};
+}
 
-	/* Re-origin the cursor to the center and apply hotspot */
-	glm_translate(model_matrix, (vec3){
-		-(float)hotspot_x / width,
-		-1.0 + (float)hotspot_y / height, 0 });
+static void init_atlas_program_uniforms(struct wxrc_gl_atlas_program *prog) {
+	prog->vp_loc = glGetUniformLocation(prog->program, "vp");
+	glUseProgram(prog->program);
+	glUniform1i(glGetUniformLocation(prog->program, "tex"), 0);
+	glUniform1f(glGetUniformLocation(prog->program, "half_texel"),
+		0.5 / WXRC_GL_ATLAS_SIZE);
+	glUseProgram(0);
+}
 
-	mat4 mvp_matrix = GLM_MAT4_IDENTITY_INIT;
-	glm_mat4_mul(vp_matrix, model_matrix, mvp_matrix);
+static void atlas_destroy(struct wxrc_gl_atlas *atlas) {
+	glDeleteBuffers(1, &atlas->instance_vbo);
+	glDeleteFramebuffers(1, &atlas->framebuffer);
+	glDeleteTextures(1, &atlas->texture);
+	free(atlas);
+}
 
-	render_texture(gl, tex, mvp_matrix);
+/**
+ * Frees a build, along with the shaders of programs still being built. The
+ * programs themselves are deleted with the others, by finish_programs.
+ */
+static void program_build_destroy(struct wxrc_gl_program_build *build) {
+	if (build == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < build->njobs; i++) {
+		glDeleteShader(build->jobs[i].vertex_shader);
+		glDeleteShader(build->jobs[i].fragment_shader);
+	}
+	if (build->atlas != NULL) {
+		atlas_destroy(build->atlas);
+	}
+	free(build);
 }
 
-void wxrc_gl_render_view(struct wxrc_server *server, struct wxrc_xr_view *view,
-		mat4 view_matrix, mat4 projection_matrix) {
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+bool wxrc_gl_init_atlas(struct wxrc_gl *gl) {
+	GLint max_texture_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+	if (max_texture_size < WXRC_GL_ATLAS_SIZE) {
+		wlr_log(WLR_INFO, "Maximum texture size too small for the atlas");
+		return false;
+	}
 
-	glClearColor(bg_color[0], bg_color[1], bg_color[2], bg_color[3]);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	struct wxrc_gl_atlas *atlas = calloc(1, sizeof(*atlas));
+	if (atlas == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return false;
+	}
+	if (!load_instancing(atlas)) {
+		free(atlas);
+		return false;
+	}
 
-	mat4 vp_matrix = GLM_MAT4_IDENTITY_INIT;
-	glm_mat4_mul(projection_matrix, view_matrix, vp_matrix);
+	struct wxrc_gl_program_build *build = calloc(1, sizeof(*build));
+	if (build == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		free(atlas);
+		return false;
+	}
+	get_atlas_program_job(&gl->programs.atlas, &program_sources,
+		&build->jobs[build->njobs++]);
+	if (gl->multiview_build != NULL || gl->multiview) {
+		get_atlas_program_job(&gl->multiview_programs.atlas,
+			&multiview_program_sources, &build->jobs[build->njobs++]);
+	}
+	submit_programs(gl, build->jobs, build->njobs);
+
+	glGenTextures(1, &atlas->texture);
+	glBindTexture(GL_TEXTURE_2D, atlas->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WXRC_GL_ATLAS_SIZE,
+		WXRC_GL_ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &atlas->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, atlas->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+		atlas->texture, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	render_grid(&server->gl, vp_matrix);
+	glGenBuffers(1, &atlas->instance_vbo);
+
+	build->atlas = atlas;
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		wlr_log(WLR_ERROR, "Atlas framebuffer incomplete: 0x%x", status);
+		program_build_destroy(build);
+		glDeleteProgram(gl->programs.atlas.program);
+		glDeleteProgram(gl->multiview_programs.atlas.program);
+		gl->programs.atlas.program = 0;
+		gl->multiview_programs.atlas.program = 0;
+		return false;
+	}
 
-	// Disable writing to the depth buffer, so that we never render views
-	// intersected but still correctly integrate them in the 3D scene
-	glDepthMask(GL_FALSE);
+	gl->atlas_build = build;
+	return true;
+}
 
-	struct wxrc_view *wxrc_view;
-	wl_list_for_each_reverse(wxrc_view, &server->views, link) {
-		if (!wxrc_view->mapped) {
-			continue;
+void wxrc_gl_poll_programs(struct wxrc_gl *gl) {
+	struct wxrc_gl_program_build *build = gl->multiview_build;
+	if (build != NULL && programs_completed(gl, build->jobs, build->njobs)) {
+		gl->multiview_build = NULL;
+		if (wait_programs(gl, build->jobs, build->njobs)) {
+			init_program_uniforms(&gl->multiview_programs);
+			gl->multiview = true;
+			wlr_log(WLR_DEBUG, "Switching to the multiview programs");
+		} else {
+			wlr_log(WLR_ERROR, "Failed to build the multiview programs, "
+				"rendering views one by one");
 		}
-		render_view(&server->gl, vp_matrix, view, wxrc_view);
+		program_build_destroy(build);
 	}
 
-	if (server->seat->pointer_state.focused_surface != NULL) {
-		render_cursor(server, &server->gl, vp_matrix, server->cursor.matrix);
+	build = gl->atlas_build;
+	if (build != NULL && programs_completed(gl, build->jobs, build->njobs)) {
+		gl->atlas_build = NULL;
+		if (wait_programs(gl, build->jobs, build->njobs)) {
+			init_atlas_program_uniforms(&gl->programs.atlas);
+			if (build->njobs > 1) {
+				init_atlas_program_uniforms(&gl->multiview_programs.atlas);
+			}
+			gl->atlas = build->atlas;
+			build->atlas = NULL;
+			wlr_log(WLR_DEBUG, "Switching to the texture atlas");
+		} else {
+			wlr_log(WLR_ERROR, "Failed to build the atlas programs");
+		}
+		program_build_destroy(build);
 	}
+}
 
-	glDepthMask(GL_TRUE);
+static int atlas_slot_size(int width, int height) {
+	int size = WXRC_GL_ATLAS_MIN_SLOT_SIZE;
+	while (size < width || size < height) {
+		size *= 2;
+	}
+	return size;
 }
 
-void wxrc_gl_render_xr_view(struct wxrc_server *server, struct wxrc_xr_view *view,
-		XrView *xr_view, GLuint framebuffer, GLuint image, GLuint depth_buffer) {
-	uint32_t width = view->config.recommendedImageRectWidth;
-	uint32_t height = view->config.recommendedImageRectHeight;
+/**
+ * Allocates a slot for a width x height surface. Returns false if the surface
+ * is too large, or if the atlas is full.
+ */
+static bool atlas_alloc(struct wxrc_gl_atlas *atlas, int width, int height,
+		int *x, int *y) {
+	if (width > WXRC_GL_ATLAS_PAGE_SIZE || height > WXRC_GL_ATLAS_PAGE_SIZE) {
+		return false;
+	}
+	int slot_size = atlas_slot_size(width, height);
+	int slots_per_row = WXRC_GL_ATLAS_PAGE_SIZE / slot_size;
+	int nslots = slots_per_row * slots_per_row;
+
+	struct wxrc_gl_atlas_page *page = NULL;
+	int page_index = -1, slot = -1;
+	for (int i = 0; i < WXRC_GL_ATLAS_NPAGES && slot < 0; i++) {
+		struct wxrc_gl_atlas_page *p = &atlas->pages[i];
+		if (p->slot_size == 0) {
+			if (page == NULL) {
+				page = p;
+				page_index = i;
+			}
+			continue;
+		}
+		if (p->slot_size != slot_size) {
+			continue;
+		}
+		for (int j = 0; j < nslots; j++) {
+			if (!(p->used_slots & (UINT64_C(1) << j))) {
+				page = p;
+				page_index = i;
+				slot = j;
+				break;
+			}
+		}
+	}
+	if (page == NULL) {
+		return false;
+	}
+	if (slot < 0) {
+		page->slot_size = slot_size;
+		slot = 0;
+	}
+	page->used_slots |= UINT64_C(1) << slot;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	*x = (page_index % WXRC_GL_ATLAS_PAGES_PER_ROW) * WXRC_GL_ATLAS_PAGE_SIZE +
+		(slot % slots_per_row) * slot_size;
+	*y = (page_index / WXRC_GL_ATLAS_PAGES_PER_ROW) * WXRC_GL_ATLAS_PAGE_SIZE +
+		(slot / slots_per_row) * slot_size;
+	return true;
+}
 
-	glViewport(0, 0, width, height);
+static void atlas_free(struct wxrc_gl_atlas *atlas, int x, int y) {
+	int page_index = (y / WXRC_GL_ATLAS_PAGE_SIZE) *
+		WXRC_GL_ATLAS_PAGES_PER_ROW + x / WXRC_GL_ATLAS_PAGE_SIZE;
+	struct wxrc_gl_atlas_page *page = &atlas->pages[page_index];
+	int slots_per_row = WXRC_GL_ATLAS_PAGE_SIZE / page->slot_size;
+	int slot = (y % WXRC_GL_ATLAS_PAGE_SIZE) / page->slot_size *
+		slots_per_row + (x % WXRC_GL_ATLAS_PAGE_SIZE) / page->slot_size;
+	page->used_slots &= ~(UINT64_C(1) << slot);
+	if (page->used_slots == 0) {
+		page->slot_size = 0;
+	}
+}
+
+static void surface_texture_finish(struct wxrc_gl *gl,
+		struct wxrc_gl_surface_texture *copy) {
+	if (copy->in_atlas) {
+		atlas_free(gl->atlas, copy->x, copy->y);
+	} else {
+		glDeleteFramebuffers(1, &copy->framebuffer);
+		glDeleteTextures(1, &copy->texture);
+	}
+	copy->framebuffer = copy->texture = 0;
+	copy->in_atlas = false;
+}
+
+static void view_texture_finish(struct wxrc_gl_view_texture *copy) {
+	glDeleteFramebuffers(1, &copy->framebuffer);
+	glDeleteTextures(1, &copy->texture);
+	copy->framebuffer = copy->texture = 0;
+}
+
+void wxrc_gl_finish(struct wxrc_gl *gl) {
+	for (size_t i = 0; i < gl->nsurface_textures; i++) {
+		surface_texture_finish(gl, &gl->surface_textures[i]);
+	}
+	free(gl->surface_textures);
+	gl->surface_textures = NULL;
+	gl->nsurface_textures = gl->surface_textures_cap = 0;
+	for (size_t i = 0; i < gl->nview_textures; i++) {
+		view_texture_finish(&gl->view_textures[i]);
+	}
+	free(gl->view_textures);
+	gl->view_textures = NULL;
+	gl->nview_textures = gl->view_textures_cap = 0;
+	if (gl->atlas != NULL) {
+		atlas_destroy(gl->atlas);
+		gl->atlas = NULL;
+	}
+
+	struct wxrc_gl_foveation *fov = &gl->foveation;
+	glDeleteFramebuffers(1, &fov->framebuffer);
+	glDeleteRenderbuffers(1, &fov->depth_buffer);
+	glDeleteTextures(1, &fov->texture);
+	fov->framebuffer = fov->depth_buffer = fov->texture = 0;
+	fov->width = fov->height = 0;
+
+	program_build_destroy(gl->multiview_build);
+	program_build_destroy(gl->atlas_build);
+	gl->multiview_build = gl->atlas_build = NULL;
+	finish_programs(&gl->programs);
+	finish_programs(&gl->multiview_programs);
+	gl->multiview = false;
+	glDeleteBuffers(1, &gl->grid_vbo);
+	glDeleteBuffers(1, &gl->quad_vbo);
+	glDeleteTextures(1, &gl->grid_texture);
+	free(gl->view_depths);
+	gl->view_depths = NULL;
+	gl->view_depths_cap = 0;
+	wxrc_program_cache_finish(&gl->program_cache);
+	wxrc_gpu_timer_finish(&gl->gpu_timer);
+}
+
+static void gl_state_begin(struct wxrc_gl *gl) {
+	memset(&gl->state, 0, sizeof(gl->state));
+	glActiveTexture(GL_TEXTURE0);
+	glEnableVertexAttribArray(WXRC_VERTEX_ATTRIB);
+}
+
+/**
+ * Restores the bindings wlroots expects, it uses client-side vertex arrays.
+ */
+static void gl_state_end(struct wxrc_gl *gl) {
+	glDisableVertexAttribArray(WXRC_VERTEX_ATTRIB);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+	memset(&gl->state, 0, sizeof(gl->state));
+}
+
+static void gl_state_use_program(struct wxrc_gl *gl, GLuint program) {
+	if (gl->state.program != program) {
+		glUseProgram(program);
+		gl->state.program = program;
+	}
+}
+
+static void gl_state_bind_vertex_buffer(struct wxrc_gl *gl, GLuint vbo,
+		GLint coords_per_point) {
+	if (gl->state.vertex_buffer != vbo) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glVertexAttribPointer(WXRC_VERTEX_ATTRIB, coords_per_point,
+			GL_FLOAT, GL_FALSE, 0, NULL);
+		gl->state.vertex_buffer = vbo;
+	}
+}
+
+static void gl_state_bind_texture(struct wxrc_gl *gl, GLenum target,
+		GLuint tex, GLint min_filter) {
+	if (gl->state.texture_target == target && gl->state.texture == tex) {
+		return;
+	}
+	glBindTexture(target, tex);
+	/* Filtering is texture state, so it only needs to be set when switching
+	 * to another texture */
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, min_filter);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	gl->state.texture_target = target;
+	gl->state.texture = tex;
+}
+
+static void set_uniform_bool(GLint loc, int *current, bool value) {
+	if (loc >= 0 && *current != value) {
+		glUniform1i(loc, value);
+		*current = value;
+	}
+}
+
+static void set_uniform_rect(GLint loc, GLfloat current[static 4],
+		const GLfloat value[static 4]) {
+	if (memcmp(current, value, 4 * sizeof(GLfloat)) != 0) {
+		glUniform4fv(loc, 1, value);
+		memcpy(current, value, 4 * sizeof(GLfloat));
+	}
+}
+
+/* Whole texture, or whole surface, see render_surface_rect */
+static const GLfloat full_rect[4] = { 0.0, 0.0, 1.0, 1.0 };
+
+/**
+ * A render pass draws the scene once, for one view or for all layers of a
+ * multiview framebuffer.
+ */
+struct render_pass {
+	struct wxrc_gl_programs *programs;
+	uint32_t nviews;
+	mat4 vp_matrices[WXRC_GL_MULTIVIEW_NVIEWS];
+
+	/* Single view passes: which texture XR shell surfaces use */
+	uint32_t xr_view_index;
+	/* Multiview passes: XR shell surfaces have a texture per view, they're
+	 * drawn to each layer separately */
+	GLuint framebuffer;
+	const GLuint *layer_framebuffers;
+
+	/* Frustum planes of each view, from vp_matrices */
+	vec4 frustum_planes[WXRC_GL_MULTIVIEW_NVIEWS][6];
+};
+
+/**
+ * Returns false if a bounding sphere lies outside the frusta of all the views
+ * of the pass.
+ */
+static bool render_pass_sphere_visible(struct render_pass *pass,
+		vec3 center, float radius) {
+	for (uint32_t i = 0; i < pass->nviews; i++) {
+		bool inside = true;
+		for (size_t j = 0; j < 6 && inside; j++) {
+			vec4 *plane = &pass->frustum_planes[i][j];
+			inside = glm_vec3_dot(*plane, center) + (*plane)[3] >= -radius;
+		}
+		if (inside) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void render_grid(struct wxrc_gl *gl, struct render_pass *pass) {
+	struct wxrc_gl_grid_program *prog = &pass->programs->grid;
+	gl_state_use_program(gl, prog->program);
+	gl_state_bind_texture(gl, GL_TEXTURE_2D, gl->grid_texture,
+		GL_LINEAR_MIPMAP_LINEAR);
+
+	mat4 model_matrix;
+	glm_mat4_identity(model_matrix);
+	glm_translate(model_matrix, (vec3){ 0.0, -1.0, 0.0 });
+	glm_scale(model_matrix,
+		(vec3){ 2 * GRID_RADIUS, 2 * GRID_RADIUS, 2 * GRID_RADIUS });
+	glm_rotate(model_matrix, glm_rad(90.0), (vec3){ 1.0, 0.0, 0.0 });
+
+	mat4 mvp_matrices[WXRC_GL_MULTIVIEW_NVIEWS];
+	for (uint32_t i = 0; i < pass->nviews; i++) {
+		glm_mat4_mul(pass->vp_matrices[i], model_matrix, mvp_matrices[i]);
+	}
+
+	glUniformMatrix4fv(prog->mvp_loc, pass->nviews, GL_FALSE,
+		(GLfloat *)mvp_matrices);
+
+	size_t npoints = 4;
+	GLint coords_per_point =
+		sizeof(grid_points) / sizeof(grid_points[0]) / npoints;
+	gl_state_bind_vertex_buffer(gl, gl->grid_vbo, coords_per_point);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, npoints);
+}
+
+/**
+ * Draws a rectangle of a GL texture once per view of the program, with one MVP
+ * matrix each. The MVP matrices map the whole texture.
+ */
+static void render_gl_texture(struct wxrc_gl *gl,
+		struct wxrc_gl_texture_program *prog, GLenum target, GLuint tex,
+		GLint min_filter, bool invert_y, bool has_alpha,
+		const GLfloat tex_rect[static 4], mat4 *mvp_matrices,
+		uint32_t nviews) {
+	gl_state_use_program(gl, prog->program);
+	gl_state_bind_texture(gl, target, tex, min_filter);
+
+	set_uniform_bool(prog->invert_y_loc, &prog->invert_y, invert_y);
+	set_uniform_bool(prog->has_alpha_loc, &prog->has_alpha, has_alpha);
+	set_uniform_rect(prog->tex_rect_loc, prog->tex_rect, tex_rect);
+
+	glUniformMatrix4fv(prog->mvp_loc, nviews, GL_FALSE,
+		(GLfloat *)mvp_matrices);
+
+	size_t npoints = 4;
+	GLint coords_per_point =
+		sizeof(quad_points) / sizeof(quad_points[0]) / npoints;
+	gl_state_bind_vertex_buffer(gl, gl->quad_vbo, coords_per_point);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, npoints);
+}
+
+/**
+ * Draws a rectangle of a texture once per view of the programs, with one MVP
+ * matrix each. The rectangle is upright, like the texture is displayed.
+ */
+static void render_texture(struct wxrc_gl *gl,
+		struct wxrc_gl_programs *programs, struct wlr_texture *tex,
+		const GLfloat tex_rect[static 4], mat4 *mvp_matrices,
+		uint32_t nviews) {
+	if (!wlr_texture_is_gles2(tex)) {
+		wlr_log(WLR_ERROR, "unsupported texture type");
+		return;
+	}
+
+	struct wlr_gles2_texture_attribs attribs = {0};
+	wlr_gles2_texture_get_attribs(tex, &attribs);
+
+	struct wxrc_gl_texture_program *prog;
+	switch (attribs.target) {
+	case GL_TEXTURE_2D:
+		prog = &programs->texture_rgb;
+		break;
+	case GL_TEXTURE_EXTERNAL_OES:
+		prog = &programs->texture_external;
+		break;
+	default:
+		wlr_log(WLR_ERROR, "unsupported texture target %d", attribs.target);
+		return;
+	}
+
+	render_gl_texture(gl, prog, attribs.target, attribs.tex, GL_LINEAR,
+		!attribs.inverted_y, attribs.has_alpha, tex_rect, mvp_matrices,
+		nviews);
+}
+
+static struct wxrc_gl_surface_texture *find_surface_texture(
+		struct wxrc_gl *gl, uint64_t surface_id) {
+	if (surface_id == 0) {
+		return NULL;
+	}
+	for (size_t i = 0; i < gl->nsurface_textures; i++) {
+		if (gl->surface_textures[i].surface_id == surface_id) {
+			return &gl->surface_textures[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Draws the surfaces queued by render_atlas_queue, in order, with a single
+ * instanced draw covering all views of the pass.
+ */
+static void render_atlas_flush(struct wxrc_gl *gl, struct render_pass *pass) {
+	struct wxrc_gl_atlas *atlas = gl->atlas;
+	if (atlas == NULL || atlas->nbatch == 0) {
+		return;
+	}
+
+	struct wxrc_gl_atlas_program *prog = &pass->programs->atlas;
+	gl_state_use_program(gl, prog->program);
+	gl_state_bind_texture(gl, GL_TEXTURE_2D, atlas->texture, GL_LINEAR);
+
+	glUniformMatrix4fv(prog->vp_loc, pass->nviews, GL_FALSE,
+		(GLfloat *)pass->vp_matrices);
+
+	size_t npoints = 4;
+	GLint coords_per_point =
+		sizeof(quad_points) / sizeof(quad_points[0]) / npoints;
+	gl_state_bind_vertex_buffer(gl, gl->quad_vbo, coords_per_point);
+
+	/* Orphan the previous batch, which may still be in use by the GPU */
+	glBindBuffer(GL_ARRAY_BUFFER, atlas->instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(atlas->batch), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0,
+		atlas->nbatch * sizeof(atlas->batch[0]), atlas->batch);
+	gl->state.vertex_buffer = atlas->instance_vbo;
+
+	GLsizei stride = sizeof(atlas->batch[0]);
+	for (GLuint i = 0; i < 4; i++) {
+		size_t offset = offsetof(struct wxrc_gl_atlas_instance, model_matrix) +
+			i * 4 * sizeof(GLfloat);
+		glEnableVertexAttribArray(WXRC_MODEL_ATTRIB + i);
+		glVertexAttribPointer(WXRC_MODEL_ATTRIB + i, 4, GL_FLOAT, GL_FALSE,
+			stride, (void *)offset);
+		atlas->glVertexAttribDivisor(WXRC_MODEL_ATTRIB + i, 1);
+	}
+	glEnableVertexAttribArray(WXRC_UV_RECT_ATTRIB);
+	glVertexAttribPointer(WXRC_UV_RECT_ATTRIB, 4, GL_FLOAT, GL_FALSE, stride,
+		(void *)offsetof(struct wxrc_gl_atlas_instance, uv_rect));
+	atlas->glVertexAttribDivisor(WXRC_UV_RECT_ATTRIB, 1);
+
+	atlas->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, npoints,
+		atlas->nbatch);
+
+	/* Other programs only use WXRC_VERTEX_ATTRIB */
+	for (GLuint i = WXRC_MODEL_ATTRIB; i <= WXRC_UV_RECT_ATTRIB; i++) {
+		atlas->glVertexAttribDivisor(i, 0);
+		glDisableVertexAttribArray(i);
+	}
+
+	atlas->nbatch = 0;
+}
+
+static void render_atlas_queue(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_gl_surface_texture *copy, mat4 model_matrix,
+		const GLfloat rect[static 4]) {
+	struct wxrc_gl_atlas *atlas = gl->atlas;
+	if (atlas->nbatch == WXRC_GL_ATLAS_MAX_BATCH) {
+		render_atlas_flush(gl, pass);
+	}
+
+	struct wxrc_gl_atlas_instance *instance = &atlas->batch[atlas->nbatch++];
+	mat4 rect_matrix;
+	glm_translate_to(model_matrix, (vec3){ rect[0], rect[1], 0.0 },
+		rect_matrix);
+	glm_scale(rect_matrix, (vec3){ rect[2], rect[3], 1.0 });
+	memcpy(instance->model_matrix, rect_matrix,
+		sizeof(instance->model_matrix));
+	/* Slots are upright, like other copies */
+	float slot_width = (float)copy->width / WXRC_GL_ATLAS_SIZE;
+	float slot_height = (float)copy->height / WXRC_GL_ATLAS_SIZE;
+	instance->uv_rect[0] =
+		(float)copy->x / WXRC_GL_ATLAS_SIZE + rect[0] * slot_width;
+	instance->uv_rect[1] =
+		(float)copy->y / WXRC_GL_ATLAS_SIZE + rect[1] * slot_height;
+	instance->uv_rect[2] = rect[2] * slot_width;
+	instance->uv_rect[3] = rect[3] * slot_height;
+}
 
+/**
+ * Draws a rectangle of a surface. The rectangle is normalized, with its origin
+ * at the bottom-left corner of the surface.
+ */
+static void render_surface_rect(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene_surface *surface, const GLfloat rect[static 4]) {
+	mat4 mvp_matrices[WXRC_GL_MULTIVIEW_NVIEWS];
+	for (uint32_t i = 0; i < pass->nviews; i++) {
+		glm_mat4_mul(pass->vp_matrices[i], surface->model_matrix,
+			mvp_matrices[i]);
+	}
+
+	struct wxrc_gl_surface_texture *copy =
+		find_surface_texture(gl, surface->id);
+	if (copy != NULL && copy->commit_seq != 0 && copy->in_atlas) {
+		render_atlas_queue(gl, pass, copy, surface->model_matrix, rect);
+		return;
+	}
+
+	/* Anything queued is below this surface */
+	render_atlas_flush(gl, pass);
+
+	if (copy != NULL && copy->commit_seq != 0) {
+		/* Copies are upright, see copy_surface_texture */
+		render_gl_texture(gl, &pass->programs->texture_rgb, GL_TEXTURE_2D,
+			copy->texture, GL_LINEAR_MIPMAP_LINEAR, false, true, rect,
+			mvp_matrices, pass->nviews);
+		return;
+	}
+
+	render_texture(gl, pass->programs, surface->texture, rect, mvp_matrices,
+		pass->nviews);
+}
+
+static void render_surface(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene_surface *surface) {
+	render_surface_rect(gl, pass, surface, full_rect);
+}
+
+/**
+ * Creates a texture to render to, for mipmapped sampling.
+ */
+static bool create_render_texture(int width, int height, GLuint *texture,
+		GLuint *framebuffer) {
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_2D, *texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+		GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, *framebuffer);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-		image, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-		depth_buffer, 0);
+		*texture, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		wlr_log(WLR_ERROR, "Render texture framebuffer incomplete: 0x%x",
+			status);
+		glDeleteFramebuffers(1, framebuffer);
+		glDeleteTextures(1, texture);
+		*framebuffer = *texture = 0;
+		return false;
+	}
+	return true;
+}
+
+static bool surface_texture_init(struct wxrc_gl *gl,
+		struct wxrc_gl_surface_texture *copy, int width, int height) {
+	if (gl->atlas != NULL &&
+			atlas_alloc(gl->atlas, width, height, &copy->x, &copy->y)) {
+		copy->in_atlas = true;
+		copy->texture = gl->atlas->texture;
+		copy->framebuffer = gl->atlas->framebuffer;
+		copy->width = width;
+		copy->height = height;
+		copy->commit_seq = 0;
+		return true;
+	}
+	if (!gl->mipmaps) {
+		return false;
+	}
+
+	copy->in_atlas = false;
+	copy->x = copy->y = 0;
+	if (!create_render_texture(width, height, &copy->texture,
+			&copy->framebuffer)) {
+		return false;
+	}
+
+	copy->width = width;
+	copy->height = height;
+	copy->commit_seq = 0;
+	return true;
+}
+
+/**
+ * Copies a surface's texture to level 0 of the copy, then regenerates the
+ * other levels. Atlas slots have no other levels. Only the damaged area is
+ * copied if the damage since the state the copy holds is known.
+ */
+static void copy_surface_texture(struct wxrc_gl *gl,
+		struct wxrc_gl_surface_texture *copy,
+		struct wxrc_scene_surface *surface) {
+	struct wlr_box damage;
+	if (!wxrc_scene_surface_get_damage(surface, copy->commit_seq, &damage)) {
+		damage = (struct wlr_box){
+			.width = copy->width,
+			.height = copy->height,
+		};
+	}
+	if (damage.width <= 0 || damage.height <= 0) {
+		/* Committed without new content, e.g. to request a frame
+		 * callback */
+		copy->commit_seq = surface->commit_seq;
+		return;
+	}
+	bool partial = damage.width < copy->width || damage.height < copy->height;
+	gl->counters[partial ? WXRC_FRAME_COUNTER_PARTIAL_COPIES :
+		WXRC_FRAME_COUNTER_FULL_COPIES]++;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, copy->framebuffer);
+	glViewport(copy->x, copy->y, copy->width, copy->height);
+
+	/* The texture program flips client textures, so the copy's bottom row
+	 * is the buffer's bottom row */
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(copy->x + damage.x,
+		copy->y + copy->height - damage.y - damage.height,
+		damage.width, damage.height);
+
+	mat4 mvp_matrix = GLM_MAT4_IDENTITY_INIT;
+	glm_translate(mvp_matrix, (vec3){ -1.0, -1.0, 0.0 });
+	glm_scale(mvp_matrix, (vec3){ 2.0, 2.0, 1.0 });
+	render_texture(gl, &gl->programs, surface->texture, full_rect,
+		&mvp_matrix, 1);
+
+	glDisable(GL_SCISSOR_TEST);
+
+	if (!copy->in_atlas) {
+		gl_state_bind_texture(gl, GL_TEXTURE_2D, copy->texture,
+			GL_LINEAR_MIPMAP_LINEAR);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	copy->commit_seq = surface->commit_seq;
+}
+
+static struct wxrc_gl_view_texture *find_view_texture(struct wxrc_gl *gl,
+		uint64_t view_id) {
+	for (size_t i = 0; i < gl->nview_textures; i++) {
+		if (gl->view_textures[i].view_id == view_id) {
+			return &gl->view_textures[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Draws all surfaces of a view to its texture, which the surface copies must
+ * be up to date for, then regenerates the texture's other levels.
+ */
+static void flatten_view(struct wxrc_gl *gl, struct wxrc_gl_view_texture *copy,
+		struct wxrc_scene *scene, struct wxrc_scene_view *view,
+		mat4 inv_pose_matrix) {
+	glBindFramebuffer(GL_FRAMEBUFFER, copy->framebuffer);
+	glViewport(0, 0, copy->width, copy->height);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	struct render_pass pass = {
+		.programs = &gl->programs,
+		.nviews = 1,
+	};
+	wxrc_gl_get_bounds_vp_matrix(inv_pose_matrix, copy->x1, copy->y1,
+		copy->x2, copy->y2, pass.vp_matrices[0]);
+	for (size_t i = 0; i < view->nsurfaces; i++) {
+		render_surface(gl, &pass, &scene->surfaces[view->first_surface + i]);
+	}
+	render_atlas_flush(gl, &pass);
+
+	gl_state_bind_texture(gl, GL_TEXTURE_2D, copy->texture,
+		GL_LINEAR_MIPMAP_LINEAR);
+	glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+static void update_view_textures(struct wxrc_gl *gl,
+		struct wxrc_scene *scene) {
+	for (size_t i = 0; i < gl->nview_textures; i++) {
+		gl->view_textures[i].used = false;
+	}
+
+	/* Surfaces of a view are coplanar and drawn in order, like in quad
+	 * layers */
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	gl_state_begin(gl);
+
+	for (size_t i = 0; scene != NULL && i < scene->nviews; i++) {
+		struct wxrc_scene_view *view = &scene->views[i];
+		/* Views with a single surface are drawn from its copy already.
+		 * Untracked views would need to be flattened on each frame. */
+		if (view->xr_shell || view->nsurfaces < 2 || view->commit_seq == 0) {
+			continue;
+		}
 
+		struct wxrc_scene_surface *surfaces =
+			&scene->surfaces[view->first_surface];
+		mat4 inv_pose_matrix;
+		glm_mat4_inv(view->pose_matrix, inv_pose_matrix);
+		int x1, y1, x2, y2;
+		if (!wxrc_gl_get_surface_bounds(inv_pose_matrix, surfaces,
+				view->nsurfaces, &x1, &y1, &x2, &y2)) {
+			continue;
+		}
+
+		/* Larger views are downscaled */
+		int width = x2 - x1, height = y2 - y1;
+		if (width > gl->max_texture_size) {
+			width = gl->max_texture_size;
+		}
+		if (height > gl->max_texture_size) {
+			height = gl->max_texture_size;
+		}
+
+		struct wxrc_gl_view_texture *copy = find_view_texture(gl, view->id);
+		if (copy != NULL &&
+				(copy->width != width || copy->height != height)) {
+			view_texture_finish(copy);
+			if (!create_render_texture(width, height, &copy->texture,
+					&copy->framebuffer)) {
+				/* Dropped below, the surfaces are drawn one by one */
+				continue;
+			}
+			copy->width = width;
+			copy->height = height;
+			copy->commit_seq = 0;
+		}
+		if (copy == NULL) {
+			if (gl->nview_textures == gl->view_textures_cap) {
+				size_t cap = gl->view_textures_cap == 0 ?
+					8 : gl->view_textures_cap * 2;
+				struct wxrc_gl_view_texture *copies = realloc(
+					gl->view_textures, cap * sizeof(copies[0]));
+				if (copies == NULL) {
+					wlr_log_errno(WLR_ERROR, "realloc failed");
+					continue;
+				}
+				gl->view_textures = copies;
+				gl->view_textures_cap = cap;
+			}
+			copy = &gl->view_textures[gl->nview_textures];
+			*copy = (struct wxrc_gl_view_texture){
+				.view_id = view->id,
+				.width = width,
+				.height = height,
+			};
+			if (!create_render_texture(width, height, &copy->texture,
+					&copy->framebuffer)) {
+				continue;
+			}
+			gl->nview_textures++;
+		}
+
+		copy->used = true;
+		/* Surfaces only move relative to each other when one of them is
+		 * committed, or when one is added or removed */
+		bool changed = copy->commit_seq != view->commit_seq ||
+			copy->nsurfaces != view->nsurfaces ||
+			copy->x1 != x1 || copy->y1 != y1 ||
+			copy->x2 != x2 || copy->y2 != y2;
+		if (!changed) {
+			continue;
+		}
+
+		copy->nsurfaces = view->nsurfaces;
+		copy->x1 = x1;
+		copy->y1 = y1;
+		copy->x2 = x2;
+		copy->y2 = y2;
+		int main_x1, main_y1, main_x2, main_y2;
+		if (wxrc_gl_get_surface_bounds(inv_pose_matrix, surfaces, 1,
+				&main_x1, &main_y1, &main_x2, &main_y2)) {
+			copy->main_rect[0] = (float)(main_x1 - x1) / (x2 - x1);
+			copy->main_rect[1] = (float)(main_y1 - y1) / (y2 - y1);
+			copy->main_rect[2] = (float)(main_x2 - main_x1) / (x2 - x1);
+			copy->main_rect[3] = (float)(main_y2 - main_y1) / (y2 - y1);
+		} else {
+			memset(copy->main_rect, 0, sizeof(copy->main_rect));
+		}
+
+		flatten_view(gl, copy, scene, view, inv_pose_matrix);
+		copy->commit_seq = view->commit_seq;
+	}
+
+	gl_state_end(gl);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	for (size_t i = 0; i < gl->nview_textures;) {
+		struct wxrc_gl_view_texture *copy = &gl->view_textures[i];
+		if (copy->used) {
+			i++;
+			continue;
+		}
+		view_texture_finish(copy);
+		*copy = gl->view_textures[--gl->nview_textures];
+	}
+}
+
+void wxrc_gl_update_surface_textures(struct wxrc_gl *gl,
+		struct wxrc_scene *scene) {
+	memset(gl->counters, 0, sizeof(gl->counters));
+	if (!gl->mipmaps && gl->atlas == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < gl->nsurface_textures; i++) {
+		gl->surface_textures[i].used = false;
+	}
+
+	wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_COPIES);
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	gl_state_begin(gl);
+
+	for (size_t i = 0; scene != NULL && i < scene->nsurfaces; i++) {
+		struct wxrc_scene_surface *surface = &scene->surfaces[i];
+		if (surface->id == 0 || surface->width <= 0 || surface->height <= 0) {
+			continue;
+		}
+
+		struct wxrc_gl_surface_texture *copy =
+			find_surface_texture(gl, surface->id);
+		if (copy != NULL && (copy->width != surface->width ||
+				copy->height != surface->height)) {
+			surface_texture_finish(gl, copy);
+			if (!surface_texture_init(gl, copy, surface->width,
+					surface->height)) {
+				/* Dropped below, the surface is sampled directly */
+				continue;
+			}
+		}
+		if (copy == NULL) {
+			if (gl->nsurface_textures == gl->surface_textures_cap) {
+				size_t cap = gl->surface_textures_cap == 0 ?
+					16 : gl->surface_textures_cap * 2;
+				struct wxrc_gl_surface_texture *copies = realloc(
+					gl->surface_textures, cap * sizeof(copies[0]));
+				if (copies == NULL) {
+					wlr_log_errno(WLR_ERROR, "realloc failed");
+					continue;
+				}
+				gl->surface_textures = copies;
+				gl->surface_textures_cap = cap;
+			}
+			copy = &gl->surface_textures[gl->nsurface_textures];
+			if (!surface_texture_init(gl, copy, surface->width,
+					surface->height)) {
+				continue;
+			}
+			copy->surface_id = surface->id;
+			gl->nsurface_textures++;
+		}
+
+		copy->used = true;
+		if (wxrc_scene_surface_changed(surface, copy->commit_seq)) {
+			copy_surface_texture(gl, copy, surface);
+		}
+	}
+
+	gl_state_end(gl);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	for (size_t i = 0; i < gl->nsurface_textures;) {
+		struct wxrc_gl_surface_texture *copy = &gl->surface_textures[i];
+		if (copy->used) {
+			i++;
+			continue;
+		}
+		surface_texture_finish(gl, copy);
+		*copy = gl->surface_textures[--gl->nsurface_textures];
+	}
+
+	if (gl->mipmaps) {
+		update_view_textures(gl, scene);
+	}
+
+	wxrc_gpu_timer_end(&gl->gpu_timer);
+}
+
+/**
+ * Returns the flattened texture of a view, or NULL if its surfaces must be
+ * drawn one by one.
+ */
+static struct wxrc_gl_view_texture *get_view_texture(struct wxrc_gl *gl,
+		struct wxrc_scene_view *view) {
+	if (view->nsurfaces < 2 || view->commit_seq == 0) {
+		return NULL;
+	}
+	struct wxrc_gl_view_texture *copy = find_view_texture(gl, view->id);
+	if (copy == NULL || copy->commit_seq != view->commit_seq ||
+			copy->nsurfaces != view->nsurfaces) {
+		return NULL;
+	}
+	return copy;
+}
+
+/**
+ * Draws a rectangle of a flattened view, normalized like the rectangles of
+ * render_surface_rect.
+ */
+static void render_view_texture_rect(struct wxrc_gl *gl,
+		struct render_pass *pass, struct wxrc_scene_view *view,
+		struct wxrc_gl_view_texture *copy, const GLfloat rect[static 4]) {
+	/* The pose may change without the content changing, e.g. while a view
+	 * is being moved */
+	mat4 model_matrix;
+	glm_translate_to(view->pose_matrix, (vec3){
+		copy->x1 / WXRC_SURFACE_SCALE, copy->y1 / WXRC_SURFACE_SCALE, 0.0,
+	}, model_matrix);
+	glm_scale(model_matrix, (vec3){
+		(copy->x2 - copy->x1) / WXRC_SURFACE_SCALE,
+		(copy->y2 - copy->y1) / WXRC_SURFACE_SCALE,
+		1.0,
+	});
+
+	mat4 mvp_matrices[WXRC_GL_MULTIVIEW_NVIEWS];
+	for (uint32_t i = 0; i < pass->nviews; i++) {
+		glm_mat4_mul(pass->vp_matrices[i], model_matrix, mvp_matrices[i]);
+	}
+
+	/* Anything queued is below this view */
+	render_atlas_flush(gl, pass);
+
+	/* Flattened views are upright, like surface copies */
+	render_gl_texture(gl, &pass->programs->texture_rgb, GL_TEXTURE_2D,
+		copy->texture, GL_LINEAR_MIPMAP_LINEAR, false, true, rect,
+		mvp_matrices, pass->nviews);
+}
+
+static void render_2d_view(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene *scene, struct wxrc_scene_view *view) {
+	struct wxrc_gl_view_texture *copy = get_view_texture(gl, view);
+	if (copy != NULL) {
+		render_view_texture_rect(gl, pass, view, copy, full_rect);
+		return;
+	}
+
+	for (size_t i = 0; i < view->nsurfaces; i++) {
+		render_surface(gl, pass, &scene->surfaces[view->first_surface + i]);
+	}
+}
+
+static void render_xr_shell_texture(struct wxrc_gl *gl,
+		uint32_t xr_view_index, struct wxrc_scene_view *view) {
+	struct wlr_texture *tex = NULL;
+	if (xr_view_index < WXRC_SCENE_MAX_XR_VIEWS) {
+		tex = view->xr_textures[xr_view_index];
+	}
+	if (tex == NULL) {
+		/* TODO: Don't show on one view if we can't show on all views */
+		wlr_log(WLR_DEBUG, "Attempted to render XR surface without texture");
+		return;
+	}
+
+	mat4 mvp_matrix = GLM_MAT4_IDENTITY_INIT;
+	glm_translate(mvp_matrix, (vec3){ -1.0, -1.0, 0.0 });
+	glm_scale(mvp_matrix, (vec3){ 2.0, 2.0, 1.0 });
+	render_texture(gl, &gl->programs, tex, full_rect, &mvp_matrix, 1);
+}
+
+static void render_xr_shell_view(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene_view *view) {
+	render_atlas_flush(gl, pass);
+
+	/* XR shell textures cover the whole view, but their clients don't
+	 * share their depth */
+	glDepthMask(GL_FALSE);
+
+	if (pass->layer_framebuffers == NULL) {
+		render_xr_shell_texture(gl, pass->xr_view_index, view);
+	} else {
+		for (uint32_t i = 0; i < pass->nviews; i++) {
+			glBindFramebuffer(GL_FRAMEBUFFER, pass->layer_framebuffers[i]);
+			render_xr_shell_texture(gl, i, view);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, pass->framebuffer);
+	}
+
+	glDepthMask(gl->write_depth);
+}
+
+static void render_view(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene *scene, struct wxrc_scene_view *view) {
+	if (view->xr_shell) {
+		render_xr_shell_view(gl, pass, view);
+	} else {
+		render_2d_view(gl, pass, scene, view);
+	}
+}
+
+/**
+ * Returns the part of a surface known to be opaque, normalized like the
+ * rectangles of render_surface_rect. Returns false if there's none.
+ */
+static bool get_opaque_rect(struct wxrc_scene_surface *surface,
+		GLfloat rect[static 4]) {
+	if (surface->width <= 0 || surface->height <= 0) {
+		return false;
+	}
+
+	struct wlr_box box = surface->opaque;
+	if (wlr_texture_is_gles2(surface->texture)) {
+		struct wlr_gles2_texture_attribs attribs = {0};
+		wlr_gles2_texture_get_attribs(surface->texture, &attribs);
+		if (!attribs.has_alpha) {
+			box = (struct wlr_box){
+				.width = surface->width,
+				.height = surface->height,
+			};
+		}
+	}
+
+	int x1 = box.x > 0 ? box.x : 0;
+	int y1 = box.y > 0 ? box.y : 0;
+	int x2 = box.x + box.width < surface->width ?
+		box.x + box.width : surface->width;
+	int y2 = box.y + box.height < surface->height ?
+		box.y + box.height : surface->height;
+	if (x1 >= x2 || y1 >= y2) {
+		return false;
+	}
+
+	/* The box is in buffer coordinates, with its origin at the top */
+	rect[0] = (float)x1 / surface->width;
+	rect[1] = 1.0 - (float)y2 / surface->height;
+	rect[2] = (float)(x2 - x1) / surface->width;
+	rect[3] = (float)(y2 - y1) / surface->height;
+	return true;
+}
+
+/**
+ * Returns the part of a view's first surface known to be opaque, normalized
+ * like the rectangles of render_surface_rect, but relative to the whole view if
+ * it's flattened. Returns false if there's none.
+ */
+static bool get_view_opaque_rect(struct wxrc_scene *scene,
+		struct wxrc_scene_view *view, struct wxrc_gl_view_texture *copy,
+		GLfloat rect[static 4]) {
+	if (view->nsurfaces == 0 ||
+			!get_opaque_rect(&scene->surfaces[view->first_surface], rect)) {
+		return false;
+	}
+	if (copy != NULL) {
+		/* Whatever is drawn over an opaque pixel is opaque too */
+		const GLfloat *main_rect = copy->main_rect;
+		rect[0] = main_rect[0] + rect[0] * main_rect[2];
+		rect[1] = main_rect[1] + rect[1] * main_rect[3];
+		rect[2] *= main_rect[2];
+		rect[3] *= main_rect[3];
+	}
+	return rect[2] > 0 && rect[3] > 0;
+}
+
+/**
+ * Draws a rectangle of a view's first surface, or of the whole view if it's
+ * flattened.
+ */
+static void render_view_rect(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene *scene, struct wxrc_scene_view *view,
+		struct wxrc_gl_view_texture *copy, const GLfloat rect[static 4]) {
+	if (copy != NULL) {
+		render_view_texture_rect(gl, pass, view, copy, rect);
+	} else {
+		render_surface_rect(gl, pass,
+			&scene->surfaces[view->first_surface], rect);
+	}
+}
+
+/**
+ * Draws the parts of a view's first surface around its opaque rectangle, then
+ * the view's other surfaces. Flattened views are drawn as one.
+ */
+static void render_view_translucent(struct wxrc_gl *gl,
+		struct render_pass *pass, struct wxrc_scene *scene,
+		struct wxrc_scene_view *view, struct wxrc_gl_view_texture *copy,
+		const GLfloat opaque[static 4]) {
+	float right = opaque[0] + opaque[2];
+	float top = opaque[1] + opaque[3];
+	const GLfloat strips[][4] = {
+		{ 0.0, 0.0, 1.0, opaque[1] },
+		{ 0.0, top, 1.0, 1.0 - top },
+		{ 0.0, opaque[1], opaque[0], opaque[3] },
+		{ right, opaque[1], 1.0 - right, opaque[3] },
+	};
+	for (size_t i = 0; i < sizeof(strips) / sizeof(strips[0]); i++) {
+		if (strips[i][2] > 0 && strips[i][3] > 0) {
+			render_view_rect(gl, pass, scene, view, copy, strips[i]);
+		}
+	}
+
+	if (copy != NULL) {
+		return;
+	}
+	for (size_t i = 1; i < view->nsurfaces; i++) {
+		render_surface(gl, pass, &scene->surfaces[view->first_surface + i]);
+	}
+}
+
+static int view_depth_compare(const void *_a, const void *_b) {
+	const struct wxrc_gl_view_depth *a = _a, *b = _b;
+	/* Farthest first */
+	if (a->depth != b->depth) {
+		return a->depth < b->depth ? 1 : -1;
+	}
+	/* Keep the stacking order of views at the same distance */
+	return a->index < b->index ? -1 : a->index > b->index;
+}
+
+/**
+ * Fills gl->view_depths with the visible 2D views from first on, back to
+ * front. Returns false on allocation failure.
+ */
+static bool sort_2d_views(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene *scene, size_t first, size_t *nviews) {
+	if (scene->nviews > gl->view_depths_cap) {
+		struct wxrc_gl_view_depth *view_depths = realloc(gl->view_depths,
+			scene->nviews * sizeof(view_depths[0]));
+		if (view_depths == NULL) {
+			wlr_log_errno(WLR_ERROR, "realloc failed");
+			return false;
+		}
+		gl->view_depths = view_depths;
+		gl->view_depths_cap = scene->nviews;
+	}
+
+	*nviews = 0;
+	for (size_t i = first; i < scene->nviews; i++) {
+		struct wxrc_scene_view *view = &scene->views[i];
+		/* Many views are arranged all around the user, skip the ones
+		 * behind them */
+		if (!render_pass_sphere_visible(pass, view->bounds_center,
+				view->bounds_radius)) {
+			continue;
+		}
+
+		/* Clip-space w is the distance along the view axis */
+		vec4 center;
+		glm_mat4_mulv(pass->vp_matrices[0],
+			(vec4){ view->bounds_center[0], view->bounds_center[1],
+			view->bounds_center[2], 1.0 }, center);
+		gl->view_depths[*nviews] = (struct wxrc_gl_view_depth){
+			.index = i,
+			.rank = *nviews,
+			.depth = center[3],
+		};
+		(*nviews)++;
+	}
+
+	qsort(gl->view_depths, *nviews, sizeof(gl->view_depths[0]),
+		view_depth_compare);
+	return true;
+}
+
+/**
+ * Pulls what's drawn next towards the viewer according to its stacking rank,
+ * so that views drawn in the same plane, e.g. new windows spawned at the same
+ * spot, hide each other in stacking order whatever the depth test decides.
+ * Each view gets two steps: its translucent surfaces are pulled one step more
+ * than its opaque surface, so they pass the depth test against it, but never
+ * as far as the opaque surface of the view above.
+ */
+static void set_2d_view_depth_bias(struct wxrc_gl *gl,
+		struct render_pass *pass, size_t rank, bool translucent) {
+	/* Queued surfaces are drawn with the current offset */
+	render_atlas_flush(gl, pass);
+	glPolygonOffset(0.0, -(GLfloat)(2 * rank + translucent));
+}
+
+/**
+ * Draws everything but the opaque part of the main surface of the sorted 2D
+ * views, back to front. Flattened views count as a single surface.
+ */
+static void render_2d_views_translucent(struct wxrc_gl *gl,
+		struct render_pass *pass, struct wxrc_scene *scene, size_t nviews) {
+	GLfloat opaque[4];
+	for (size_t i = 0; i < nviews; i++) {
+		struct wxrc_scene_view *view =
+			&scene->views[gl->view_depths[i].index];
+		set_2d_view_depth_bias(gl, pass, gl->view_depths[i].rank, true);
+		struct wxrc_gl_view_texture *copy = get_view_texture(gl, view);
+		if (get_view_opaque_rect(scene, view, copy, opaque)) {
+			render_view_translucent(gl, pass, scene, view, copy, opaque);
+		} else {
+			render_2d_view(gl, pass, scene, view);
+		}
+	}
+}
+
+/**
+ * Draws 2D views from first on, and the cursor. Returns false if nothing was
+ * drawn. The opaque part of each view's
+ * main surface is drawn first, front to back with depth writes and without
+ * blending, so that the depth test rejects whatever it hides. Everything else
+ * is then blended back to front.
+ */
+static bool render_2d_views(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene *scene, size_t first) {
+	size_t nviews;
+	if (!sort_2d_views(gl, pass, scene, first, &nviews)) {
+		return false;
+	}
+
+	/* Surfaces above the main one, e.g. popups, are coplanar with it, so
+	 * only the main surface, or the flattened view, can be drawn out of
+	 * order */
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+	GLfloat opaque[4];
+	for (size_t i = nviews; i-- > 0;) {
+		struct wxrc_scene_view *view =
+			&scene->views[gl->view_depths[i].index];
+		set_2d_view_depth_bias(gl, pass, gl->view_depths[i].rank, false);
+		struct wxrc_gl_view_texture *copy = get_view_texture(gl, view);
+		if (get_view_opaque_rect(scene, view, copy, opaque)) {
+			render_view_rect(gl, pass, scene, view, copy, opaque);
+		}
+	}
+	render_atlas_flush(gl, pass);
+
+	/* Translucent surfaces don't write depth: coplanar surfaces of the
+	 * same view would hide each other */
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND);
+	render_2d_views_translucent(gl, pass, scene, nviews);
+	render_atlas_flush(gl, pass);
+	if (scene->has_cursor) {
+		wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_CURSOR);
+		/* Above every view */
+		set_2d_view_depth_bias(gl, pass, nviews, false);
+		render_surface(gl, pass, &scene->cursor);
+		render_atlas_flush(gl, pass);
+	}
+
+	if (gl->write_depth) {
+		/* The runtime needs the depth of the nearest surface over each
+		 * pixel, translucent or not */
+		wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_VIEWS);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_TRUE);
+		render_2d_views_translucent(gl, pass, scene, nviews);
+		render_atlas_flush(gl, pass);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	return true;
+}
+
+/**
+ * Draws views from first to last in stacking order, without occluding each
+ * other.
+ */
+static void render_views_in_order(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene *scene, size_t first, size_t last) {
+	glDepthMask(GL_FALSE);
+	if (gl->write_depth) {
+		/* Nothing is occluded either way, but the runtime needs the
+		 * depth of whatever was drawn last over each pixel */
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_ALWAYS);
+	}
+	for (size_t i = first; i < last; i++) {
+		struct wxrc_scene_view *view = &scene->views[i];
+		if (gl->quad_layers && !view->xr_shell) {
+			continue;
+		}
+		/* Many views are arranged all around the user, skip the ones
+		 * behind them */
+		if (!view->xr_shell && !render_pass_sphere_visible(pass,
+				view->bounds_center, view->bounds_radius)) {
+			continue;
+		}
+		render_view(gl, pass, scene, view);
+	}
+	render_atlas_flush(gl, pass);
+	glDepthFunc(GL_LESS);
+}
+
+static void render_pass(struct wxrc_gl *gl, struct render_pass *pass,
+		struct wxrc_scene *scene) {
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glClearColor(bg_color[0], bg_color[1], bg_color[2], bg_color[3]);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	for (uint32_t i = 0; i < pass->nviews; i++) {
+		glm_frustum_planes(pass->vp_matrices[i], pass->frustum_planes[i]);
+	}
+
+	gl_state_begin(gl);
+
+	// The grid is transparent between its lines, it doesn't occlude
+	// anything. Not even with write_depth: windows below the floor would be
+	// hidden.
+	glDepthMask(GL_FALSE);
+	if (!gl->hide_grid) {
+		wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_GRID);
+		render_grid(gl, pass);
+		wxrc_gpu_timer_end(&gl->gpu_timer);
+	}
+
+	if (scene == NULL) {
+		glDepthMask(GL_TRUE);
+		gl_state_end(gl);
+		return;
+	}
+
+	wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_VIEWS);
+
+	/* XR shell views cover the whole view, and their clients don't share
+	 * their depth. Views stacked below the topmost one are drawn in
+	 * stacking order, before anything else. */
+	size_t first_2d = 0;
+	for (size_t i = 0; i < scene->nviews; i++) {
+		if (scene->views[i].xr_shell) {
+			first_2d = i + 1;
+		}
+	}
+	render_views_in_order(gl, pass, scene, 0, first_2d);
+
+	if (!gl->quad_layers && !render_2d_views(gl, pass, scene, first_2d)) {
+		render_views_in_order(gl, pass, scene, first_2d, scene->nviews);
+		if (scene->has_cursor) {
+			wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_CURSOR);
+			render_surface(gl, pass, &scene->cursor);
+			render_atlas_flush(gl, pass);
+		}
+	}
+	wxrc_gpu_timer_end(&gl->gpu_timer);
+
+	glDepthMask(GL_TRUE);
+
+	gl_state_end(gl);
+}
+
+void wxrc_gl_render_view(struct wxrc_gl *gl, struct wxrc_scene *scene,
+		uint32_t xr_view_index, mat4 view_matrix, mat4 projection_matrix) {
+	struct render_pass pass = {
+		.programs = &gl->programs,
+		.nviews = 1,
+		.xr_view_index = xr_view_index,
+	};
+	glm_mat4_mul(projection_matrix, view_matrix, pass.vp_matrices[0]);
+
+	render_pass(gl, &pass, scene);
+}
+
+static void get_view_projection_matrix(XrView *xr_view, mat4 vp_matrix) {
 	mat4 view_matrix;
 	wxrc_xr_view_get_matrix(xr_view, view_matrix);
 	glm_mat4_inv(view_matrix, view_matrix);
@@ -448,11 +2218,348 @@ void wxrc_gl_render_xr_view(struct wxrc_server *server, struct wxrc_xr_view *vie
 	mat4 projection_matrix;
 	wxrc_get_projection_matrix(xr_view, projection_matrix);
 
-	wxrc_gl_render_view(server, view, view_matrix, projection_matrix);
+	glm_mat4_mul(projection_matrix, view_matrix, vp_matrix);
+}
+
+/**
+ * Draws an opaque texture over the whole viewport, replacing what's there.
+ */
+static void render_viewport_texture(struct wxrc_gl *gl, GLuint tex) {
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	mat4 mvp_matrix = GLM_MAT4_IDENTITY_INIT;
+	glm_translate(mvp_matrix, (vec3){ -1.0, -1.0, 0.0 });
+	glm_scale(mvp_matrix, (vec3){ 2.0, 2.0, 1.0 });
+
+	gl_state_begin(gl);
+	render_gl_texture(gl, &gl->programs.texture_rgb, GL_TEXTURE_2D, tex,
+		GL_LINEAR, false, false, full_rect, &mvp_matrix, 1);
+	gl_state_end(gl);
+}
+
+static bool foveation_resize(struct wxrc_gl_foveation *fov,
+		uint32_t width, uint32_t height) {
+	if (fov->framebuffer != 0 && fov->width == width &&
+			fov->height == height) {
+		return true;
+	}
+
+	if (fov->framebuffer == 0) {
+		glGenTextures(1, &fov->texture);
+		glGenRenderbuffers(1, &fov->depth_buffer);
+		glGenFramebuffers(1, &fov->framebuffer);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, fov->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+		GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, fov->depth_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16,
+		width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fov->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+		fov->texture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, fov->depth_buffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		wlr_log(WLR_ERROR, "Foveation framebuffer incomplete (0x%X), "
+			"disabling foveation", status);
+		fov->inset_size = 0;
+		return false;
+	}
+
+	fov->width = width;
+	fov->height = height;
+	return true;
+}
+
+/**
+ * Computes the inset rendered at full resolution, centered on the point the
+ * view's optical axis projects to. The FOV is asymmetric, so it's usually
+ * off-center in the image.
+ */
+static void get_foveation_inset(struct wxrc_gl_foveation *fov,
+		const XrFovf *xr_fov, uint32_t width, uint32_t height,
+		GLint *x, GLint *y, GLsizei *inset_width, GLsizei *inset_height) {
+	float tan_left = tanf(xr_fov->angleLeft);
+	float tan_right = tanf(xr_fov->angleRight);
+	float tan_down = tanf(xr_fov->angleDown);
+	float tan_up = tanf(xr_fov->angleUp);
+	float center_x = -tan_left / (tan_right - tan_left) * width;
+	float center_y = -tan_down / (tan_up - tan_down) * height;
+
+	*inset_width = roundf(width * fov->inset_size);
+	*inset_height = roundf(height * fov->inset_size);
+	*x = fmaxf(fminf(roundf(center_x - *inset_width / 2.0),
+		width - *inset_width), 0);
+	*y = fmaxf(fminf(roundf(center_y - *inset_height / 2.0),
+		height - *inset_height), 0);
+}
+
+/**
+ * Narrows a view-projection matrix to the off-axis frustum through the inset,
+ * so that the inset maps to the whole viewport.
+ */
+static void get_inset_projection(const GLint inset[static 4], uint32_t width,
+		uint32_t height, mat4 vp_matrix) {
+	mat4 crop = GLM_MAT4_IDENTITY_INIT;
+	crop[0][0] = (float)width / inset[2];
+	crop[1][1] = (float)height / inset[3];
+	crop[3][0] = ((float)width - 2 * inset[0] - inset[2]) / inset[2];
+	crop[3][1] = ((float)height - 2 * inset[1] - inset[3]) / inset[3];
+	glm_mat4_mul(crop, vp_matrix, vp_matrix);
+}
+
+/**
+ * Renders the view to the periphery framebuffer, and upscales it to
+ * framebuffer around the inset, which is x, y, width and height.
+ */
+static void render_foveation_periphery(struct wxrc_gl *gl,
+		struct render_pass *pass, struct wxrc_scene *scene,
+		uint32_t width, uint32_t height, GLuint framebuffer,
+		const GLint inset[static 4]) {
+	struct wxrc_gl_foveation *fov = &gl->foveation;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fov->framebuffer);
+	glViewport(0, 0, fov->width, fov->height);
+	render_pass(gl, pass, scene);
+
+	/* Only the strips around the inset are upscaled, the inset is
+	 * overwritten by its own pass */
+	GLint w = width, h = height;
+	GLint x1 = inset[0], y1 = inset[1];
+	GLint x2 = inset[0] + inset[2], y2 = inset[1] + inset[3];
+	const GLint strips[4][4] = {
+		{ 0, 0, w, y1 }, // bottom
+		{ 0, y2, w, h - y2 }, // top
+		{ 0, y1, x1, y2 - y1 }, // left
+		{ x2, y1, w - x2, y2 - y1 }, // right
+	};
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, width, height);
+	wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_FOVEATION);
+	glEnable(GL_SCISSOR_TEST);
+	for (size_t i = 0; i < 4; i++) {
+		if (strips[i][2] <= 0 || strips[i][3] <= 0) {
+			continue;
+		}
+		glScissor(strips[i][0], strips[i][1], strips[i][2], strips[i][3]);
+		render_viewport_texture(gl, fov->texture);
+	}
+	glDisable(GL_SCISSOR_TEST);
+	wxrc_gpu_timer_end(&gl->gpu_timer);
+}
+
+void wxrc_gl_render_xr_view(struct wxrc_gl *gl, struct wxrc_scene *scene,
+		uint32_t xr_view_index, XrView *xr_view, uint32_t width,
+		uint32_t height, GLuint framebuffer, GLuint image,
+		GLuint depth_buffer) {
+	struct render_pass pass = {
+		.programs = &gl->programs,
+		.nviews = 1,
+		.xr_view_index = xr_view_index,
+	};
+	get_view_projection_matrix(xr_view, pass.vp_matrices[0]);
+
+	struct wxrc_gl_foveation *fov = &gl->foveation;
+	bool foveated = fov->inset_size > 0 && foveation_resize(fov,
+		fmaxf(roundf(width * fov->periphery_scale), 1),
+		fmaxf(roundf(height * fov->periphery_scale), 1));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+		image, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+		depth_buffer, 0);
+
+	if (!foveated) {
+		glViewport(0, 0, width, height);
+		render_pass(gl, &pass, scene);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return;
+	}
+
+	GLint inset[4];
+	get_foveation_inset(fov, &xr_view->fov, width, height,
+		&inset[0], &inset[1], &inset[2], &inset[3]);
+	render_foveation_periphery(gl, &pass, scene, width, height, framebuffer,
+		inset);
+
+	/* Only the sub-frustum through the inset is rendered, so surfaces
+	 * outside of it are culled. The clear ignores the viewport, the
+	 * scissor test limits it to the inset. */
+	get_inset_projection(inset, width, height, pass.vp_matrices[0]);
+	glViewport(inset[0], inset[1], inset[2], inset[3]);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(inset[0], inset[1], inset[2], inset[3]);
+	render_pass(gl, &pass, scene);
+	glDisable(GL_SCISSOR_TEST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void wxrc_gl_render_xr_multiview(struct wxrc_gl *gl, struct wxrc_scene *scene,
+		XrView *xr_views, uint32_t width, uint32_t height,
+		GLuint framebuffer, const GLuint *layer_framebuffers) {
+	glViewport(0, 0, width, height);
+
+	if (!gl->multiview) {
+		/* The multiview programs aren't ready, render each layer on
+		 * its own */
+		for (uint32_t i = 0; i < WXRC_GL_MULTIVIEW_NVIEWS; i++) {
+			glBindFramebuffer(GL_FRAMEBUFFER, layer_framebuffers[i]);
+			struct render_pass pass = {
+				.programs = &gl->programs,
+				.nviews = 1,
+				.xr_view_index = i,
+			};
+			get_view_projection_matrix(&xr_views[i], pass.vp_matrices[0]);
+			render_pass(gl, &pass, scene);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	struct render_pass pass = {
+		.programs = &gl->multiview_programs,
+		.nviews = WXRC_GL_MULTIVIEW_NVIEWS,
+		.framebuffer = framebuffer,
+		.layer_framebuffers = layer_framebuffers,
+	};
+	for (uint32_t i = 0; i < pass.nviews; i++) {
+		get_view_projection_matrix(&xr_views[i], pass.vp_matrices[i]);
+	}
+
+	render_pass(gl, &pass, scene);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool wxrc_gl_get_surface_bounds(mat4 inv_pose_matrix,
+		struct wxrc_scene_surface *surfaces, size_t nsurfaces,
+		int *x1, int *y1, int *x2, int *y2) {
+	float min_x = INFINITY, min_y = INFINITY;
+	float max_x = -INFINITY, max_y = -INFINITY;
+	for (size_t i = 0; i < nsurfaces; i++) {
+		mat4 matrix;
+		glm_mat4_mul(inv_pose_matrix, surfaces[i].model_matrix, matrix);
+
+		vec3 corners[2];
+		glm_mat4_mulv3(matrix, (vec3){ 0.0, 0.0, 0.0 }, 1.0, corners[0]);
+		glm_mat4_mulv3(matrix, (vec3){ 1.0, 1.0, 0.0 }, 1.0, corners[1]);
+		for (size_t j = 0; j < 2; j++) {
+			min_x = fminf(min_x, corners[j][0]);
+			min_y = fminf(min_y, corners[j][1]);
+			max_x = fmaxf(max_x, corners[j][0]);
+			max_y = fmaxf(max_y, corners[j][1]);
+		}
+	}
+
+	/* Rounded so that moving a view doesn't look like a content change */
+	*x1 = roundf(min_x * WXRC_SURFACE_SCALE);
+	*y1 = roundf(min_y * WXRC_SURFACE_SCALE);
+	*x2 = roundf(max_x * WXRC_SURFACE_SCALE);
+	*y2 = roundf(max_y * WXRC_SURFACE_SCALE);
+	return *x1 < *x2 && *y1 < *y2;
+}
+
+void wxrc_gl_get_bounds_vp_matrix(mat4 inv_pose_matrix, int x1, int y1,
+		int x2, int y2, mat4 vp_matrix) {
+	glm_mat4_identity(vp_matrix);
+	glm_scale(vp_matrix, (vec3){ 2.0 / (x2 - x1), 2.0 / (y2 - y1), 1.0 });
+	glm_translate(vp_matrix, (vec3){
+		-(x1 + x2) / 2.0, -(y1 + y2) / 2.0, 0.0 });
+	glm_scale(vp_matrix, (vec3){
+		WXRC_SURFACE_SCALE, WXRC_SURFACE_SCALE, 1.0 });
+	glm_mat4_mul(vp_matrix, inv_pose_matrix, vp_matrix);
+}
+
+void wxrc_gl_render_quad(struct wxrc_gl *gl,
+		struct wxrc_scene_surface *surfaces, size_t nsurfaces, mat4 vp_matrix,
+		GLuint framebuffer, GLuint image, uint32_t width, uint32_t height) {
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	glViewport(0, 0, width, height);
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+		image, 0);
+
+	/* Surfaces of a view are coplanar and drawn in order, no need for a
+	 * depth buffer */
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	struct render_pass pass = {
+		.programs = &gl->programs,
+		.nviews = 1,
+	};
+	glm_mat4_copy(vp_matrix, pass.vp_matrices[0]);
+
+	wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_QUADS);
+	gl_state_begin(gl);
+	for (size_t i = 0; i < nsurfaces; i++) {
+		render_surface(gl, &pass, &surfaces[i]);
+	}
+	render_atlas_flush(gl, &pass);
+	gl_state_end(gl);
+	wxrc_gpu_timer_end(&gl->gpu_timer);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void wxrc_gl_render_mirror_copy(struct wxrc_gl *gl, GLuint image,
+		uint32_t width, uint32_t height, uint32_t image_width,
+		uint32_t image_height, GLuint framebuffer, uint32_t copy_width,
+		uint32_t copy_height) {
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	/* Stretch the whole image so that the rendered rectangle covers the
+	 * copy, the rest is clipped */
+	glViewport(0, 0, copy_width * image_width / width,
+		copy_height * image_height / height);
+	wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_MIRROR);
+	render_viewport_texture(gl, image);
+	wxrc_gpu_timer_end(&gl->gpu_timer);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void wxrc_gl_render_mirror(struct wxrc_gl *gl, GLuint texture,
+		uint32_t copy_width, uint32_t copy_height, uint32_t width,
+		uint32_t height) {
+	wxrc_gpu_timer_begin(&gl->gpu_timer, WXRC_GPU_PASS_MIRROR);
+
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	float scale = fminf((float)width / copy_width,
+		(float)height / copy_height);
+	GLsizei viewport_width = roundf(copy_width * scale);
+	GLsizei viewport_height = roundf(copy_height * scale);
+	glViewport((width - viewport_width) / 2, (height - viewport_height) / 2,
+		viewport_width, viewport_height);
+	render_viewport_texture(gl, texture);
+
+	wxrc_gpu_timer_end(&gl->gpu_timer);
+}
+
 void wxrc_get_projection_matrix(XrView *xr_view, mat4 projection_matrix) {
-	wxrc_xr_projection_from_fov(&xr_view->fov, 0.05, 100.0, projection_matrix);
+	wxrc_xr_projection_from_fov(&xr_view->fov, WXRC_GL_NEAR_Z, WXRC_GL_FAR_Z,
+		projection_matrix);
 }
@@ -0,0 +1,68 @@
+#include <math.h>
+#include "resolution.h"
+
+#define MIN_SCALE 0.5
+/* Scale down above this fraction of the display period, aiming for the
+ * target fraction */
+#define HIGH_LOAD 0.75
+#define TARGET_LOAD 0.6
+/* Scale up after this many frames below the low load fraction */
+#define LOW_LOAD 0.45
+#define HEADROOM_FRAMES 90
+#define SCALE_UP_STEP 1.1
+
+void wxrc_resolution_governor_init(struct wxrc_resolution_governor *gov) {
+	gov->scale = 1.0;
+	gov->gpu_estimate_ns = 0;
+	gov->headroom_frames = 0;
+}
+
+static void set_scale(struct wxrc_resolution_governor *gov, float scale) {
+	/* Fill cost is proportional to the area, assume it's the bulk of the
+	 * GPU time */
+	float ratio = scale / gov->scale;
+	gov->gpu_estimate_ns *= ratio * ratio;
+	gov->scale = scale;
+	gov->headroom_frames = 0;
+}
+
+bool wxrc_resolution_governor_report(struct wxrc_resolution_governor *gov,
+		int64_t gpu_ns, int64_t display_period_ns) {
+	if (display_period_ns <= 0) {
+		return false;
+	}
+
+	if (gpu_ns > gov->gpu_estimate_ns) {
+		gov->gpu_estimate_ns = gpu_ns;
+	} else {
+		gov->gpu_estimate_ns -= (gov->gpu_estimate_ns - gpu_ns) / 8;
+	}
+
+	float load = (float)gov->gpu_estimate_ns / display_period_ns;
+	if (load > HIGH_LOAD) {
+		if (gov->scale <= MIN_SCALE) {
+			return false;
+		}
+		float scale = gov->scale * sqrtf(TARGET_LOAD / load);
+		set_scale(gov, fmaxf(scale, MIN_SCALE));
+		return true;
+	}
+
+	if (load > LOW_LOAD || gov->scale >= 1.0) {
+		gov->headroom_frames = 0;
+		return false;
+	}
+	gov->headroom_frames++;
+	if (gov->headroom_frames < HEADROOM_FRAMES) {
+		return false;
+	}
+	set_scale(gov, fminf(gov->scale * SCALE_UP_STEP, 1.0));
+	return true;
+}
+
+void wxrc_resolution_governor_get_size(struct wxrc_resolution_governor *gov,
+		uint32_t max_width, uint32_t max_height, uint32_t *width,
+		uint32_t *height) {
+	*width = fmaxf(roundf(max_width * gov->scale), 1);
+	*height = fmaxf(roundf(max_height * gov->scale), 1);
+}
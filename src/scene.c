@@ -0,0 +1,382 @@
+#include <float.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+#include "backend.h"
+#include "scene.h"
+#include "server.h"
+#include "surface.h"
+#include "view.h"
+
+struct deferred_texture {
+	struct wlr_texture *texture;
+	/* Scenes older than this one may still reference the texture */
+	uint64_t seq;
+	struct wl_list link; // wxrc_server.deferred_textures
+};
+
+static bool ensure_capacity(void **data, size_t *cap, size_t n, size_t size) {
+	if (n < *cap) {
+		return true;
+	}
+	size_t new_cap = *cap == 0 ? 16 : *cap * 2;
+	void *new_data = realloc(*data, new_cap * size);
+	if (new_data == NULL) {
+		wlr_log_errno(WLR_ERROR, "realloc failed");
+		return false;
+	}
+	*data = new_data;
+	*cap = new_cap;
+	return true;
+}
+
+static bool scene_add_buffer(struct wxrc_scene *scene,
+		struct wlr_buffer *buffer) {
+	if (!ensure_capacity((void **)&scene->buffers, &scene->buffers_cap,
+			scene->nbuffers, sizeof(scene->buffers[0]))) {
+		return false;
+	}
+	scene->buffers[scene->nbuffers++] = wlr_buffer_ref(buffer);
+	return true;
+}
+
+static struct wxrc_scene_surface *scene_add_surface(struct wxrc_scene *scene) {
+	if (!ensure_capacity((void **)&scene->surfaces, &scene->surfaces_cap,
+			scene->nsurfaces, sizeof(scene->surfaces[0]))) {
+		return NULL;
+	}
+	return &scene->surfaces[scene->nsurfaces++];
+}
+
+static struct wxrc_scene_view *scene_add_view(struct wxrc_scene *scene) {
+	if (!ensure_capacity((void **)&scene->views, &scene->views_cap,
+			scene->nviews, sizeof(scene->views[0]))) {
+		return NULL;
+	}
+	struct wxrc_scene_view *scene_view = &scene->views[scene->nviews++];
+	memset(scene_view, 0, sizeof(*scene_view));
+	return scene_view;
+}
+
+/**
+ * Fills the cache state of a scene surface from its wxrc_surface.
+ */
+static void scene_surface_init_cache(struct wxrc_scene_surface *scene_surface,
+		struct wlr_surface *wlr_surface) {
+	scene_surface->width = wlr_surface->current.buffer_width;
+	scene_surface->height = wlr_surface->current.buffer_height;
+
+	struct wxrc_surface *surface = wxrc_surface_from_wlr_surface(wlr_surface);
+	if (surface == NULL) {
+		scene_surface->id = 0;
+		scene_surface->commit_seq = 0;
+		memset(scene_surface->damage, 0, sizeof(scene_surface->damage));
+		scene_surface->opaque = (struct wlr_box){0};
+		return;
+	}
+
+	scene_surface->id = surface->id;
+	scene_surface->commit_seq = surface->commit_seq;
+	memcpy(scene_surface->damage, surface->damage,
+		sizeof(scene_surface->damage));
+	wxrc_surface_get_opaque_box(surface, &scene_surface->opaque);
+}
+
+struct scene_view_data {
+	struct wxrc_scene *scene;
+	struct wxrc_view *view;
+	uint64_t commit_seq;
+	bool untracked;
+};
+
+static void scene_surface_iterator(struct wlr_surface *surface,
+		int sx, int sy, void *_data) {
+	struct scene_view_data *data = _data;
+
+	if (surface->buffer == NULL || surface->buffer->texture == NULL) {
+		return;
+	}
+
+	if (!scene_add_buffer(data->scene, surface->buffer)) {
+		return;
+	}
+	struct wxrc_scene_surface *scene_surface = scene_add_surface(data->scene);
+	if (scene_surface == NULL) {
+		return;
+	}
+
+	scene_surface->texture = surface->buffer->texture;
+	wxrc_view_get_2d_model_matrix(data->view, surface, sx, sy,
+		scene_surface->model_matrix);
+	scene_surface_init_cache(scene_surface, surface);
+
+	if (scene_surface->commit_seq == 0) {
+		data->untracked = true;
+	} else if (scene_surface->commit_seq > data->commit_seq) {
+		data->commit_seq = scene_surface->commit_seq;
+	}
+}
+
+static void scene_view_update_bounds(struct wxrc_scene *scene,
+		struct wxrc_scene_view *scene_view) {
+	vec3 box[2] = {
+		{ FLT_MAX, FLT_MAX, FLT_MAX },
+		{ -FLT_MAX, -FLT_MAX, -FLT_MAX },
+	};
+	for (size_t i = 0; i < scene_view->nsurfaces; i++) {
+		struct wxrc_scene_surface *surface =
+			&scene->surfaces[scene_view->first_surface + i];
+		for (int j = 0; j < 4; j++) {
+			vec3 corner;
+			glm_mat4_mulv3(surface->model_matrix,
+				(vec3){ j % 2, j / 2, 0.0 }, 1.0, corner);
+			glm_vec3_minv(box[0], corner, box[0]);
+			glm_vec3_maxv(box[1], corner, box[1]);
+		}
+	}
+
+	if (scene_view->nsurfaces == 0) {
+		glm_vec3_zero(scene_view->bounds_center);
+		scene_view->bounds_radius = 0.0;
+		return;
+	}
+	glm_vec3_center(box[0], box[1], scene_view->bounds_center);
+	scene_view->bounds_radius = glm_vec3_distance(box[0], box[1]) / 2.0;
+}
+
+static void scene_add_2d_view(struct wxrc_scene *scene,
+		struct wxrc_view *view) {
+	struct wxrc_scene_view *scene_view = scene_add_view(scene);
+	if (scene_view == NULL) {
+		return;
+	}
+	size_t first_surface = scene->nsurfaces;
+
+	struct scene_view_data data = {
+		.scene = scene,
+		.view = view,
+	};
+	wxrc_view_for_each_surface(view, scene_surface_iterator, &data);
+
+	scene_view->first_surface = first_surface;
+	scene_view->nsurfaces = scene->nsurfaces - first_surface;
+	scene_view->id = view->id;
+	scene_view->commit_seq = data.untracked ? 0 : data.commit_seq;
+	wxrc_view_get_model_matrix(view, scene_view->pose_matrix);
+	scene_view_update_bounds(scene, scene_view);
+}
+
+static void scene_add_xr_shell_view(struct wxrc_scene *scene,
+		struct wxrc_server *server, struct wxrc_view *view) {
+	struct wlr_buffer *buffer = view->surface->buffer;
+	if (buffer == NULL) {
+		return;
+	}
+
+	struct wxrc_scene_view *scene_view = scene_add_view(scene);
+	if (scene_view == NULL) {
+		return;
+	}
+	scene_view->xr_shell = true;
+
+	/* TODO: Test for other kinds of buffers */
+	struct wxrc_zxr_composite_buffer_v1 *comp_buffer =
+		wxrc_zxr_composite_buffer_v1_from_buffer(buffer);
+	struct wxrc_xr_backend *backend = server->xr_backend;
+	for (uint32_t i = 0; i < backend->nviews &&
+			i < WXRC_SCENE_MAX_XR_VIEWS; i++) {
+		struct wlr_buffer *view_buffer =
+			wxrc_zxr_composite_buffer_v1_buffer_for_view(comp_buffer,
+				backend->views[i].wl_view,
+				ZXR_COMPOSITE_BUFFER_V1_BUFFER_TYPE_PIXEL_BUFFER);
+		if (view_buffer == NULL || view_buffer->texture == NULL) {
+			continue;
+		}
+		if (!scene_add_buffer(scene, view_buffer)) {
+			continue;
+		}
+		scene_view->xr_textures[i] = view_buffer->texture;
+	}
+}
+
+static void scene_add_cursor(struct wxrc_scene *scene,
+		struct wxrc_server *server) {
+	struct wxrc_cursor *cursor = &server->cursor;
+
+	int hotspot_x, hotspot_y, scale;
+	struct wlr_texture *tex = wxrc_cursor_get_texture(cursor,
+		&hotspot_x, &hotspot_y, &scale);
+	if (tex == NULL) {
+		return;
+	}
+
+	if (cursor->surface != NULL && cursor->surface->buffer != NULL &&
+			cursor->surface->buffer->texture == tex) {
+		if (!scene_add_buffer(scene, cursor->surface->buffer)) {
+			return;
+		}
+	}
+
+	int width, height;
+	wlr_texture_get_size(tex, &width, &height);
+
+	float scale_x = (float)width / WXRC_SURFACE_SCALE / scale;
+	float scale_y = (float)height / WXRC_SURFACE_SCALE / scale;
+
+	glm_mat4_copy(cursor->matrix, scene->cursor_pose_matrix);
+
+	mat4 model_matrix;
+	glm_mat4_copy(cursor->matrix, model_matrix);
+	glm_scale(model_matrix, (vec3){ scale_x, scale_y, 1.0 });
+
+	/* Re-origin the cursor to the center and apply hotspot */
+	glm_translate(model_matrix, (vec3){
+		-(float)hotspot_x / width,
+		-1.0 + (float)hotspot_y / height, 0 });
+
+	/* Cursor images don't always come from a surface, and can change
+	 * without a commit */
+	scene->cursor = (struct wxrc_scene_surface){
+		.texture = tex,
+		.width = width,
+		.height = height,
+	};
+	glm_mat4_copy(model_matrix, scene->cursor.model_matrix);
+	scene->has_cursor = true;
+}
+
+struct wxrc_scene *wxrc_scene_create(struct wxrc_server *server) {
+	struct wxrc_scene *scene = calloc(1, sizeof(*scene));
+	if (scene == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return NULL;
+	}
+	scene->seq = server->scene_seq++;
+	wl_list_insert(server->scenes.prev, &scene->link);
+	server->scene_dirty = false;
+
+	struct wxrc_view *view;
+	wl_list_for_each_reverse(view, &server->views, link) {
+		if (!view->mapped) {
+			continue;
+		}
+		if (wxrc_view_is_xr_shell(view)) {
+			scene_add_xr_shell_view(scene, server, view);
+		} else {
+			scene_add_2d_view(scene, view);
+		}
+	}
+
+	if (server->seat->pointer_state.focused_surface != NULL) {
+		scene_add_cursor(scene, server);
+	}
+
+	return scene;
+}
+
+static void destroy_deferred_textures(struct wxrc_server *server) {
+	uint64_t oldest_seq = server->scene_seq;
+	if (!wl_list_empty(&server->scenes)) {
+		struct wxrc_scene *oldest =
+			wl_container_of(server->scenes.next, oldest, link);
+		oldest_seq = oldest->seq;
+	}
+
+	struct deferred_texture *deferred, *tmp;
+	wl_list_for_each_safe(deferred, tmp, &server->deferred_textures, link) {
+		if (deferred->seq > oldest_seq) {
+			continue;
+		}
+		wlr_texture_destroy(deferred->texture);
+		wl_list_remove(&deferred->link);
+		free(deferred);
+	}
+}
+
+void wxrc_scene_destroy(struct wxrc_server *server, struct wxrc_scene *scene) {
+	if (scene == NULL) {
+		return;
+	}
+
+	/* Replaced before the render thread latched it */
+	wxrc_xr_backend_destroy_fence(server->xr_backend, scene->fence);
+	for (size_t i = 0; i < scene->nbuffers; i++) {
+		wlr_buffer_unref(scene->buffers[i]);
+	}
+	wl_list_remove(&scene->link);
+	free(scene->buffers);
+	free(scene->surfaces);
+	free(scene->views);
+	free(scene);
+
+	destroy_deferred_textures(server);
+}
+
+bool wxrc_scene_surface_changed(const struct wxrc_scene_surface *surface,
+		uint64_t seen_commit_seq) {
+	return surface->commit_seq == 0 || surface->commit_seq != seen_commit_seq;
+}
+
+bool wxrc_scene_surface_get_damage(const struct wxrc_scene_surface *surface,
+		uint64_t seen_commit_seq, struct wlr_box *damage) {
+	if (surface->commit_seq == 0 || seen_commit_seq == 0) {
+		return false;
+	}
+
+	/* Walk back the commits from the current state to the seen one */
+	int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+	uint64_t commit_seq = surface->commit_seq;
+	for (size_t i = 0; i < WXRC_SURFACE_DAMAGE_HISTORY &&
+			commit_seq != seen_commit_seq; i++) {
+		const struct wxrc_surface_damage *commit = &surface->damage[i];
+		if (commit->commit_seq != commit_seq) {
+			return false;
+		}
+		const struct wlr_box *box = &commit->box;
+		if (box->width > 0 && box->height > 0) {
+			x1 = box->x < x1 ? box->x : x1;
+			y1 = box->y < y1 ? box->y : y1;
+			x2 = box->x + box->width > x2 ? box->x + box->width : x2;
+			y2 = box->y + box->height > y2 ? box->y + box->height : y2;
+		}
+		commit_seq = commit->prev_commit_seq;
+	}
+	if (commit_seq != seen_commit_seq) {
+		/* Older than the history */
+		return false;
+	}
+
+	*damage = (struct wlr_box){0};
+	if (x1 < x2 && y1 < y2) {
+		*damage = (struct wlr_box){
+			.x = x1,
+			.y = y1,
+			.width = x2 - x1,
+			.height = y2 - y1,
+		};
+	}
+	return true;
+}
+
+void wxrc_scene_defer_texture_destroy(struct wxrc_server *server,
+		struct wlr_texture *texture) {
+	if (texture == NULL) {
+		return;
+	}
+
+	struct deferred_texture *deferred = calloc(1, sizeof(*deferred));
+	if (deferred == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		/* Leaking is better than a use-after-free on the render thread */
+		return;
+	}
+	deferred->texture = texture;
+	deferred->seq = server->scene_seq;
+	wl_list_insert(&server->deferred_textures, &deferred->link);
+
+	destroy_deferred_textures(server);
+}
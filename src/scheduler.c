@@ -0,0 +1,90 @@
+#include "scheduler.h"
+
+/* Used until we've measured a frame */
+#define INITIAL_RENDER_ESTIMATE_NS 4000000
+#define DEFAULT_MARGIN_NS 1500000
+/* Added to the margin on each missed frame, and taken back after a while
+ * without any */
+#define MARGIN_STEP_NS 1000000
+#define ONTIME_FRAMES 300
+
+void wxrc_frame_scheduler_init(struct wxrc_frame_scheduler *sched) {
+	sched->render_estimate_ns = INITIAL_RENDER_ESTIMATE_NS;
+	sched->margin_ns = DEFAULT_MARGIN_NS;
+	sched->ontime_frames = 0;
+	sched->display_offset_ns = 0;
+	sched->last_display_ns = 0;
+}
+
+/**
+ * The runtime skips display slots when a frame is submitted too late for its
+ * display time.
+ */
+static void update_margin(struct wxrc_frame_scheduler *sched,
+		int64_t display_ns, int64_t display_period_ns) {
+	int64_t last_display_ns = sched->last_display_ns;
+	sched->last_display_ns = display_ns;
+	if (last_display_ns == 0) {
+		return;
+	}
+
+	if (display_ns - last_display_ns > display_period_ns * 3 / 2) {
+		sched->ontime_frames = 0;
+		if (sched->margin_ns + MARGIN_STEP_NS < display_period_ns / 2) {
+			sched->margin_ns += MARGIN_STEP_NS;
+		}
+		return;
+	}
+
+	sched->ontime_frames++;
+	if (sched->ontime_frames >= ONTIME_FRAMES &&
+			sched->margin_ns > DEFAULT_MARGIN_NS) {
+		sched->ontime_frames = 0;
+		sched->margin_ns -= MARGIN_STEP_NS;
+	}
+}
+
+/**
+ * Returns when the frame would have begun if the runtime had woken us up on
+ * time. xrWaitFrame returns late by a varying amount, the display time
+ * doesn't.
+ */
+static int64_t get_frame_begin(struct wxrc_frame_scheduler *sched,
+		int64_t frame_begin_ns, int64_t display_ns) {
+	int64_t offset_ns = display_ns - frame_begin_ns;
+	if (sched->display_offset_ns == 0 || offset_ns > sched->display_offset_ns) {
+		sched->display_offset_ns = offset_ns;
+	} else {
+		sched->display_offset_ns -= (sched->display_offset_ns - offset_ns) / 64;
+	}
+	return display_ns - sched->display_offset_ns;
+}
+
+int64_t wxrc_frame_scheduler_get_latch_deadline(
+		struct wxrc_frame_scheduler *sched, int64_t frame_begin_ns,
+		int64_t display_ns, int64_t display_period_ns) {
+	int64_t begin_ns = frame_begin_ns;
+	if (display_ns != 0) {
+		update_margin(sched, display_ns, display_period_ns);
+		begin_ns = get_frame_begin(sched, frame_begin_ns, display_ns);
+	}
+
+	int64_t deadline = begin_ns + display_period_ns -
+		sched->render_estimate_ns - sched->margin_ns;
+	if (deadline < frame_begin_ns) {
+		/* We're already late, don't wait for clients at all */
+		return frame_begin_ns;
+	}
+	return deadline;
+}
+
+void wxrc_frame_scheduler_report_render(struct wxrc_frame_scheduler *sched,
+		int64_t render_ns) {
+	if (render_ns > sched->render_estimate_ns) {
+		/* Missing a frame is worse than a late commit: jump up right away */
+		sched->render_estimate_ns = render_ns;
+	} else {
+		sched->render_estimate_ns -=
+			(sched->render_estimate_ns - render_ns) / 16;
+	}
+}
@@ -0,0 +1,143 @@
+#include <pixman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+#include "server.h"
+#include "surface.h"
+
+/**
+ * Counts how a committed shm buffer was uploaded. wlr_surface only uploads the
+ * damage into the previous texture if nothing else references the previous
+ * wlr_buffer, but scenes do until the render thread is done with them. It
+ * creates a new wlr_buffer otherwise.
+ */
+static void surface_count_upload(struct wxrc_surface *surface) {
+	struct wlr_surface *wlr_surface = surface->wlr_surface;
+	const struct wlr_buffer *prev = surface->buffer;
+	surface->buffer = wlr_surface->buffer;
+
+	/* shm buffers are released as soon as they're uploaded */
+	if (!(wlr_surface->current.committed & WLR_SURFACE_STATE_BUFFER) ||
+			wlr_surface->buffer == NULL || !wlr_surface->buffer->released ||
+			prev == NULL ||
+			!pixman_region32_not_empty(&wlr_surface->buffer_damage)) {
+		return;
+	}
+	if (wlr_surface->buffer == prev) {
+		surface->server->damage_uploads++;
+	} else {
+		surface->server->full_uploads++;
+	}
+}
+
+static void surface_handle_commit(struct wl_listener *listener, void *data) {
+	struct wxrc_surface *surface = wl_container_of(listener, surface, commit);
+	struct wlr_surface *wlr_surface = surface->wlr_surface;
+	surface->server->scene_dirty = true;
+
+	memmove(&surface->damage[1], &surface->damage[0],
+		(WXRC_SURFACE_DAMAGE_HISTORY - 1) * sizeof(surface->damage[0]));
+	struct wxrc_surface_damage *damage = &surface->damage[0];
+	damage->prev_commit_seq = surface->commit_seq;
+	surface->commit_seq = ++surface->server->commit_seq;
+	damage->commit_seq = surface->commit_seq;
+
+	int width = wlr_surface->current.buffer_width;
+	int height = wlr_surface->current.buffer_height;
+	if (width != surface->width || height != surface->height) {
+		surface->width = width;
+		surface->height = height;
+		surface->buffer = wlr_surface->buffer;
+		damage->box = (struct wlr_box){ .width = width, .height = height };
+		return;
+	}
+	surface_count_upload(surface);
+
+	pixman_region32_t clipped;
+	pixman_region32_init(&clipped);
+	pixman_region32_intersect_rect(&clipped, &wlr_surface->buffer_damage,
+		0, 0, width, height);
+	pixman_box32_t *extents = pixman_region32_extents(&clipped);
+	damage->box = (struct wlr_box){
+		.x = extents->x1,
+		.y = extents->y1,
+		.width = extents->x2 - extents->x1,
+		.height = extents->y2 - extents->y1,
+	};
+	pixman_region32_fini(&clipped);
+}
+
+static void surface_handle_destroy(struct wl_listener *listener, void *data) {
+	struct wxrc_surface *surface = wl_container_of(listener, surface, destroy);
+	surface->server->scene_dirty = true;
+	surface->wlr_surface->data = NULL;
+	wl_list_remove(&surface->commit.link);
+	wl_list_remove(&surface->destroy.link);
+	free(surface);
+}
+
+static void handle_new_surface(struct wl_listener *listener, void *data) {
+	struct wxrc_server *server =
+		wl_container_of(listener, server, new_surface);
+	struct wlr_surface *wlr_surface = data;
+
+	struct wxrc_surface *surface = calloc(1, sizeof(*surface));
+	if (surface == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return;
+	}
+	surface->server = server;
+	surface->wlr_surface = wlr_surface;
+	surface->id = ++server->last_surface_id;
+	surface->commit_seq = ++server->commit_seq;
+
+	surface->commit.notify = surface_handle_commit;
+	wl_signal_add(&wlr_surface->events.commit, &surface->commit);
+	surface->destroy.notify = surface_handle_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &surface->destroy);
+
+	wlr_surface->data = surface;
+}
+
+void wxrc_surface_init(struct wxrc_server *server) {
+	server->new_surface.notify = handle_new_surface;
+	wl_signal_add(&server->compositor->events.new_surface,
+		&server->new_surface);
+}
+
+struct wxrc_surface *wxrc_surface_from_wlr_surface(
+		struct wlr_surface *wlr_surface) {
+	return wlr_surface->data;
+}
+
+void wxrc_surface_get_opaque_box(struct wxrc_surface *surface,
+		struct wlr_box *box) {
+	struct wlr_surface *wlr_surface = surface->wlr_surface;
+
+	int nrects;
+	pixman_box32_t *rects =
+		pixman_region32_rectangles(&wlr_surface->opaque_region, &nrects);
+	int64_t best_area = 0;
+	*box = (struct wlr_box){0};
+	for (int i = 0; i < nrects; i++) {
+		int64_t area = (int64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+		if (area <= best_area) {
+			continue;
+		}
+		best_area = area;
+		box->x = rects[i].x1;
+		box->y = rects[i].y1;
+		box->width = rects[i].x2 - rects[i].x1;
+		box->height = rects[i].y2 - rects[i].y1;
+	}
+
+	/* The opaque region is in surface-local coordinates */
+	int scale = wlr_surface->current.scale;
+	box->x *= scale;
+	box->y *= scale;
+	box->width *= scale;
+	box->height *= scale;
+}
@@ -0,0 +1,261 @@
+#define _POSIX_C_SOURCE 200112L
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/util/log.h>
+#include "timing.h"
+
+static const char *phase_names[WXRC_FRAME_PHASE_COUNT] = {
+	[WXRC_FRAME_PHASE_WAIT_FRAME] = "wait frame",
+	[WXRC_FRAME_PHASE_POLL_EVENTS] = "poll events",
+	[WXRC_FRAME_PHASE_LATCH_WAIT] = "latch wait",
+	[WXRC_FRAME_PHASE_PUSH_FRAME] = "push frame",
+	[WXRC_FRAME_PHASE_GPU_WAIT] = "gpu wait",
+};
+
+static const char *gpu_pass_names[WXRC_GPU_PASS_COUNT] = {
+	[WXRC_GPU_PASS_COPIES] = "gpu copies",
+	[WXRC_GPU_PASS_GRID] = "gpu grid",
+	[WXRC_GPU_PASS_VIEWS] = "gpu views",
+	[WXRC_GPU_PASS_CURSOR] = "gpu cursor",
+	[WXRC_GPU_PASS_FOVEATION] = "gpu foveation",
+	[WXRC_GPU_PASS_QUADS] = "gpu quads",
+	[WXRC_GPU_PASS_MIRROR] = "gpu mirror",
+};
+
+static const char *counter_names[WXRC_FRAME_COUNTER_COUNT] = {
+	[WXRC_FRAME_COUNTER_PARTIAL_COPIES] = "partial copies",
+	[WXRC_FRAME_COUNTER_FULL_COPIES] = "full copies",
+};
+
+int64_t wxrc_get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct wxrc_frame_timing *current_frame(
+		struct wxrc_frame_timings *timings) {
+	/* Only the writer calls this, so a relaxed load is enough */
+	uint64_t head = atomic_load_explicit(&timings->head, memory_order_relaxed);
+	return &timings->frames[head % WXRC_FRAME_TIMING_HISTORY];
+}
+
+void wxrc_frame_timing_begin(struct wxrc_frame_timings *timings) {
+	struct wxrc_frame_timing *frame = current_frame(timings);
+	memset(frame, 0, sizeof(*frame));
+	frame->begin_ns = wxrc_get_time_ns();
+}
+
+void wxrc_frame_timing_phase_begin(struct wxrc_frame_timings *timings,
+		enum wxrc_frame_phase phase) {
+	struct wxrc_frame_timing *frame = current_frame(timings);
+	frame->phase_begin_ns[phase] = wxrc_get_time_ns();
+}
+
+void wxrc_frame_timing_phase_end(struct wxrc_frame_timings *timings,
+		enum wxrc_frame_phase phase) {
+	struct wxrc_frame_timing *frame = current_frame(timings);
+	/* Phases may run several times per frame, accumulate them */
+	frame->phase_ns[phase] += wxrc_get_time_ns() - frame->phase_begin_ns[phase];
+}
+
+void wxrc_frame_timing_set_gpu_passes(struct wxrc_frame_timings *timings,
+		const int64_t pass_ns[static WXRC_GPU_PASS_COUNT]) {
+	struct wxrc_frame_timing *frame = current_frame(timings);
+	memcpy(frame->gpu_pass_ns, pass_ns, sizeof(frame->gpu_pass_ns));
+	frame->has_gpu_passes = true;
+}
+
+void wxrc_frame_timing_count(struct wxrc_frame_timings *timings,
+		const int64_t counters[static WXRC_FRAME_COUNTER_COUNT]) {
+	struct wxrc_frame_timing *frame = current_frame(timings);
+	for (size_t i = 0; i < WXRC_FRAME_COUNTER_COUNT; i++) {
+		frame->counters[i] += counters[i];
+	}
+}
+
+void wxrc_frame_timing_set_foveation(struct wxrc_frame_timings *timings,
+		float inset_size, float periphery_scale) {
+	struct wxrc_frame_timing *frame = current_frame(timings);
+	frame->foveation_inset_size = inset_size;
+	frame->foveation_periphery_scale = periphery_scale;
+}
+
+void wxrc_frame_timing_end(struct wxrc_frame_timings *timings,
+		int64_t predicted_display_time, int64_t predicted_display_period) {
+	struct wxrc_frame_timing *frame = current_frame(timings);
+	frame->end_ns = wxrc_get_time_ns();
+	frame->predicted_display_time = predicted_display_time;
+	frame->predicted_display_period = predicted_display_period;
+	atomic_fetch_add_explicit(&timings->head, 1, memory_order_release);
+}
+
+static uint64_t first_valid_frame(uint64_t head) {
+	/* The slot of the frame being written aliases the oldest one */
+	if (head + 1 > WXRC_FRAME_TIMING_HISTORY) {
+		return head + 1 - WXRC_FRAME_TIMING_HISTORY;
+	}
+	return 0;
+}
+
+/**
+ * Copies the completed frames into dest, oldest first, without blocking the
+ * writer. Returns the number of frames copied.
+ */
+static size_t timings_snapshot(struct wxrc_frame_timings *timings,
+		struct wxrc_frame_timing *dest) {
+	uint64_t head_before =
+		atomic_load_explicit(&timings->head, memory_order_acquire);
+	uint64_t first = first_valid_frame(head_before);
+
+	size_t n = 0;
+	for (uint64_t i = first; i < head_before; i++) {
+		size_t slot = i % WXRC_FRAME_TIMING_HISTORY;
+		memcpy(&dest[n++], &timings->frames[slot], sizeof(dest[0]));
+	}
+
+	/* Drop the frames the writer may have overwritten while we were
+	 * copying */
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t head_after =
+		atomic_load_explicit(&timings->head, memory_order_relaxed);
+	uint64_t first_after = first_valid_frame(head_after);
+	if (first_after > first) {
+		size_t stale = first_after - first;
+		if (stale >= n) {
+			return 0;
+		}
+		memmove(dest, &dest[stale], (n - stale) * sizeof(dest[0]));
+		n -= stale;
+	}
+	return n;
+}
+
+static int cmp_int64(const void *_a, const void *_b) {
+	const int64_t *a = _a, *b = _b;
+	return (*a > *b) - (*a < *b);
+}
+
+/**
+ * Formats the name of the report, along with the foveation settings of its
+ * frames.
+ */
+static void format_label(char *label, size_t size, const char *name,
+		const struct wxrc_frame_timing *frames, size_t n) {
+	const struct wxrc_frame_timing *last = &frames[n - 1];
+	bool mixed = false;
+	for (size_t i = 0; i < n; i++) {
+		mixed = mixed ||
+			frames[i].foveation_inset_size != last->foveation_inset_size ||
+			frames[i].foveation_periphery_scale !=
+			last->foveation_periphery_scale;
+	}
+
+	if (mixed) {
+		snprintf(label, size, "%s (mixed foveation settings)", name);
+	} else if (last->foveation_inset_size > 0) {
+		snprintf(label, size, "%s (foveated: %.0f%% inset, periphery at "
+			"%.0f%% resolution)", name, last->foveation_inset_size * 100.0,
+			last->foveation_periphery_scale * 100.0);
+	} else {
+		snprintf(label, size, "%s", name);
+	}
+}
+
+static void report_durations(const char *name, int64_t *durations, size_t n) {
+	qsort(durations, n, sizeof(int64_t), cmp_int64);
+
+	int64_t sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		sum += durations[i];
+	}
+	size_t p99 = (n * 99) / 100;
+	if (p99 >= n) {
+		p99 = n - 1;
+	}
+
+	wlr_log(WLR_INFO, "\t%-16s min %7.3f ms, avg %7.3f ms, p99 %7.3f ms",
+		name, durations[0] / 1e6, (double)sum / n / 1e6,
+		durations[p99] / 1e6);
+}
+
+void wxrc_frame_timings_report(struct wxrc_frame_timings *timings,
+		const char *name) {
+	struct wxrc_frame_timing *frames =
+		calloc(WXRC_FRAME_TIMING_HISTORY, sizeof(*frames));
+	int64_t *durations = calloc(WXRC_FRAME_TIMING_HISTORY, sizeof(int64_t));
+	if (frames == NULL || durations == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		goto exit;
+	}
+
+	size_t n = timings_snapshot(timings, frames);
+	if (n == 0) {
+		wlr_log(WLR_INFO, "No %s timings recorded yet", name);
+		goto exit;
+	}
+
+	size_t over_budget = 0;
+	for (size_t i = 0; i < n; i++) {
+		durations[i] = frames[i].end_ns - frames[i].begin_ns;
+		/* Time spent blocked in xrWaitFrame or sleeping until the latch
+		 * deadline doesn't count against the budget */
+		int64_t busy_ns = durations[i] -
+			frames[i].phase_ns[WXRC_FRAME_PHASE_WAIT_FRAME] -
+			frames[i].phase_ns[WXRC_FRAME_PHASE_LATCH_WAIT];
+		if (frames[i].predicted_display_period > 0 &&
+				busy_ns > frames[i].predicted_display_period) {
+			over_budget++;
+		}
+	}
+
+	char label[128];
+	format_label(label, sizeof(label), name, frames, n);
+	wlr_log(WLR_INFO, "%s timings over the last %zu frames "
+		"(%zu over the display period):", label, n, over_budget);
+	report_durations("total", durations, n);
+
+	for (size_t phase = 0; phase < WXRC_FRAME_PHASE_COUNT; phase++) {
+		bool ran = false;
+		for (size_t i = 0; i < n; i++) {
+			durations[i] = frames[i].phase_ns[phase];
+			ran = ran || durations[i] != 0;
+		}
+		if (ran) {
+			report_durations(phase_names[phase], durations, n);
+		}
+	}
+
+	/* GPU passes are only reported over the frames which have them */
+	for (size_t pass = 0; pass < WXRC_GPU_PASS_COUNT; pass++) {
+		size_t m = 0;
+		bool ran = false;
+		for (size_t i = 0; i < n; i++) {
+			if (frames[i].has_gpu_passes) {
+				durations[m++] = frames[i].gpu_pass_ns[pass];
+				ran = ran || frames[i].gpu_pass_ns[pass] != 0;
+			}
+		}
+		if (ran) {
+			report_durations(gpu_pass_names[pass], durations, m);
+		}
+	}
+
+	for (size_t counter = 0; counter < WXRC_FRAME_COUNTER_COUNT; counter++) {
+		int64_t sum = 0;
+		for (size_t i = 0; i < n; i++) {
+			sum += frames[i].counters[counter];
+		}
+		if (sum != 0) {
+			wlr_log(WLR_INFO, "\t%-16s avg %7.3f per frame, total %" PRId64,
+				counter_names[counter], (double)sum / n, sum);
+		}
+	}
+
+exit:
+	free(frames);
+	free(durations);
+}
@@ -0,0 +1,721 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/interfaces/wlr_input_device.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+#include "backend.h"
+#include "server.h"
+#include "timing.h"
+#include "trace.h"
+
+/*
+ * A trace is a header followed by a sequence of records. Each record starts
+ * with a trace_record_header and is followed by its payload. Everything is
+ * stored in native byte order: traces are meant to be replayed on the machine
+ * which recorded them, or one just like it.
+ */
+
+#define WXRC_TRACE_MAGIC "wxrctrc"
+#define WXRC_TRACE_VERSION 2
+#define WXRC_TRACE_MAX_VIEWS 4
+
+enum trace_record_type {
+	TRACE_RECORD_FRAME,
+	TRACE_RECORD_POINTER_MOTION,
+	TRACE_RECORD_POINTER_BUTTON,
+	TRACE_RECORD_POINTER_AXIS,
+	TRACE_RECORD_POINTER_FRAME,
+	TRACE_RECORD_KEYBOARD_KEY,
+	TRACE_RECORD_KEYBOARD_MODIFIERS,
+	TRACE_RECORD_COMMIT,
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nviews;
+};
+
+struct trace_record_header {
+	uint16_t type; // enum trace_record_type
+	uint16_t size; // of the payload
+	/* For frames, the render thread's frame number. For other records,
+	 * the number of render thread frames latched before them. */
+	uint32_t frame;
+	/* Since the start of the recording */
+	int64_t time_ns;
+};
+
+struct trace_view {
+	float orientation[4];
+	float position[3];
+	float fov[4];
+};
+
+struct trace_frame {
+	int64_t display_time_ns;
+	uint32_t nviews;
+	uint32_t pad;
+	struct trace_view views[WXRC_TRACE_MAX_VIEWS];
+};
+
+struct trace_pointer_motion {
+	uint32_t time_msec;
+	uint32_t pad;
+	double delta_x, delta_y;
+	double unaccel_dx, unaccel_dy;
+};
+
+struct trace_pointer_button {
+	uint32_t time_msec;
+	uint32_t button;
+	uint32_t state;
+};
+
+struct trace_pointer_axis {
+	uint32_t time_msec;
+	uint32_t source;
+	uint32_t orientation;
+	int32_t delta_discrete;
+	double delta;
+};
+
+struct trace_keyboard_key {
+	uint32_t time_msec;
+	uint32_t keycode;
+	uint32_t update_state;
+	uint32_t state;
+};
+
+struct trace_keyboard_modifiers {
+	uint32_t depressed, latched, locked, group;
+};
+
+struct trace_commit {
+	uint32_t surface_id;
+};
+
+struct trace_surface {
+	struct wxrc_trace *trace;
+	uint32_t id;
+
+	struct wl_listener commit;
+	struct wl_listener destroy;
+	struct wl_list link; // wxrc_trace.surfaces
+};
+
+struct wxrc_trace {
+	struct wxrc_server *server;
+	bool replay;
+	uint32_t nviews;
+	/* Number of render thread frames latched so far */
+	uint32_t frame;
+
+	/* Recording */
+	FILE *file;
+	int64_t start_ns;
+	uint32_t next_surface_id;
+	struct wl_list surfaces;
+	struct wl_listener new_surface;
+
+	/* Replay */
+	uint8_t *data;
+	size_t size;
+	/* Frame records, by increasing frame number */
+	size_t *frame_offsets;
+	size_t nframes;
+	/* Render thread frames covered by the trace */
+	uint32_t frame_count;
+	size_t *event_offsets;
+	size_t nevents, next_event;
+
+	struct wlr_input_device pointer_device;
+	struct wlr_pointer pointer;
+	struct wlr_input_device keyboard_device;
+	struct wlr_keyboard keyboard;
+};
+
+static void trace_write(struct wxrc_trace *trace, enum trace_record_type type,
+		const void *payload, size_t size) {
+	if (trace == NULL || trace->replay || trace->file == NULL) {
+		return;
+	}
+
+	struct trace_record_header header = {
+		.type = type,
+		.size = size,
+		.frame = trace->frame,
+		.time_ns = wxrc_get_time_ns() - trace->start_ns,
+	};
+	if (fwrite(&header, sizeof(header), 1, trace->file) != 1 ||
+			(size > 0 && fwrite(payload, size, 1, trace->file) != 1)) {
+		wlr_log_errno(WLR_ERROR, "Failed to write trace, stopping recording");
+		fclose(trace->file);
+		trace->file = NULL;
+	}
+}
+
+static void trace_surface_destroy(struct trace_surface *surface) {
+	wl_list_remove(&surface->commit.link);
+	wl_list_remove(&surface->destroy.link);
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static void trace_surface_handle_commit(struct wl_listener *listener,
+		void *data) {
+	struct trace_surface *surface = wl_container_of(listener, surface, commit);
+	struct trace_commit commit = {
+		.surface_id = surface->id,
+	};
+	trace_write(surface->trace, TRACE_RECORD_COMMIT, &commit, sizeof(commit));
+}
+
+static void trace_surface_handle_destroy(struct wl_listener *listener,
+		void *data) {
+	struct trace_surface *surface = wl_container_of(listener, surface, destroy);
+	trace_surface_destroy(surface);
+}
+
+static void trace_handle_new_surface(struct wl_listener *listener,
+		void *data) {
+	struct wxrc_trace *trace = wl_container_of(listener, trace, new_surface);
+	struct wlr_surface *wlr_surface = data;
+
+	struct trace_surface *surface = calloc(1, sizeof(*surface));
+	if (surface == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return;
+	}
+	surface->trace = trace;
+	surface->id = trace->next_surface_id++;
+
+	surface->commit.notify = trace_surface_handle_commit;
+	wl_signal_add(&wlr_surface->events.commit, &surface->commit);
+	surface->destroy.notify = trace_surface_handle_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &surface->destroy);
+	wl_list_insert(&trace->surfaces, &surface->link);
+}
+
+struct wxrc_trace *wxrc_trace_create_recorder(struct wxrc_server *server,
+		const char *path) {
+	struct wxrc_trace *trace = calloc(1, sizeof(*trace));
+	if (trace == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return NULL;
+	}
+	trace->server = server;
+	trace->nviews = server->xr_backend->nviews;
+	wl_list_init(&trace->surfaces);
+
+	if (trace->nviews > WXRC_TRACE_MAX_VIEWS) {
+		wlr_log(WLR_ERROR, "Can't record more than %d views",
+			WXRC_TRACE_MAX_VIEWS);
+		free(trace);
+		return NULL;
+	}
+
+	trace->file = fopen(path, "wb");
+	if (trace->file == NULL) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s", path);
+		free(trace);
+		return NULL;
+	}
+
+	struct trace_header header = {
+		.magic = WXRC_TRACE_MAGIC,
+		.version = WXRC_TRACE_VERSION,
+		.nviews = trace->nviews,
+	};
+	if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+		wlr_log_errno(WLR_ERROR, "Failed to write trace header");
+		fclose(trace->file);
+		free(trace);
+		return NULL;
+	}
+	trace->start_ns = wxrc_get_time_ns();
+
+	trace->new_surface.notify = trace_handle_new_surface;
+	wl_signal_add(&server->compositor->events.new_surface,
+		&trace->new_surface);
+
+	wlr_log(WLR_INFO, "Recording trace to %s", path);
+	return trace;
+}
+
+static bool trace_load(struct wxrc_trace *trace, const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s", path);
+		return false;
+	}
+
+	bool ok = false;
+	if (fseek(f, 0, SEEK_END) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to seek %s", path);
+		goto exit;
+	}
+	long size = ftell(f);
+	if (size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to seek %s", path);
+		goto exit;
+	}
+	trace->size = size;
+	trace->data = malloc(trace->size);
+	if (trace->data == NULL) {
+		wlr_log_errno(WLR_ERROR, "malloc failed");
+		goto exit;
+	}
+	if (trace->size > 0 && fread(trace->data, trace->size, 1, f) != 1) {
+		wlr_log_errno(WLR_ERROR, "Failed to read %s", path);
+		goto exit;
+	}
+	ok = true;
+
+exit:
+	fclose(f);
+	return ok;
+}
+
+static bool trace_index(struct wxrc_trace *trace) {
+	struct trace_header header;
+	if (trace->size < sizeof(header)) {
+		wlr_log(WLR_ERROR, "Trace is truncated");
+		return false;
+	}
+	memcpy(&header, trace->data, sizeof(header));
+	if (memcmp(header.magic, WXRC_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != WXRC_TRACE_VERSION) {
+		wlr_log(WLR_ERROR, "Not a wxrc trace, or unsupported version");
+		return false;
+	}
+	trace->nviews = header.nviews;
+
+	/* First pass to count records, second pass to index them */
+	size_t ncommits = 0;
+	uint32_t nsurfaces = 0;
+	int64_t duration_ns = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		trace->nframes = trace->nevents = 0;
+
+		size_t offset = sizeof(header);
+		while (offset < trace->size) {
+			struct trace_record_header record;
+			if (trace->size - offset < sizeof(record)) {
+				wlr_log(WLR_ERROR, "Trace is truncated");
+				return false;
+			}
+			memcpy(&record, trace->data + offset, sizeof(record));
+			if (trace->size - offset - sizeof(record) < record.size) {
+				wlr_log(WLR_ERROR, "Trace is truncated");
+				return false;
+			}
+
+			switch (record.type) {
+			case TRACE_RECORD_FRAME:
+				if (pass == 1) {
+					trace->frame_offsets[trace->nframes] = offset;
+				}
+				trace->nframes++;
+				trace->frame_count = record.frame + 1;
+				break;
+			case TRACE_RECORD_COMMIT:
+				if (pass == 0) {
+					struct trace_commit commit = {0};
+					memcpy(&commit, trace->data + offset + sizeof(record),
+						record.size < sizeof(commit) ?
+						record.size : sizeof(commit));
+					ncommits++;
+					if (commit.surface_id >= nsurfaces) {
+						nsurfaces = commit.surface_id + 1;
+					}
+				}
+				break;
+			default:
+				if (pass == 1) {
+					trace->event_offsets[trace->nevents] = offset;
+				}
+				trace->nevents++;
+				break;
+			}
+
+			duration_ns = record.time_ns;
+			offset += sizeof(record) + record.size;
+		}
+
+		if (pass == 0) {
+			trace->frame_offsets = calloc(trace->nframes + 1, sizeof(size_t));
+			trace->event_offsets = calloc(trace->nevents + 1, sizeof(size_t));
+			if (trace->frame_offsets == NULL || trace->event_offsets == NULL) {
+				wlr_log_errno(WLR_ERROR, "calloc failed");
+				return false;
+			}
+		}
+	}
+
+	double duration_s = duration_ns / 1e9;
+	wlr_log(WLR_INFO, "Trace: %u frames (%zu recorded) and %zu input events "
+		"over %.2f s, %zu commits from %u surfaces (%.1f commits/s)",
+		trace->frame_count, trace->nframes, trace->nevents, duration_s,
+		ncommits, nsurfaces,
+		duration_s > 0 ? ncommits / duration_s : 0.0);
+	return true;
+}
+
+static void virtual_input_device_destroy(struct wlr_input_device *device) {
+	// The device is embedded in the trace
+}
+
+static const struct wlr_input_device_impl virtual_input_device_impl = {
+	.destroy = virtual_input_device_destroy,
+};
+
+static void virtual_pointer_destroy(struct wlr_pointer *pointer) {
+	// The pointer is embedded in the trace
+}
+
+static const struct wlr_pointer_impl virtual_pointer_impl = {
+	.destroy = virtual_pointer_destroy,
+};
+
+static void virtual_keyboard_destroy(struct wlr_keyboard *keyboard) {
+	// The keyboard is embedded in the trace
+}
+
+static void virtual_keyboard_led_update(struct wlr_keyboard *keyboard,
+		uint32_t leds) {
+	// This space deliberately left blank
+}
+
+static const struct wlr_keyboard_impl virtual_keyboard_impl = {
+	.destroy = virtual_keyboard_destroy,
+	.led_update = virtual_keyboard_led_update,
+};
+
+static void trace_create_virtual_devices(struct wxrc_trace *trace) {
+	struct wlr_backend *backend = trace->server->backend;
+
+	wlr_input_device_init(&trace->pointer_device, WLR_INPUT_DEVICE_POINTER,
+		&virtual_input_device_impl, "wxrc-replay-pointer", 0, 0);
+	wlr_pointer_init(&trace->pointer, &virtual_pointer_impl);
+	trace->pointer_device.pointer = &trace->pointer;
+	wl_signal_emit(&backend->events.new_input, &trace->pointer_device);
+
+	wlr_input_device_init(&trace->keyboard_device, WLR_INPUT_DEVICE_KEYBOARD,
+		&virtual_input_device_impl, "wxrc-replay-keyboard", 0, 0);
+	wlr_keyboard_init(&trace->keyboard, &virtual_keyboard_impl);
+	trace->keyboard_device.keyboard = &trace->keyboard;
+	wl_signal_emit(&backend->events.new_input, &trace->keyboard_device);
+}
+
+static void trace_replay_event(struct wxrc_trace *trace,
+		const struct trace_record_header *record, const uint8_t *payload) {
+	switch (record->type) {
+	case TRACE_RECORD_POINTER_MOTION:;
+		struct trace_pointer_motion motion = {0};
+		memcpy(&motion, payload, record->size < sizeof(motion) ?
+			record->size : sizeof(motion));
+		struct wlr_event_pointer_motion motion_event = {
+			.device = &trace->pointer_device,
+			.time_msec = motion.time_msec,
+			.delta_x = motion.delta_x,
+			.delta_y = motion.delta_y,
+			.unaccel_dx = motion.unaccel_dx,
+			.unaccel_dy = motion.unaccel_dy,
+		};
+		wl_signal_emit(&trace->pointer.events.motion, &motion_event);
+		break;
+	case TRACE_RECORD_POINTER_BUTTON:;
+		struct trace_pointer_button button = {0};
+		memcpy(&button, payload, record->size < sizeof(button) ?
+			record->size : sizeof(button));
+		struct wlr_event_pointer_button button_event = {
+			.device = &trace->pointer_device,
+			.time_msec = button.time_msec,
+			.button = button.button,
+			.state = button.state,
+		};
+		wl_signal_emit(&trace->pointer.events.button, &button_event);
+		break;
+	case TRACE_RECORD_POINTER_AXIS:;
+		struct trace_pointer_axis axis = {0};
+		memcpy(&axis, payload, record->size < sizeof(axis) ?
+			record->size : sizeof(axis));
+		struct wlr_event_pointer_axis axis_event = {
+			.device = &trace->pointer_device,
+			.time_msec = axis.time_msec,
+			.source = axis.source,
+			.orientation = axis.orientation,
+			.delta = axis.delta,
+			.delta_discrete = axis.delta_discrete,
+		};
+		wl_signal_emit(&trace->pointer.events.axis, &axis_event);
+		break;
+	case TRACE_RECORD_POINTER_FRAME:
+		wl_signal_emit(&trace->pointer.events.frame, &trace->pointer);
+		break;
+	case TRACE_RECORD_KEYBOARD_KEY:;
+		struct trace_keyboard_key key = {0};
+		memcpy(&key, payload, record->size < sizeof(key) ?
+			record->size : sizeof(key));
+		struct wlr_event_keyboard_key key_event = {
+			.time_msec = key.time_msec,
+			.keycode = key.keycode,
+			.update_state = key.update_state,
+			.state = key.state,
+		};
+		wlr_keyboard_notify_key(&trace->keyboard, &key_event);
+		break;
+	case TRACE_RECORD_KEYBOARD_MODIFIERS:;
+		struct trace_keyboard_modifiers modifiers = {0};
+		memcpy(&modifiers, payload, record->size < sizeof(modifiers) ?
+			record->size : sizeof(modifiers));
+		wlr_keyboard_notify_modifiers(&trace->keyboard, modifiers.depressed,
+			modifiers.latched, modifiers.locked, modifiers.group);
+		break;
+	default:
+		wlr_log(WLR_DEBUG, "Skipping unknown trace record type %d",
+			record->type);
+		break;
+	}
+}
+
+/**
+ * Replays all input events which were recorded before the current frame.
+ */
+static void trace_replay_events(struct wxrc_trace *trace) {
+	while (trace->next_event < trace->nevents) {
+		size_t offset = trace->event_offsets[trace->next_event];
+		struct trace_record_header record;
+		memcpy(&record, trace->data + offset, sizeof(record));
+		if (record.frame > trace->frame) {
+			break;
+		}
+
+		trace_replay_event(trace, &record,
+			trace->data + offset + sizeof(record));
+		trace->next_event++;
+	}
+}
+
+struct wxrc_trace *wxrc_trace_create_replayer(struct wxrc_server *server,
+		const char *path) {
+	struct wxrc_trace *trace = calloc(1, sizeof(*trace));
+	if (trace == NULL) {
+		wlr_log_errno(WLR_ERROR, "calloc failed");
+		return NULL;
+	}
+	trace->server = server;
+	trace->replay = true;
+	wl_list_init(&trace->surfaces);
+
+	if (!trace_load(trace, path) || !trace_index(trace)) {
+		wxrc_trace_destroy(trace);
+		return NULL;
+	}
+
+	trace_create_virtual_devices(trace);
+	trace_replay_events(trace);
+
+	wlr_log(WLR_INFO, "Replaying trace from %s", path);
+	return trace;
+}
+
+void wxrc_trace_destroy(struct wxrc_trace *trace) {
+	if (trace == NULL) {
+		return;
+	}
+
+	if (trace->replay) {
+		wlr_log(WLR_INFO, "Replayed %u of %u frames, %zu of %zu input events",
+			trace->frame, trace->frame_count, trace->next_event,
+			trace->nevents);
+	} else {
+		struct trace_surface *surface, *tmp;
+		wl_list_for_each_safe(surface, tmp, &trace->surfaces, link) {
+			trace_surface_destroy(surface);
+		}
+		wl_list_remove(&trace->new_surface.link);
+		if (trace->file != NULL) {
+			fclose(trace->file);
+		}
+	}
+
+	/* Virtual input devices are kept alive until exit, the seat may still
+	 * reference them */
+	free(trace->frame_offsets);
+	free(trace->event_offsets);
+	free(trace->data);
+	free(trace);
+}
+
+void wxrc_trace_handle_frame(struct wxrc_trace *trace, uint64_t frame_number,
+		const struct timespec *display_time, const XrView *xr_views,
+		uint32_t nviews) {
+	if (trace == NULL) {
+		return;
+	}
+
+	/* Frame events are coalesced, so frame numbers may be skipped */
+	if (trace->replay) {
+		trace->frame = frame_number + 1;
+		trace_replay_events(trace);
+		return;
+	}
+
+	struct trace_frame frame = {
+		.display_time_ns = (int64_t)display_time->tv_sec * 1000000000 +
+			display_time->tv_nsec - trace->start_ns,
+		.nviews = nviews,
+	};
+	for (uint32_t i = 0; i < nviews && i < WXRC_TRACE_MAX_VIEWS; i++) {
+		const XrView *xr_view = &xr_views[i];
+		struct trace_view *view = &frame.views[i];
+		view->orientation[0] = xr_view->pose.orientation.x;
+		view->orientation[1] = xr_view->pose.orientation.y;
+		view->orientation[2] = xr_view->pose.orientation.z;
+		view->orientation[3] = xr_view->pose.orientation.w;
+		view->position[0] = xr_view->pose.position.x;
+		view->position[1] = xr_view->pose.position.y;
+		view->position[2] = xr_view->pose.position.z;
+		view->fov[0] = xr_view->fov.angleLeft;
+		view->fov[1] = xr_view->fov.angleRight;
+		view->fov[2] = xr_view->fov.angleUp;
+		view->fov[3] = xr_view->fov.angleDown;
+	}
+	size_t size = offsetof(struct trace_frame, views) +
+		frame.nviews * sizeof(struct trace_view);
+	trace->frame = frame_number;
+	trace_write(trace, TRACE_RECORD_FRAME, &frame, size);
+	trace->frame = frame_number + 1;
+}
+
+void wxrc_trace_record_pointer_motion(struct wxrc_trace *trace,
+		const struct wlr_event_pointer_motion *event) {
+	struct trace_pointer_motion motion = {
+		.time_msec = event->time_msec,
+		.delta_x = event->delta_x,
+		.delta_y = event->delta_y,
+		.unaccel_dx = event->unaccel_dx,
+		.unaccel_dy = event->unaccel_dy,
+	};
+	trace_write(trace, TRACE_RECORD_POINTER_MOTION, &motion, sizeof(motion));
+}
+
+void wxrc_trace_record_pointer_button(struct wxrc_trace *trace,
+		const struct wlr_event_pointer_button *event) {
+	struct trace_pointer_button button = {
+		.time_msec = event->time_msec,
+		.button = event->button,
+		.state = event->state,
+	};
+	trace_write(trace, TRACE_RECORD_POINTER_BUTTON, &button, sizeof(button));
+}
+
+void wxrc_trace_record_pointer_axis(struct wxrc_trace *trace,
+		const struct wlr_event_pointer_axis *event) {
+	struct trace_pointer_axis axis = {
+		.time_msec = event->time_msec,
+		.source = event->source,
+		.orientation = event->orientation,
+		.delta_discrete = event->delta_discrete,
+		.delta = event->delta,
+	};
+	trace_write(trace, TRACE_RECORD_POINTER_AXIS, &axis, sizeof(axis));
+}
+
+void wxrc_trace_record_pointer_frame(struct wxrc_trace *trace) {
+	trace_write(trace, TRACE_RECORD_POINTER_FRAME, NULL, 0);
+}
+
+void wxrc_trace_record_keyboard_key(struct wxrc_trace *trace,
+		const struct wlr_event_keyboard_key *event) {
+	struct trace_keyboard_key key = {
+		.time_msec = event->time_msec,
+		.keycode = event->keycode,
+		.update_state = event->update_state,
+		.state = event->state,
+	};
+	trace_write(trace, TRACE_RECORD_KEYBOARD_KEY, &key, sizeof(key));
+}
+
+void wxrc_trace_record_keyboard_modifiers(struct wxrc_trace *trace,
+		const struct wlr_keyboard_modifiers *modifiers) {
+	struct trace_keyboard_modifiers mods = {
+		.depressed = modifiers->depressed,
+		.latched = modifiers->latched,
+		.locked = modifiers->locked,
+		.group = modifiers->group,
+	};
+	trace_write(trace, TRACE_RECORD_KEYBOARD_MODIFIERS, &mods, sizeof(mods));
+}
+
+size_t wxrc_trace_get_frame_count(struct wxrc_trace *trace) {
+	return trace->frame_count;
+}
+
+static uint32_t trace_get_frame_number(struct wxrc_trace *trace,
+		size_t index) {
+	struct trace_record_header record;
+	memcpy(&record, trace->data + trace->frame_offsets[index], sizeof(record));
+	return record.frame;
+}
+
+bool wxrc_trace_get_frame_views(struct wxrc_trace *trace, size_t frame_number,
+		XrView *xr_views, uint32_t nviews) {
+	if (trace->nframes == 0) {
+		return false;
+	}
+
+	/* Latest frame recorded at or before this one, or the first one */
+	size_t lo = 0, hi = trace->nframes;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (trace_get_frame_number(trace, mid) <= frame_number) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	size_t offset = trace->frame_offsets[lo];
+	struct trace_record_header record;
+	memcpy(&record, trace->data + offset, sizeof(record));
+
+	struct trace_frame frame = {0};
+	memcpy(&frame, trace->data + offset + sizeof(record),
+		record.size < sizeof(frame) ? record.size : sizeof(frame));
+	if (frame.nviews != nviews || nviews > WXRC_TRACE_MAX_VIEWS) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < nviews; i++) {
+		struct trace_view *view = &frame.views[i];
+		XrView *xr_view = &xr_views[i];
+		xr_view->pose.orientation = (XrQuaternionf){
+			.x = view->orientation[0],
+			.y = view->orientation[1],
+			.z = view->orientation[2],
+			.w = view->orientation[3],
+		};
+		xr_view->pose.position = (XrVector3f){
+			.x = view->position[0],
+			.y = view->position[1],
+			.z = view->position[2],
+		};
+		xr_view->fov = (XrFovf){
+			.angleLeft = view->fov[0],
+			.angleRight = view->fov[1],
+			.angleUp = view->fov[2],
+			.angleDown = view->fov[3],
+		};
+	}
+	return true;
+}
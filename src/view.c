@@ -8,12 +8,15 @@ void wxrc_view_init(struct wxrc_view *view, struct wxrc_server *server,
 	view->server = server;
 	view->impl = impl;
 	view->surface = surface;
+	view->id = ++server->last_view_id;
 
 	wl_list_insert(server->views.prev, &view->link);
+	server->scene_dirty = true;
 }
 
 void wxrc_view_finish(struct wxrc_view *view) {
 	wl_list_remove(&view->link);
+	view->server->scene_dirty = true;
 }
 
 void wxrc_view_get_model_matrix(struct wxrc_view *view, mat4 model_matrix) {
@@ -82,6 +85,7 @@ void wxrc_set_focus(struct wxrc_view *view) {
 
 	wl_list_remove(&view->link);
 	wl_list_insert(&server->views, &view->link);
+	server->scene_dirty = true;
 
 	struct wlr_seat *seat = server->seat;
 	struct wlr_keyboard *keyboard = wlr_seat_get_keyboard(seat);
@@ -93,11 +93,13 @@ static void handle_xdg_surface_map(struct wl_listener *listener, void *data) {
 
 	wxrc_set_focus(&view->base);
 	view->base.mapped = true;
+	view->base.server->scene_dirty = true;
 }
 
 static void handle_xdg_surface_unmap(struct wl_listener *listener, void *data) {
 	struct wxrc_xdg_shell_view *view = wl_container_of(listener, view, unmap);
 	view->base.mapped = false;
+	view->base.server->scene_dirty = true;
 
 	struct wxrc_view *wview;
 	wl_list_for_each(wview, &view->base.server->views, link) {
@@ -45,7 +45,7 @@ struct wxrc_zxr_composite_buffer_v1 *wxrc_zxr_composite_buffer_v1_from_buffer(
 	return composite_buffer_from_resource(buffer->resource);
 }
 
-struct wlr_texture *wxrc_zxr_composite_buffer_v1_for_view(
+struct wlr_buffer *wxrc_zxr_composite_buffer_v1_buffer_for_view(
 		struct wxrc_zxr_composite_buffer_v1 *buffer,
 		struct wxrc_zxr_view_v1 *view,
 		enum zxr_composite_buffer_v1_buffer_type buffer_type) {
@@ -54,12 +54,24 @@ struct wlr_texture *wxrc_zxr_composite_buffer_v1_for_view(
 		if (vb->view == view
 				&& vb->buffer_type == buffer_type
 				&& vb->buffer != NULL) {
-			return vb->buffer->texture;
+			return vb->buffer;
 		}
 	}
 	return NULL;
 }
 
+struct wlr_texture *wxrc_zxr_composite_buffer_v1_for_view(
+		struct wxrc_zxr_composite_buffer_v1 *buffer,
+		struct wxrc_zxr_view_v1 *view,
+		enum zxr_composite_buffer_v1_buffer_type buffer_type) {
+	struct wlr_buffer *wlr_buffer = wxrc_zxr_composite_buffer_v1_buffer_for_view(
+		buffer, view, buffer_type);
+	if (wlr_buffer == NULL) {
+		return NULL;
+	}
+	return wlr_buffer->texture;
+}
+
 static const struct wl_buffer_interface composite_wl_buffer_impl = {
 	.destroy = composite_buffer_handle_destroy,
 };
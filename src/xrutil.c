@@ -301,6 +301,33 @@ const char *wxrc_xr_structure_type_str(XrStructureType t) {
 	}
 }
 
+const char *wxrc_xr_session_state_str(XrSessionState s) {
+	static char state[64];
+	switch (s) {
+	case XR_SESSION_STATE_UNKNOWN:
+		return "XR_SESSION_STATE_UNKNOWN";
+	case XR_SESSION_STATE_IDLE:
+		return "XR_SESSION_STATE_IDLE";
+	case XR_SESSION_STATE_READY:
+		return "XR_SESSION_STATE_READY";
+	case XR_SESSION_STATE_SYNCHRONIZED:
+		return "XR_SESSION_STATE_SYNCHRONIZED";
+	case XR_SESSION_STATE_VISIBLE:
+		return "XR_SESSION_STATE_VISIBLE";
+	case XR_SESSION_STATE_FOCUSED:
+		return "XR_SESSION_STATE_FOCUSED";
+	case XR_SESSION_STATE_STOPPING:
+		return "XR_SESSION_STATE_STOPPING";
+	case XR_SESSION_STATE_LOSS_PENDING:
+		return "XR_SESSION_STATE_LOSS_PENDING";
+	case XR_SESSION_STATE_EXITING:
+		return "XR_SESSION_STATE_EXITING";
+	default:
+		sprintf(state, "Unknown XR session state %d", (int)s);
+		return state;
+	}
+}
+
 void wxrc_log_xr_result(const char *entrypoint, XrResult r) {
 	wlr_log(XR_FAILED(r) ? WLR_ERROR : WLR_DEBUG,
 			"%s: %s", entrypoint, wxrc_xr_result_str(r));